@@ -0,0 +1,72 @@
+#ifndef _COMMON_DYNAMICRESOLUTION_H_
+#define _COMMON_DYNAMICRESOLUTION_H_
+
+#include <stdint.h>
+
+#include "GpuTimer.h"
+
+namespace common {
+
+struct DynamicResolutionStats {
+    float Scale = 1.0f;     // of each axis
+    int32_t Width = 0;      // scene resolution
+    int32_t Height = 0;
+    double GpuMs = 0.0;     // last measured scene time
+    uint32_t Changes = 0;   // total
+};
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+// Renders the scene into an offscreen framebuffer sized to keep its GPU time
+// within a budget, then scales it up to the window with one linear blit;
+// whatever is drawn after endScene() stays at native resolution. The
+// framebuffer has the size of the window and a lower scale only uses its
+// lower left part, so changing the scale costs nothing but the viewport.
+//
+// The scale follows a PID controller in velocity form on the fraction of
+// window pixels drawn, which the GPU time is about proportional to. Errors
+// within a few percent of the budget are ignored so the scale settles.
+// Without timer queries the scene goes straight to the window.
+class DynamicResolution {
+public:
+    DynamicResolution();
+    ~DynamicResolution();
+
+    // GPU time of the scene to stay within, 0 turns scaling off; minScale
+    // bounds each axis. Before init().
+    void setBudget(double budgetMs, float minScale = 0.5f);
+    bool isEnabled() const { return m_budgetMs > 0.0; }
+
+    // with a current context, the window size
+    bool init(int32_t width, int32_t height);
+    void release();
+    bool isActive() const { return m_framebuffer != 0; }
+
+    // around the scene, endScene() leaves the window bound
+    void beginScene();
+    void endScene();
+
+    const DynamicResolutionStats &stats() const { return m_stats; }
+
+private:
+    void updateScale(double gpuMs);
+
+private:
+    GpuTimer m_timer;
+    GLuint m_framebuffer;
+    GLuint m_color;
+    GLuint m_depth;
+    int32_t m_width;
+    int32_t m_height;
+
+    double m_budgetMs;
+    float m_minScale;
+    // controller state, pixels drawn over window pixels and the last errors
+    double m_area;
+    double m_error[2];
+    DynamicResolutionStats m_stats;
+};
+#endif
+
+} // namespace common
+
+#endif // _COMMON_DYNAMICRESOLUTION_H_
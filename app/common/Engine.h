@@ -1,48 +1,144 @@
 #ifndef _COMMON_ENGINE_H_
 #define _COMMON_ENGINE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
 #ifdef __ANDROID__
 #include <android_native_app_glue.h>
+#include <android/choreographer.h>
 #endif
 
 #include "SensorManager.h"
 #include "GestureManager.h"
+#include "DynamicResolution.h"
+#include "GpuMemory.h"
+#include "Renderer.h"
+#include "SpscQueue.h"
 
 struct android_app;
 
 namespace common {
 
-class Renderer;
 class GLContext;
 
+// gesture detected on the looper thread, consumed by the render thread
+struct InputEvent {
+    GestureType Type = GESTURE_TYPE_NONE;
+    glm::vec2 Pointer;
+    // steady clock nanoseconds, the motion event time on android
+    int64_t TimeNs = 0;
+};
+
+// input event to the swap of the frame that handled it
+struct InputLatencyStats {
+    uint32_t Events = 0;
+    uint32_t Dropped = 0;   // queue full
+    double AvgMs = 0.0;
+    double MaxMs = 0.0;
+    double LastMs = 0.0;
+};
+
+// render thread time with focus, idle is the part spent waiting for a reason
+// to draw
+struct RenderLoopStats {
+    uint64_t Frames = 0;
+    double IdleMs = 0.0;
+    double TotalMs = 0.0;
+};
+
 class Engine {
 public:
     explicit Engine(const std::shared_ptr<Renderer> &renderer);
     ~Engine();
 
     // hanlde functions
-    static void handleCmd(struct android_app *app, int32_t cmd);
 #ifdef __ANDROID__
+    static void handleCmd(struct android_app *app, int32_t cmd);
     static int32_t handleInput(struct android_app *app, AInputEvent *event);
 #endif
 
     void setState(struct android_app *state);
     int onInitDisplay(struct android_app *app);
 
+    // The render thread owns the EGL context and draws while the engine has
+    // focus; the looper thread keeps input, sensors and lifecycle commands.
+    // Without it draw() is called by the owner of the context, as on host.
+    void startRenderThread();
+    // terminates the surface on the render thread and joins it
+    void stopRenderThread();
+    // runs on the render thread and waits for it, inline without one
+    void runOnRenderThread(const std::function<void()> &task);
+    void postToRenderThread(const std::function<void()> &task);
+    void setFocus(bool focus);
+    // Unless the renderer is continuous the render thread sleeps until a
+    // frame is due: after input, sensor changes, finished loads or this,
+    // from any thread, or when the renderer's requested frame comes up.
+    void invalidate();
+    // from the looper thread, false when the queue is full
+    bool postInput(const InputEvent &event);
+    uint64_t frameCount() const { return m_frameCount.load(std::memory_order_acquire); }
+    // read from the render thread or after stopRenderThread()
+    InputLatencyStats inputLatency() const;
+    RenderLoopStats renderLoopStats() const;
+
     void draw();
     void loadResources();
     void unloadResources();
 
     void terminate();
+    // APP_CMD_LOW_MEMORY, one tier further than the last warning unless
+    // that was a while ago
     void trimMemory();
+    // render thread, applies every tier up to level, nothing without
+    // loaded resources
+    void trimMemory(MemoryPressure level);
+    // render thread, back to the budgets set; after a while without
+    // warnings or with a new context
+    void relieveMemory();
+    // render thread, what the context's objects take, for HUDs and traces
+    util::GpuMemoryStats gpuMemory() const;
 
     bool isReady() const;
+    // time per frame spent on uploads of asynchronously loaded resources
+    void setUploadBudget(double ms) { m_uploadBudgetMs = ms; }
     SensorManagerPtr getSensorMgr() const { return m_sensorManager; }
+    // the scene's render scale, set its budget before the display is initialized
+    DynamicResolution *getDynamicResolution() { return &m_resolution; }
+
+    // any thread, the display's refresh rate for the frame pacer; on
+    // android setState() and the display's own changes keep it current
+    void setRefreshRate(float hz);
 
     // TODO: some camera, sensor functions
     void processSensors(int32_t id);
 
+private:
+    struct RenderTask {
+        std::function<void()> Run;
+        bool Done;
+    };
+
+    void renderLoop();
+    // with m_taskMutex held
+    bool frameDue() const;
+    void dispatchInput();
+    void recordInputLatency();
+#ifdef __ANDROID__
+    // looper thread, Display.getRefreshRate, 0 when it can't be read
+    float queryRefreshRate();
+    // looper thread, refresh rate changes from the choreographer, API 30
+    void watchRefreshRate();
+    void unwatchRefreshRate();
+    static void onRefreshRateChanged(int64_t vsyncPeriodNanos, void *data);
+#endif
+
 private:
     // TODO:
     // updateFps
@@ -56,11 +152,51 @@ private:
 
     // flag
     bool m_initializedResources;
-    bool m_hasFocus;
+    std::atomic<bool> m_hasFocus;
+
+    double m_uploadBudgetMs;
 
     // sensor
     SensorManagerPtr m_sensorManager;
 
+#ifdef __ANDROID__
+    // looper thread, registered for refresh rate changes on it
+    AChoreographer *m_choreographer;
+#endif
+
+    DynamicResolution m_resolution;
+
+    // render thread, tasks and focus changes wake it up
+    std::thread m_renderThread;
+    mutable std::mutex m_taskMutex;
+    std::condition_variable m_taskCondition;
+    std::deque<std::shared_ptr<RenderTask> > m_tasks;
+    bool m_running;
+    // a frame is due, under m_taskMutex
+    bool m_dirty;
+    // render thread, steady clock time of the frame the renderer asked for, 0 none
+    int64_t m_nextFrameNs;
+    RenderLoopStats m_loopStats;
+    std::atomic<uint64_t> m_frameCount;
+
+    // input, times of the events handled by the frame being drawn
+    util::SpscQueue<InputEvent, 256> m_input;
+    std::vector<int64_t> m_inputTimes;
+    std::atomic<uint32_t> m_droppedInput;
+    InputLatencyStats m_latency;
+    double m_latencySumMs;
+
+    // sensor update to swap, averaged over the last frames
+    int64_t m_frameNs;
+    // render thread, the next frame follows a pause
+    bool m_restartPacing;
+    // render thread, tier in effect and when it was trimmed to
+    MemoryPressure m_pressure;
+    int64_t m_trimNs;
+    // render thread, the last tier dropped the context, the next frame due
+    // creates it again
+    bool m_contextDropped;
+
     // TODO: tap, pinch, drag, perf...
 
     // TODO: camera
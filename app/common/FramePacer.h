@@ -0,0 +1,109 @@
+#ifndef _COMMON_FRAMEPACER_H_
+#define _COMMON_FRAMEPACER_H_
+
+#include <deque>
+#include <stdint.h>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace common {
+
+struct FramePacingStats {
+    uint32_t Frames = 0;
+    uint32_t Missed = 0;        // frames ready after their slot
+    uint32_t Waits = 0;         // swaps that waited for the GPU
+    double WaitMs = 0.0;
+    // swap to swap
+    double AvgIntervalMs = 0.0;
+    double JitterMs = 0.0;      // standard deviation of the interval
+    double MaxIntervalMs = 0.0;
+};
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+// Paces swaps to a fixed cadence of whole refresh periods, 60, 90 or 120 fps
+// or a fraction of the refresh rate, instead of queuing frames as fast as
+// the driver takes them. Each frame gets a slot on the cadence; with
+// EGL_ANDROID_presentation_time the compositor holds it until one refresh
+// after its slot, otherwise the swap interval keeps the rate. A frame
+// ready after its slot counts as missed and the cadence skips to the next
+// slot, keeping its phase.
+//
+// With EGL_KHR_fence_sync every swap is fenced and the CPU waits once more
+// than maxFramesInFlight frames are queued, so input is sampled for a frame
+// that is shown soon rather than after a stuffed queue drains. Surfaces
+// without vsync, like the host's pbuffer, are paced by sleeping until the
+// slot instead, and only when a target rate is set.
+class FramePacer {
+public:
+    FramePacer();
+    ~FramePacer();
+
+    // with the context current, looks up the extensions
+    void init(EGLDisplay display, bool vsync);
+    // before the display goes away
+    void release();
+
+    // of the display, 60 until told otherwise; the engine keeps it current
+    // on android
+    void setRefreshRate(float hz);
+    // rounded to a whole number of refresh periods, 0 follows the refresh
+    // rate through the divisor instead: 1 native, 2 half rate
+    void setTargetRate(float hz);
+    void setRateDivisor(int32_t divisor);
+    // 0 leaves the queue depth to the driver
+    void setMaxFramesInFlight(uint32_t frames) { m_maxFramesInFlight = frames; }
+
+    // the next frame starts a new cadence, after the loop was paused rather
+    // than late
+    void restart();
+    // around eglSwapBuffers
+    void beginSwap(EGLSurface surface);
+    void endSwap();
+
+    float targetRate() const;
+    // one refresh of the display, what a swapped frame waits to be shown
+    int64_t refreshPeriodNs() const { return m_refreshNs; }
+    int32_t swapInterval() const { return m_interval; }
+    uint32_t maxFramesInFlight() const { return m_maxFramesInFlight; }
+    bool hasPresentationTime() const { return m_presentationTime != nullptr; }
+    bool hasFences() const { return m_createSync != nullptr; }
+    const FramePacingStats &stats() const { return m_stats; }
+    void resetStats();
+
+private:
+    void waitOldest();
+
+private:
+    EGLDisplay m_display;
+    bool m_vsync;
+    PFNEGLPRESENTATIONTIMEANDROIDPROC m_presentationTime;
+    PFNEGLCREATESYNCKHRPROC m_createSync;
+    PFNEGLCLIENTWAITSYNCKHRPROC m_clientWaitSync;
+    PFNEGLDESTROYSYNCKHRPROC m_destroySync;
+
+    int64_t m_refreshNs;
+    float m_targetRate;
+    int32_t m_divisor;
+    int32_t m_interval;
+    // the swap interval has to be set again
+    bool m_intervalDirty;
+    uint32_t m_maxFramesInFlight;
+    // steady clock, slot of the frame being swapped
+    int64_t m_slotNs;
+    int64_t m_lastSwapNs;
+    std::deque<EGLSyncKHR> m_fences;
+
+    // running mean and squared deviations of the interval, in ms
+    uint32_t m_intervals;
+    double m_intervalMean;
+    double m_intervalM2;
+    FramePacingStats m_stats;
+};
+#endif
+
+} // namespace common
+
+#endif // _COMMON_FRAMEPACER_H_
@@ -1,10 +1,17 @@
 #ifndef _COMMON_GLCONTEXT_H_
 #define _COMMON_GLCONTEXT_H_
 
-#ifdef __ANDROID__
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
 #include <GLES3/gl32.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
+#include "GLStateCache.h"
+#include "FramePacer.h"
+#endif
+
+#ifdef QVIEWER_HOST
+// host builds render offscreen, the window is always null
+struct ANativeWindow;
 #endif
 
 // For local programming, no meaning
@@ -20,7 +27,7 @@ class GLContext
 public:
     static GLContext *Get();
 
-#ifdef __ANDROID__
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
     bool init(ANativeWindow *window);
     EGLint swap();
     EGLint resume(ANativeWindow *window);
@@ -35,7 +42,18 @@ public:
     int32_t getBufferColorSize() const { return m_colorSize; }
     int32_t getBufferDepthSize() const { return m_depthSize; }
     float getGLVersion() const { return m_glVersion; }
+    // in the current context's GL_EXTENSIONS
     bool checkExtension(const char *extension);
+    // in a space separated list, as GL_EXTENSIONS and EGL_EXTENSIONS are
+    static bool HasExtension(const char *extensions, const char *extension);
+    // shadowed GL state of this context, reset when the context is recreated
+    util::GLStateCache *getStateCache() { return &m_stateCache; }
+    // paces swap(), its settings outlive the context
+    FramePacer *getFramePacer() { return &m_pacer; }
+#ifdef QVIEWER_HOST
+    // size of the pbuffer used instead of a window, set before init()
+    void setSurfaceSize(int32_t width, int32_t height);
+#endif
 
 private:
     GLContext(GLContext const&);
@@ -47,6 +65,9 @@ private:
     void terminate();
     bool initEGLSurface();
     bool initEGLContext();
+    void initParallelCompile();
+    EGLDisplay getEGLDisplay() const;
+    EGLSurface createEGLSurface();
 
 private:
     // EGL configurations
@@ -67,6 +88,9 @@ private:
     bool m_eglContexInitialized;
     bool m_contextValid;
     float m_glVersion;
+
+    util::GLStateCache m_stateCache;
+    FramePacer m_pacer;
 #endif
 };
 } // namespace common
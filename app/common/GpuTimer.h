@@ -0,0 +1,48 @@
+#ifndef _COMMON_GPUTIMER_H_
+#define _COMMON_GPUTIMER_H_
+
+#include <stdint.h>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#include <GLES2/gl2ext.h>
+#endif
+
+namespace common {
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+// GPU time of a span of commands, one span per frame, through
+// GL_EXT_disjoint_timer_query. Results come back a few frames late and are
+// read without waiting; a ring of queries keeps the frames in between
+// measured. Spans the GPU reports as disjoint, e.g. across a frequency
+// change, are dropped.
+class GpuTimer {
+public:
+    GpuTimer();
+    ~GpuTimer();
+
+    // needs a current context, false without the extension
+    bool init();
+    void release();
+    bool isValid() const { return m_getQueryObjectui64v != nullptr; }
+
+    void begin();
+    void end();
+    // true with the newest finished span
+    bool poll(double &ms);
+
+private:
+    static const uint32_t QUERIES = 4;
+
+    PFNGLGETQUERYOBJECTUI64VEXTPROC m_getQueryObjectui64v;
+    GLuint m_queries[QUERIES];
+    // spans begun and read, the difference is in flight
+    uint32_t m_begun;
+    uint32_t m_read;
+    bool m_active;
+};
+#endif
+
+} // namespace common
+
+#endif // _COMMON_GPUTIMER_H_
@@ -8,9 +8,12 @@
 #include <android/log.h>
 #include <android/native_window_jni.h>
 #include <android/asset_manager.h>
+#elif defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
 #endif
 
 #include "SensorManager.h"
+#include "TextureManager.h"
 
 // For local programming, no meaning
 #if defined(__WIN32) || defined(__WIN64)
@@ -21,19 +24,61 @@
 
 namespace common {
 
+// Tiers of the response to memory pressure, each one costs more to come
+// back from than the one before. A tier applies all the ones below it.
+enum MemoryPressure {
+    MEMORY_PRESSURE_NONE,
+    // what can be rebuilt without the user noticing, e.g. texture levels
+    // finer than the last frame drew
+    MEMORY_PRESSURE_CACHES,
+    // smaller texture and LOD budgets, the scene looks coarser
+    MEMORY_PRESSURE_BUDGETS,
+    // what is out of view, it has to come back when it is in view again
+    MEMORY_PRESSURE_HIDDEN,
+    // the whole context, everything is loaded again
+    MEMORY_PRESSURE_CONTEXT
+};
+
 class Renderer {
 public:
     virtual ~Renderer() {}
-#ifdef __ANDROID__
     virtual void init() = 0;
-#endif
-    virtual GLint getTextureType() = 0;
+    // util::TextureFamily its textures are loaded in on this context
+    virtual GLint getTextureType() { return util::TextureManager::Get()->preferredFamily(); }
     virtual void render() = 0;
+    // after the scene is scaled up to the window, at native resolution, for UI
+    virtual void renderOverlay() {}
     virtual void unload() = 0;
+    // window coordinates in pixels, origin at the top left
+    virtual void onTap(float x, float y) {}
+    // gives back what the tier asks for, called once per tier up to the
+    // level of the pressure, NONE once it is over and budgets go back to
+    // normal; the engine handles textures and the context
+    virtual void trimMemory(MemoryPressure level) {}
     void bindSensor(const SensorManagerPtr &sensorMgr) { m_sensorManager = sensorMgr; }
 
+    // Drawn every frame when true. Otherwise the engine draws only after
+    // input, sensor changes, finished loads or a requestFrame().
+    virtual bool isContinuous() const { return false; }
+    // from render(), another frame after delayMs, e.g. the next animation
+    // step or results still on their way
+    void requestFrame(double delayMs = 0.0) {
+        if (m_frameDelayMs < 0.0 || delayMs < m_frameDelayMs) {
+            m_frameDelayMs = delayMs;
+        }
+    }
+    // engine, the delay of the requested frame or negative for none
+    double takeFrameRequest() {
+        double delayMs = m_frameDelayMs;
+        m_frameDelayMs = -1.0;
+        return delayMs;
+    }
+
 protected:
     SensorManagerPtr m_sensorManager;
+
+private:
+    double m_frameDelayMs = -1.0;
 };
 
 } // namespace common
@@ -0,0 +1,74 @@
+#ifndef _COMMON_SENSORFUSION_H_
+#define _COMMON_SENSORFUSION_H_
+
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace common {
+
+enum SensorType {
+    SENSOR_ACCELEROMETER = 1,
+    SENSOR_GYROSCOPE = 2,
+    // game rotation vector, fused by the platform without the magnetometer
+    SENSOR_ROTATION_VECTOR = 4
+};
+
+// one sensor event in the android sensor frame and time base
+struct SensorSample {
+    int64_t TimeNs = 0;
+    SensorType Type = SENSOR_ACCELEROMETER;
+    // m/s^2, rad/s, or the rotation as x, y, z, w
+    glm::vec4 Value;
+};
+
+// Complementary filter in the style of Mahony: gyroscope rates are
+// integrated into the orientation and the accelerometer, while it reads
+// about 1 g, pulls the estimated up vector back towards the measured one
+// with gain kp, which cancels the tilt drift of the gyroscope. A rotation
+// vector sample replaces the estimate, the platform fused it already.
+// Without a gyroscope the accelerometer alone levels the estimate.
+//
+// The orientation rotates device vectors into the world frame, z up. Yaw
+// drifts unless a rotation vector sensor keeps it.
+class OrientationFilter {
+public:
+    explicit OrientationFilter(float kp = 1.0f);
+
+    void reset();
+    // samples in time order
+    void update(const SensorSample &sample);
+
+    bool isValid() const { return m_timeNs != 0; }
+    const glm::quat &orientation() const { return m_orientation; }
+    // device frame, rad/s
+    const glm::vec3 &angularVelocity() const { return m_angularVelocity; }
+    // of the newest sample in the estimate
+    int64_t timeNs() const { return m_timeNs; }
+
+    // extrapolated with the last angular velocity; further than
+    // MAX_PREDICTION_NS past the newest sample the estimate is stale and
+    // returned as it is
+    glm::quat predict(int64_t timeNs) const;
+
+    static const int64_t MAX_PREDICTION_NS = 100000000;
+
+private:
+    void integrate(const glm::vec3 &rate, float dt);
+
+private:
+    float m_kp;
+    glm::quat m_orientation;
+    glm::vec3 m_angularVelocity;
+    // normalized, valid when m_hasGravity
+    glm::vec3 m_gravity;
+    bool m_hasGravity;
+    int64_t m_timeNs;
+    int64_t m_accelerometerTimeNs;
+    int64_t m_gyroscopeTimeNs;
+    int64_t m_rotationTimeNs;
+};
+
+} // namespace common
+
+#endif // _COMMON_SENSORFUSION_H_
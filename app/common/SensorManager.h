@@ -1,12 +1,21 @@
 #ifndef _COMMON_SENSORMANAGER_H_
 #define _COMMON_SENSORMANAGER_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <stdint.h>
+
+#include "SensorFusion.h"
+#include "SpscQueue.h"
 
 #ifdef __ANDROID__
 #include <jni.h>
 #include <android/sensor.h>
 #include <android_native_app_glue.h>
+#endif
+
+struct android_app;
 
 namespace common {
 enum ORIENTATION {
@@ -23,6 +32,15 @@ struct AcceleratorState {
     float Z = 0.0f;
 };
 
+// The looper thread reads sensor events in batches and queues them with
+// their timestamps; the render thread drains the queue into the orientation
+// filter once per frame, before rendering, and predicts the orientation for
+// the time that frame will be displayed.
+//
+// Event rates follow what the renderer reads: the gyroscope and rotation
+// vector only run while the orientation was asked for within the last
+// second, the accelerometer drops to a few events per second while neither
+// it nor the orientation is, just enough to notice a reader coming back.
 class SensorManager {
 public:
     SensorManager();
@@ -30,19 +48,72 @@ public:
     void init(struct android_app *state);
     void suspend();
     void resume();
+#ifdef __ANDROID__
     ASensorManager* AcquireASensorManagerInstance(struct android_app *app);
-    AcceleratorState getState() const { return m_acceleratorState; }
-    void processSensors(int32_t id);
+#endif
+    // on the looper thread, true when the samples changed what a renderer
+    // that read the sensors before would see
+    bool processSensors(int32_t id);
+    // producer side of the sample queue, false when it is full; the newest
+    // sample of each sensor that didn't fit replaces the queued backlog at
+    // the next update()
+    bool pushSample(const SensorSample &sample);
+
+    // render thread, once per frame before rendering
+    void update(int64_t displayTimeNs);
+    // the newest accelerometer sample
+    AcceleratorState getState() const;
+    // device orientation predicted for the display time given to update()
+    glm::quat getOrientation() const;
+    // the same, for any other time in the NowNs() time base
+    glm::quat predictOrientation(int64_t timeNs) const;
+    uint32_t droppedSamples() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    // the sensor event time base, CLOCK_BOOTTIME on android
+    static int64_t NowNs();
 
 private:
+    // render thread
+    void applySample(const SensorSample &sample);
+#ifdef __ANDROID__
+    void setRates(int64_t now);
+
     ASensorManager *m_sensorManger;
     ASensorEventQueue *m_sensorEventQueue;
     const ASensor *m_accelerometerSensor;
+    const ASensor *m_gyroscopeSensor;
+    const ASensor *m_rotationSensor;
+    // looper thread, rates in effect, 0 off
+    int32_t m_accelerometerPeriodUs;
+    bool m_orientationSensors;
+    // looper thread, the last samples that counted as a change
+    glm::vec3 m_lastAcceleration;
+    glm::quat m_lastRotation;
+#endif
+    // looper thread to render thread
+    util::SpscQueue<SensorSample, 1024> m_samples;
+    std::atomic<uint32_t> m_dropped;
+    // newest samples that didn't fit the queue, by sensor, TimeNs 0 for none
+    static const int SENSOR_SLOTS = 3;
+    std::mutex m_overflowMutex;
+    SensorSample m_overflow[SENSOR_SLOTS];
+    std::atomic<bool> m_overflowed;
+    // last frames reading the state and the orientation, render thread to looper
+    std::atomic<int64_t> m_stateReadNs;
+    std::atomic<int64_t> m_orientationReadNs;
+    // read at least once, changes are worth a frame
+    std::atomic<bool> m_stateUsed;
+    std::atomic<bool> m_orientationUsed;
+
+    // render thread
     AcceleratorState m_acceleratorState;
+    OrientationFilter m_filter;
+    glm::quat m_orientation;
+    mutable bool m_stateRead;
+    mutable bool m_orientationRead;
 };
 
 typedef std::shared_ptr<SensorManager> SensorManagerPtr;
 } // namespace common
-#endif
 
 #endif // _COMMON_SENSORMANAGER_H_
@@ -0,0 +1,162 @@
+#include "DynamicResolution.h"
+
+#include <math.h>
+#include <algorithm>
+
+#include "GLStateCache.h"
+#include "LogUtil.h"
+
+namespace common {
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+// gains on the relative error, (budget - time) / budget
+static const double KP = 0.10;
+static const double KI = 0.15;
+static const double KD = 0.05;
+static const double DEADBAND = 0.05;
+// scene sizes are kept to whole tiles
+static const int32_t ALIGNMENT = 8;
+
+DynamicResolution::DynamicResolution() :
+    m_framebuffer(0), m_color(0), m_depth(0), m_width(0), m_height(0), m_budgetMs(0.0),
+    m_minScale(0.5f), m_area(1.0) {
+    m_error[0] = m_error[1] = 0.0;
+}
+
+DynamicResolution::~DynamicResolution() {
+    release();
+}
+
+void DynamicResolution::setBudget(double budgetMs, float minScale) {
+    m_budgetMs = budgetMs;
+    m_minScale = std::min(std::max(minScale, 0.1f), 1.0f);
+}
+
+bool DynamicResolution::init(int32_t width, int32_t height) {
+    release();
+    if (!isEnabled() || width <= 0 || height <= 0) {
+        return false;
+    }
+    if (!m_timer.init()) {
+        ALOGV("Dynamic resolution needs GL_EXT_disjoint_timer_query, rendering at native resolution");
+        return false;
+    }
+    m_width = width;
+    m_height = height;
+
+    glGenRenderbuffers(1, &m_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &m_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    util::GLStateCache *state = util::GLStateCache::Current();
+    state->memory()->track(util::GpuMemory::RENDERBUFFER, m_color, util::GPU_MEMORY_RENDER_TARGETS,
+                           (size_t)width * height * 4);
+    state->memory()->track(util::GpuMemory::RENDERBUFFER, m_depth, util::GPU_MEMORY_RENDER_TARGETS,
+                           (size_t)width * height * 4);
+    glGenFramebuffers(1, &m_framebuffer);
+    state->bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    state->bindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        ALOGE("Unable to create the scene framebuffer, status 0x%x!", status);
+        release();
+        return false;
+    }
+
+    // start from the last scale, the scene got no cheaper
+    m_error[0] = m_error[1] = 0.0;
+    updateScale(-1.0);
+    return true;
+}
+
+void DynamicResolution::release() {
+    m_timer.release();
+    util::GLStateCache *state = util::GLStateCache::Current();
+    if (m_framebuffer) {
+        state->deleteFramebuffers(1, &m_framebuffer);
+        m_framebuffer = 0;
+    }
+    if (m_color) {
+        state->deleteRenderbuffers(1, &m_color);
+        m_color = 0;
+    }
+    if (m_depth) {
+        state->deleteRenderbuffers(1, &m_depth);
+        m_depth = 0;
+    }
+}
+
+// a negative time only applies the bounds to the current area
+void DynamicResolution::updateScale(double gpuMs) {
+    if (gpuMs >= 0.0) {
+        m_stats.GpuMs = gpuMs;
+        // twice the budget or more is a spike, a shader compile or a bogus
+        // first result, and counts as twice
+        double error = std::max((m_budgetMs - gpuMs) / m_budgetMs, -1.0);
+        if (fabs(error) < DEADBAND) {
+            error = 0.0;
+        }
+        // velocity form, the output is a step of the area, so clamping it
+        // can't wind anything up
+        m_area += KP * (error - m_error[0]) + KI * error +
+                KD * (error - 2.0 * m_error[0] + m_error[1]);
+        m_error[1] = m_error[0];
+        m_error[0] = error;
+    }
+    m_area = std::min(std::max(m_area, (double)m_minScale * m_minScale), 1.0);
+
+    float scale = (float)sqrt(m_area);
+    int32_t width = std::max(ALIGNMENT, (int32_t)(m_width * scale) / ALIGNMENT * ALIGNMENT);
+    int32_t height = std::max(ALIGNMENT, (int32_t)(m_height * scale) / ALIGNMENT * ALIGNMENT);
+    // a full axis is exact, not rounded down
+    if (scale >= 1.0f) {
+        width = m_width;
+        height = m_height;
+    }
+    if (width != m_stats.Width || height != m_stats.Height) {
+        m_stats.Changes++;
+        m_stats.Width = std::min(width, m_width);
+        m_stats.Height = std::min(height, m_height);
+    }
+    m_stats.Scale = (float)m_stats.Width / m_width;
+}
+
+void DynamicResolution::beginScene() {
+    if (!m_framebuffer) {
+        return;
+    }
+    double gpuMs;
+    if (m_timer.poll(gpuMs)) {
+        updateScale(gpuMs);
+    }
+    util::GLStateCache *state = util::GLStateCache::Current();
+    state->bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    state->viewport(0, 0, m_stats.Width, m_stats.Height);
+    m_timer.begin();
+}
+
+void DynamicResolution::endScene() {
+    if (!m_framebuffer) {
+        return;
+    }
+    m_timer.end();
+    util::GLStateCache *state = util::GLStateCache::Current();
+    state->bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    bool native = m_stats.Width == m_width && m_stats.Height == m_height;
+    glBlitFramebuffer(0, 0, m_stats.Width, m_stats.Height, 0, 0, m_width, m_height,
+                      GL_COLOR_BUFFER_BIT, native ? GL_NEAREST : GL_LINEAR);
+    // nothing reads the scene again, tilers can skip writing it back
+    const GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_DEPTH_ATTACHMENT };
+    glInvalidateFramebuffer(GL_READ_FRAMEBUFFER, 2, attachments);
+    state->bindFramebuffer(GL_FRAMEBUFFER, 0);
+    state->viewport(0, 0, m_width, m_height);
+}
+#endif
+
+} // namespace common
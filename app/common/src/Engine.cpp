@@ -1,8 +1,11 @@
 #include "Engine.h"
 
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
 
 #ifdef __ANDROID__
+#include <dlfcn.h>
 #include <jni.h>
 #include <android/native_window_jni.h>
 #endif
@@ -12,54 +15,132 @@
 #include "LogUtil.h"
 #include "GestureManager.h"
 #include "AssetHelper.h"
+#include "ProgramBinaryCache.h"
+#include "ShaderCompileQueue.h"
+#include "AsyncLoader.h"
+#include "TextureManager.h"
+#include "TextureStreamer.h"
 
 namespace common {
 
+// host builds have no android_app, they render to an offscreen surface
+static ANativeWindow *appWindow(struct android_app *app) {
+#ifdef __ANDROID__
+    return app ? app->window : nullptr;
+#else
+    return nullptr;
+#endif
+}
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// warnings further apart start over at the first tier
+static const int64_t PRESSURE_RESET_NS = 10000000000LL;
+
+static void logGpuMemory(const char *label, const util::GpuMemoryStats &stats) {
+    ALOGV("GPU memory %s: %zu kB, geometry %zu streaming %zu textures %zu render targets %zu programs %zu kB",
+          label, stats.Total / 1024, stats.Bytes[util::GPU_MEMORY_GEOMETRY] / 1024,
+          stats.Bytes[util::GPU_MEMORY_STREAMING] / 1024, stats.Bytes[util::GPU_MEMORY_TEXTURES] / 1024,
+          stats.Bytes[util::GPU_MEMORY_RENDER_TARGETS] / 1024, stats.Bytes[util::GPU_MEMORY_PROGRAMS] / 1024);
+}
+
+static void logProgramStats() {
+    const util::ProgramBinaryStats &stats = util::ProgramBinaryCache::Get()->getStats();
+    ALOGV("Program cache: %u hits, %u misses, %u invalid, compile %.2f ms (latency %.2f ms), load %.2f ms",
+          stats.hits, stats.misses, stats.invalid, stats.compileMs, stats.compileLatencyMs, stats.loadMs);
+}
+
+#ifdef __ANDROID__
+// not in the headers below API 30, looked up at runtime
+typedef void (*PF_REFRESHRATECALLBACK)(int64_t vsyncPeriodNanos, void *data);
+typedef void (*PF_REFRESHRATEREGISTRATION)(AChoreographer *choreographer,
+                                           PF_REFRESHRATECALLBACK callback, void *data);
+
+static PF_REFRESHRATEREGISTRATION refreshRateFunc(const char *name) {
+    void *androidHandle = dlopen("libandroid.so", RTLD_NOW);
+    PF_REFRESHRATEREGISTRATION func = (PF_REFRESHRATEREGISTRATION)dlsym(androidHandle, name);
+    dlclose(androidHandle);
+    return func;
+}
+#endif
+
 Engine::Engine(const std::shared_ptr<Renderer> &renderer) :
     m_renderer(renderer), m_app(nullptr), m_initializedResources(false),
-    m_hasFocus(false) {
+    m_hasFocus(false), m_uploadBudgetMs(4.0),
+#ifdef __ANDROID__
+    m_choreographer(nullptr),
+#endif
+    m_running(false), m_dirty(true), m_nextFrameNs(0),
+    m_frameCount(0),
+    m_droppedInput(0), m_latencySumMs(0.0), m_frameNs(0), m_restartPacing(true),
+    m_pressure(MEMORY_PRESSURE_NONE), m_trimNs(0), m_contextDropped(false) {
     // init GL context
     m_GLcontext = GLContext::Get();
     m_sensorManager = std::make_shared<SensorManager>();
     // seems need to change
     GestureManager::Get();
+    // finished loads are worth a frame
+    util::AsyncLoader::Get()->setUploadListener([this]() {
+        invalidate();
+    });
 }
 
 Engine::~Engine() {
-
+    util::AsyncLoader::Get()->setUploadListener(nullptr);
+#ifdef __ANDROID__
+    unwatchRefreshRate();
+#endif
+    if (m_renderThread.joinable()) {
+        stopRenderThread();
+    }
 }
 
+#ifdef __ANDROID__
 void Engine::handleCmd(struct android_app *app, int32_t cmd) {
     Engine *engine = (Engine *)app->userData;
     switch (cmd) {
     case APP_CMD_SAVE_STATE:
         break;
     case APP_CMD_INIT_WINDOW:
-        // The window is being shown, get it ready.
+        // The window is being shown, get it ready; the render thread draws
+        // as soon as it has focus.
         if (app->window != nullptr) {
-            engine->onInitDisplay(app);
-            engine->m_hasFocus = true;
-            engine->draw();
+            engine->runOnRenderThread([engine, app]() {
+                engine->onInitDisplay(app);
+            });
+            engine->setFocus(true);
         }
         break;
     case APP_CMD_TERM_WINDOW:
-        // The window is being hidden or closed, clean it up.
-        engine->terminate();
-        engine->m_hasFocus = false;
+        // The window is being hidden or closed, clean it up. The glue frees
+        // the window when this returns, so stop drawing and wait for the
+        // surface to be gone first.
+        engine->setFocus(false);
+        engine->runOnRenderThread([engine]() {
+            engine->terminate();
+        });
         break;
     case APP_CMD_STOP:
         break;
     case APP_CMD_GAINED_FOCUS:
         engine->getSensorMgr()->resume();
-        engine->m_hasFocus = true;
+        engine->setFocus(true);
         break;
     case APP_CMD_LOST_FOCUS:
         engine->getSensorMgr()->suspend();
-        engine->m_hasFocus = false;
-        engine->draw();
+        engine->setFocus(false);
+        // one last frame
+        engine->postToRenderThread([engine]() {
+            engine->draw();
+        });
         break;
     case APP_CMD_LOW_MEMORY:
-        engine->trimMemory();
+        engine->runOnRenderThread([engine]() {
+            engine->trimMemory();
+        });
         break;
     }
 }
@@ -67,14 +148,22 @@ void Engine::handleCmd(struct android_app *app, int32_t cmd) {
 int32_t Engine::handleInput(struct android_app *app, AInputEvent *event) {
     Engine *engine = (Engine *)(app->userData);
     if (engine) {
-#ifdef __ANDROID__
         if (AInputEvent_getType(event) == AINPUT_EVENT_TYPE_MOTION) {
             common::GestureType type = GestureManager::Get()->detect(event);
             switch (type) {
             case GESTURE_DOUBLE_TAP:
                 break;
             case GESTURE_TAP:
+            {
+                // handled on the render thread, which owns the renderer
+                InputEvent input;
+                input.Type = type;
+                input.TimeNs = AMotionEvent_getEventTime(event);
+                if (GestureManager::Get()->getPointer(input.Pointer)) {
+                    engine->postInput(input);
+                }
                 break;
+            }
             case GESTURE_DRAG:
                 break;
             case GESTURE_PINCH:
@@ -83,26 +172,27 @@ int32_t Engine::handleInput(struct android_app *app, AInputEvent *event) {
                 break;
             }
         }
-#endif
     }
     return 0;
 }
+#endif
 
 int Engine::onInitDisplay(struct android_app *app) {
     if (!m_initializedResources) {
-        m_GLcontext->init(m_app->window);
+        m_GLcontext->init(appWindow(m_app));
         loadResources();
         m_initializedResources = true;
-    } else if (app->window != m_GLcontext->getANativeWindow()) {
+        m_contextDropped = false;
+    } else if (appWindow(app) != m_GLcontext->getANativeWindow()) {
         assert(m_GLcontext->getANativeWindow());
         unloadResources();
         m_GLcontext->invalidate();
         m_app = app;
-        m_GLcontext->init(app->window);
+        m_GLcontext->init(appWindow(app));
         loadResources();
         m_initializedResources = true;
     } else {
-        if (EGL_SUCCESS == m_GLcontext->resume(m_app->window)) {
+        if (EGL_SUCCESS == m_GLcontext->resume(appWindow(m_app))) {
             unloadResources();
             loadResources();
         } else {
@@ -113,26 +203,115 @@ int Engine::onInitDisplay(struct android_app *app) {
     // TODO: showUI()
 
     // initialize GL state
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
+    util::GLStateCache *state = m_GLcontext->getStateCache();
+    state->enable(GL_CULL_FACE);
+    state->enable(GL_DEPTH_TEST);
+    state->depthFunc(GL_LEQUAL);
 
     // set screen
-    glViewport(0, 0, m_GLcontext->getScreenWidth(), m_GLcontext->getScreenHeight());
+    state->viewport(0, 0, m_GLcontext->getScreenWidth(), m_GLcontext->getScreenHeight());
 
     // TODO: camera
+    invalidate();
     return 0;
 }
 
 void Engine::setState(struct android_app *state) {
     m_app = state;
+#ifdef __ANDROID__
     util::AssetHelper::Get()->Init(m_app->activity->assetManager);
+    util::ProgramBinaryCache::Get()->Init(m_app->activity->internalDataPath);
     m_sensorManager->init(state);
     GestureManager::Get()->setConfiguration(state->config);
+    setRefreshRate(queryRefreshRate());
+    watchRefreshRate();
+#endif
 }
 
+void Engine::setRefreshRate(float hz) {
+    if (hz <= 0.0f) {
+        return;
+    }
+    postToRenderThread([this, hz]() {
+        ALOGV("Display refresh rate: %.1f Hz", hz);
+        m_GLcontext->getFramePacer()->setRefreshRate(hz);
+    });
+}
+
+#ifdef __ANDROID__
+float Engine::queryRefreshRate() {
+    JNIEnv *env = nullptr;
+    m_app->activity->vm->AttachCurrentThread(&env, nullptr);
+    float hz = 0.0f;
+    jclass activityClass = env->GetObjectClass(m_app->activity->clazz);
+    jmethodID getWindowManager = env->GetMethodID(activityClass, "getWindowManager",
+                                                  "()Landroid/view/WindowManager;");
+    jobject windowManager = env->CallObjectMethod(m_app->activity->clazz, getWindowManager);
+    if (windowManager) {
+        jclass windowManagerClass = env->FindClass("android/view/WindowManager");
+        jmethodID getDefaultDisplay = env->GetMethodID(windowManagerClass, "getDefaultDisplay",
+                                                       "()Landroid/view/Display;");
+        jobject display = env->CallObjectMethod(windowManager, getDefaultDisplay);
+        if (display) {
+            jclass displayClass = env->FindClass("android/view/Display");
+            jmethodID getRefreshRate = env->GetMethodID(displayClass, "getRefreshRate", "()F");
+            hz = env->CallFloatMethod(display, getRefreshRate);
+        }
+    }
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        hz = 0.0f;
+    }
+    m_app->activity->vm->DetachCurrentThread();
+    return hz;
+}
+
+void Engine::watchRefreshRate() {
+    PF_REFRESHRATEREGISTRATION registerCallback =
+            refreshRateFunc("AChoreographer_registerRefreshRateCallback");
+    if (m_choreographer || !registerCallback) {
+        return;
+    }
+    // the callback runs on this thread's looper, as ALooper_pollAll dispatches
+    m_choreographer = AChoreographer_getInstance();
+    if (m_choreographer) {
+        registerCallback(m_choreographer, onRefreshRateChanged, this);
+    }
+}
+
+void Engine::unwatchRefreshRate() {
+    PF_REFRESHRATEREGISTRATION unregisterCallback =
+            refreshRateFunc("AChoreographer_unregisterRefreshRateCallback");
+    if (m_choreographer && unregisterCallback) {
+        unregisterCallback(m_choreographer, onRefreshRateChanged, this);
+    }
+    m_choreographer = nullptr;
+}
+
+void Engine::onRefreshRateChanged(int64_t vsyncPeriodNanos, void *data) {
+    if (vsyncPeriodNanos > 0) {
+        ((Engine *)data)->setRefreshRate((float)(1e9 / vsyncPeriodNanos));
+    }
+}
+#endif
+
 void Engine::loadResources() {
+    util::ShaderCompileQueue::Get()->init(
+                m_GLcontext->checkExtension("GL_KHR_parallel_shader_compile"));
+    uint32_t textureFormats = util::TEXTURE_UNCOMPRESSED;
+    if (m_GLcontext->getGLVersion() >= 3.0f) {
+        textureFormats |= util::TEXTURE_ETC2;
+    }
+    if (m_GLcontext->checkExtension("GL_KHR_texture_compression_astc_ldr")) {
+        textureFormats |= util::TEXTURE_ASTC;
+    }
+    util::TextureManager::Get()->init(textureFormats);
+    util::TextureStreamer::Get()->init();
+    m_resolution.init(m_GLcontext->getScreenWidth(), m_GLcontext->getScreenHeight());
     m_renderer->init();
+    if (!util::ShaderCompileQueue::Get()->pendingCount()) {
+        logProgramStats();
+    }
     // TODO: bind camera
 
     // bind sensor
@@ -140,18 +319,257 @@ void Engine::loadResources() {
 }
 
 void Engine::unloadResources() {
+    util::AsyncLoader::Get()->cancelAll();
+    util::ShaderCompileQueue::Get()->clear();
     m_renderer->unload();
+    util::TextureManager::Get()->clear();
+    util::TextureStreamer::Get()->release();
+    m_resolution.release();
+}
+
+void Engine::startRenderThread() {
+    if (m_renderThread.joinable()) {
+        return;
+    }
+    m_running = true;
+    m_renderThread = std::thread(&Engine::renderLoop, this);
+}
+
+void Engine::stopRenderThread() {
+    if (!m_renderThread.joinable()) {
+        return;
+    }
+    setFocus(false);
+    runOnRenderThread([this]() {
+        terminate();
+    });
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_running = false;
+    }
+    m_taskCondition.notify_all();
+    m_renderThread.join();
+}
+
+void Engine::runOnRenderThread(const std::function<void()> &task) {
+    if (!m_renderThread.joinable() || std::this_thread::get_id() == m_renderThread.get_id()) {
+        task();
+        return;
+    }
+    auto item = std::make_shared<RenderTask>();
+    item->Run = task;
+    item->Done = false;
+    std::unique_lock<std::mutex> lock(m_taskMutex);
+    m_tasks.push_back(item);
+    m_taskCondition.notify_all();
+    m_taskCondition.wait(lock, [&item]() {
+        return item->Done;
+    });
+}
+
+void Engine::postToRenderThread(const std::function<void()> &task) {
+    if (!m_renderThread.joinable()) {
+        task();
+        return;
+    }
+    auto item = std::make_shared<RenderTask>();
+    item->Run = task;
+    item->Done = false;
+    std::lock_guard<std::mutex> lock(m_taskMutex);
+    m_tasks.push_back(item);
+    m_taskCondition.notify_all();
+}
+
+void Engine::setFocus(bool focus) {
+    {
+        // under the lock so that the render thread can't miss the wake up
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_hasFocus = focus;
+        m_dirty = m_dirty || focus;
+    }
+    m_taskCondition.notify_all();
+}
+
+void Engine::invalidate() {
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_dirty = true;
+    }
+    m_taskCondition.notify_all();
+}
+
+bool Engine::frameDue() const {
+    if (!m_hasFocus || !(m_initializedResources || m_contextDropped)) {
+        return false;
+    }
+    return m_dirty || m_renderer->isContinuous() || (m_nextFrameNs && nowNs() >= m_nextFrameNs);
+}
+
+// tasks run between frames, so a frame never sees half of a lifecycle change
+void Engine::renderLoop() {
+    std::unique_lock<std::mutex> lock(m_taskMutex);
+    auto wake = [this]() {
+        return !m_tasks.empty() || !m_running || frameDue();
+    };
+    int64_t last = nowNs();
+    bool focused = m_hasFocus;
+    while (true) {
+        if (!wake()) {
+            // not drawing for a while, the pacer must not count it as late
+            m_restartPacing = true;
+            int64_t idleStart = nowNs();
+            if (m_hasFocus && m_nextFrameNs) {
+                m_taskCondition.wait_until(lock, std::chrono::steady_clock::time_point(
+                        std::chrono::nanoseconds(m_nextFrameNs)), wake);
+            } else {
+                m_taskCondition.wait(lock, wake);
+            }
+            if (focused && m_hasFocus) {
+                m_loopStats.IdleMs += (nowNs() - idleStart) * 1e-6;
+            }
+        }
+        // time spent without focus counts for nothing
+        int64_t now = nowNs();
+        if (focused && m_hasFocus) {
+            m_loopStats.TotalMs += (now - last) * 1e-6;
+        }
+        last = now;
+        focused = m_hasFocus;
+        while (!m_tasks.empty()) {
+            std::shared_ptr<RenderTask> task = m_tasks.front();
+            m_tasks.pop_front();
+            lock.unlock();
+            task->Run();
+            lock.lock();
+            task->Done = true;
+            m_taskCondition.notify_all();
+        }
+        if (!m_running) {
+            break;
+        }
+        if (frameDue()) {
+            lock.unlock();
+            draw();
+            lock.lock();
+        }
+    }
+}
+
+bool Engine::postInput(const InputEvent &event) {
+    if (!m_input.push(event)) {
+        m_droppedInput++;
+        return false;
+    }
+    invalidate();
+    return true;
+}
+
+void Engine::dispatchInput() {
+    InputEvent event;
+    while (m_input.pop(event)) {
+        switch (event.Type) {
+        case GESTURE_TAP:
+            m_renderer->onTap(event.Pointer.x, event.Pointer.y);
+            break;
+        default:
+            break;
+        }
+        m_inputTimes.push_back(event.TimeNs);
+    }
+}
+
+// swap is as close to presentation as EGL tells without frame timestamps
+void Engine::recordInputLatency() {
+    if (m_inputTimes.empty()) {
+        return;
+    }
+    int64_t now = nowNs();
+    for (int64_t time : m_inputTimes) {
+        double ms = (now - time) * 1e-6;
+        m_latency.Events++;
+        m_latency.LastMs = ms;
+        m_latency.MaxMs = std::max(m_latency.MaxMs, ms);
+        m_latencySumMs += ms;
+    }
+    m_latency.AvgMs = m_latencySumMs / m_latency.Events;
+    m_inputTimes.clear();
+}
+
+RenderLoopStats Engine::renderLoopStats() const {
+    std::lock_guard<std::mutex> lock(m_taskMutex);
+    RenderLoopStats stats = m_loopStats;
+    stats.Frames = frameCount();
+    return stats;
+}
+
+InputLatencyStats Engine::inputLatency() const {
+    InputLatencyStats stats = m_latency;
+    stats.Dropped = m_droppedInput.load();
+    return stats;
 }
 
 void Engine::draw() {
     // TODO: fps...
+    // a new context starts from the budgets set, as does a while without
+    // warnings
+    if (m_contextDropped) {
+        onInitDisplay(m_app);
+        relieveMemory();
+    } else if (m_pressure != MEMORY_PRESSURE_NONE && nowNs() - m_trimNs > PRESSURE_RESET_NS) {
+        relieveMemory();
+    }
+    {
+        // whatever makes the scene dirty from here on needs another frame
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_dirty = false;
+    }
+    m_nextFrameNs = 0;
+    dispatchInput();
+    // collect programs that finished compiling in the background
+    util::ShaderCompileQueue *queue = util::ShaderCompileQueue::Get();
+    size_t pending = queue->pendingCount();
+    queue->poll();
+    if (pending && !queue->pendingCount()) {
+        logProgramStats();
+    }
+    util::AsyncLoader::Get()->drainUploads(m_uploadBudgetMs);
+    if (m_restartPacing) {
+        m_GLcontext->getFramePacer()->restart();
+        m_restartPacing = false;
+    }
+    // sensors as late as possible, predicted to when this frame is shown;
+    // their time base keeps counting through sleep, the steady clock frames
+    // are scheduled with doesn't; a frame is shown about one refresh after
+    // its swap returns
+    int64_t frameStart = nowNs();
+    m_sensorManager->update(SensorManager::NowNs() + m_frameNs +
+                            m_GLcontext->getFramePacer()->refreshPeriodNs());
+    m_resolution.beginScene();
     m_renderer->render();
+    m_resolution.endScene();
+    m_renderer->renderOverlay();
+    // with this frame's texture sizes
+    util::TextureStreamer *streamer = util::TextureStreamer::Get();
+    streamer->update();
+    double delayMs = m_renderer->takeFrameRequest();
+    // shaders are polled, uploads drained and levels paged in by frames,
+    // keep them coming
+    if (queue->pendingCount() || util::AsyncLoader::Get()->hasUploads() || streamer->hasPendingWork()) {
+        delayMs = 0.0;
+    }
+    if (delayMs >= 0.0) {
+        m_nextFrameNs = frameStart + (int64_t)(delayMs * 1e6);
+    }
 
     // swap
     if (EGL_SUCCESS != m_GLcontext->swap()) {
         unloadResources();
         loadResources();
     }
+    int64_t frameNs = nowNs() - frameStart;
+    m_frameNs = m_frameNs ? (m_frameNs * 7 + frameNs) / 8 : frameNs;
+    recordInputLatency();
+    m_frameCount.fetch_add(1, std::memory_order_release);
 }
 
 void Engine::terminate() {
@@ -159,8 +577,68 @@ void Engine::terminate() {
 }
 
 void Engine::trimMemory() {
-    ALOGV("Trim memory");
-    m_GLcontext->invalidate();
+    if (m_pressure != MEMORY_PRESSURE_NONE && nowNs() - m_trimNs > PRESSURE_RESET_NS) {
+        relieveMemory();
+    }
+    MemoryPressure level = MEMORY_PRESSURE_CACHES;
+    if (m_pressure != MEMORY_PRESSURE_NONE) {
+        level = (MemoryPressure)std::min(m_pressure + 1, (int)MEMORY_PRESSURE_CONTEXT);
+    }
+    trimMemory(level);
+}
+
+void Engine::relieveMemory() {
+    if (m_pressure == MEMORY_PRESSURE_NONE) {
+        return;
+    }
+    ALOGV("Memory pressure over, budgets restored");
+    m_pressure = MEMORY_PRESSURE_NONE;
+    util::TextureStreamer::Get()->setBudgetScale(1.0f);
+    m_renderer->trimMemory(MEMORY_PRESSURE_NONE);
+    invalidate();
+}
+
+void Engine::trimMemory(MemoryPressure level) {
+    // the context and everything in it is gone already, no GL to call
+    if (m_contextDropped || !m_initializedResources) {
+        ALOGV("Trim memory, tier %d, nothing loaded", level);
+        return;
+    }
+    ALOGV("Trim memory, tier %d", level);
+    m_pressure = std::max(m_pressure, level);
+    m_trimNs = nowNs();
+    logGpuMemory("before trim", gpuMemory());
+    util::TextureStreamer *streamer = util::TextureStreamer::Get();
+    for (int tier = MEMORY_PRESSURE_CACHES; tier <= level; ++tier) {
+        switch (tier) {
+        case MEMORY_PRESSURE_CACHES:
+            streamer->dropUnrequested();
+            break;
+        case MEMORY_PRESSURE_BUDGETS:
+            // of the budget set, however often the tier comes up
+            streamer->setBudgetScale(0.5f);
+            break;
+        case MEMORY_PRESSURE_HIDDEN:
+            streamer->dropHidden();
+            break;
+        case MEMORY_PRESSURE_CONTEXT:
+            // everything goes while the context is still current, the next
+            // frame or window loads it again
+            unloadResources();
+            m_GLcontext->invalidate();
+            m_initializedResources = false;
+            m_contextDropped = true;
+            invalidate();
+            return;
+        }
+        m_renderer->trimMemory((MemoryPressure)tier);
+    }
+    logGpuMemory("after trim", gpuMemory());
+    invalidate();
+}
+
+util::GpuMemoryStats Engine::gpuMemory() const {
+    return m_GLcontext->getStateCache()->memory()->stats();
 }
 
 bool Engine::isReady() const {
@@ -171,7 +649,9 @@ bool Engine::isReady() const {
 }
 
 void Engine::processSensors(int32_t id) {
-    m_sensorManager->processSensors(id);
+    if (m_sensorManager->processSensors(id)) {
+        invalidate();
+    }
 }
 
 } // namespace common
@@ -0,0 +1,184 @@
+#include "FramePacer.h"
+
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "GLContext.h"
+#include "LogUtil.h"
+
+namespace common {
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+// the presentation time clock on android, CLOCK_MONOTONIC
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FramePacer::FramePacer() :
+    m_display(EGL_NO_DISPLAY), m_vsync(true), m_presentationTime(nullptr), m_createSync(nullptr),
+    m_clientWaitSync(nullptr), m_destroySync(nullptr), m_refreshNs(16666667), m_targetRate(0.0f),
+    m_divisor(1), m_interval(1), m_intervalDirty(true), m_maxFramesInFlight(2), m_slotNs(0), m_lastSwapNs(0),
+    m_intervals(0), m_intervalMean(0.0), m_intervalM2(0.0) {
+}
+
+FramePacer::~FramePacer() {
+    release();
+}
+
+void FramePacer::init(EGLDisplay display, bool vsync) {
+    release();
+    m_display = display;
+    m_vsync = vsync;
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (GLContext::HasExtension(extensions, "EGL_ANDROID_presentation_time")) {
+        m_presentationTime = (PFNEGLPRESENTATIONTIMEANDROIDPROC)
+                eglGetProcAddress("eglPresentationTimeANDROID");
+    }
+    if (GLContext::HasExtension(extensions, "EGL_KHR_fence_sync")) {
+        m_createSync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+        m_clientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+        m_destroySync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+        if (!m_clientWaitSync || !m_destroySync) {
+            m_createSync = nullptr;
+        }
+    }
+    m_intervalDirty = true;
+    m_slotNs = 0;
+    m_lastSwapNs = 0;
+    ALOGV("Frame pacing: %.1f fps, presentation time: %s, fences: %s", targetRate(),
+          m_presentationTime ? "yes" : "no", m_createSync ? "yes" : "no");
+}
+
+void FramePacer::release() {
+    if (m_destroySync) {
+        for (EGLSyncKHR fence : m_fences) {
+            m_destroySync(m_display, fence);
+        }
+    }
+    m_fences.clear();
+    m_presentationTime = nullptr;
+    m_createSync = nullptr;
+    m_clientWaitSync = nullptr;
+    m_destroySync = nullptr;
+    m_display = EGL_NO_DISPLAY;
+}
+
+void FramePacer::setRefreshRate(float hz) {
+    if (hz > 0.0f) {
+        m_refreshNs = (int64_t)(1e9 / hz);
+        setTargetRate(m_targetRate);
+    }
+}
+
+void FramePacer::setRateDivisor(int32_t divisor) {
+    m_divisor = std::max(1, divisor);
+    setTargetRate(m_targetRate);
+}
+
+void FramePacer::setTargetRate(float hz) {
+    m_targetRate = hz;
+    int32_t interval = m_divisor;
+    if (hz > 0.0f) {
+        interval = std::max(1, (int32_t)lroundf(1e9f / (hz * m_refreshNs)));
+    }
+    if (interval != m_interval) {
+        m_interval = interval;
+        m_intervalDirty = true;
+    }
+}
+
+float FramePacer::targetRate() const {
+    return (float)(1e9 / ((double)m_refreshNs * m_interval));
+}
+
+void FramePacer::restart() {
+    m_slotNs = 0;
+    m_lastSwapNs = 0;
+}
+
+void FramePacer::resetStats() {
+    m_stats = FramePacingStats();
+    m_intervals = 0;
+    m_intervalMean = 0.0;
+    m_intervalM2 = 0.0;
+    m_lastSwapNs = 0;
+}
+
+void FramePacer::beginSwap(EGLSurface surface) {
+    if (m_intervalDirty && m_display != EGL_NO_DISPLAY) {
+        // presentation times hold frames back themselves, vsync only has
+        // to keep the swap from tearing
+        eglSwapInterval(m_display, m_presentationTime ? 1 : m_interval);
+        m_intervalDirty = false;
+    }
+
+    // no display to pace to and no rate asked for, swap as fast as we can
+    if (!m_vsync && m_targetRate <= 0.0f) {
+        return;
+    }
+    int64_t periodNs = m_refreshNs * m_interval;
+    int64_t now = nowNs();
+    if (!m_slotNs) {
+        m_slotNs = now;
+    } else {
+        m_slotNs += periodNs;
+        if (now > m_slotNs) {
+            // late, the next slot on the same cadence
+            m_stats.Missed++;
+            m_slotNs += (now - m_slotNs + periodNs - 1) / periodNs * periodNs;
+        }
+    }
+
+    if (m_presentationTime) {
+        // composited on the refresh after the slot
+        m_presentationTime(m_display, surface, m_slotNs + m_refreshNs);
+    } else if (!m_vsync && m_slotNs > now) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(m_slotNs - now));
+    }
+}
+
+void FramePacer::waitOldest() {
+    EGLSyncKHR fence = m_fences.front();
+    m_fences.pop_front();
+    if (m_clientWaitSync(m_display, fence, 0, 0) == EGL_TIMEOUT_EXPIRED_KHR) {
+        auto start = std::chrono::steady_clock::now();
+        m_clientWaitSync(m_display, fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        m_stats.Waits++;
+        m_stats.WaitMs += elapsed.count();
+    }
+    m_destroySync(m_display, fence);
+}
+
+void FramePacer::endSwap() {
+    if (m_createSync && m_maxFramesInFlight) {
+        EGLSyncKHR fence = m_createSync(m_display, EGL_SYNC_FENCE_KHR, nullptr);
+        if (fence != EGL_NO_SYNC_KHR) {
+            m_fences.push_back(fence);
+        }
+    }
+    while (!m_fences.empty() && m_fences.size() > m_maxFramesInFlight) {
+        waitOldest();
+    }
+
+    int64_t now = nowNs();
+    if (m_lastSwapNs) {
+        // Welford, so the jitter needs no history
+        double ms = (now - m_lastSwapNs) * 1e-6;
+        uint32_t intervals = ++m_intervals;
+        double delta = ms - m_intervalMean;
+        m_intervalMean += delta / intervals;
+        m_intervalM2 += delta * (ms - m_intervalMean);
+        m_stats.AvgIntervalMs = m_intervalMean;
+        m_stats.JitterMs = intervals > 1 ? sqrt(m_intervalM2 / (intervals - 1)) : 0.0;
+        m_stats.MaxIntervalMs = std::max(m_stats.MaxIntervalMs, ms);
+    }
+    m_lastSwapNs = now;
+    m_stats.Frames++;
+}
+#endif
+
+} // namespace common
@@ -1,5 +1,5 @@
 #include "GLContext.h"
-#include <string>
+#include <string.h>
 #include "LogUtil.h"
 
 namespace common {
@@ -9,7 +9,12 @@ GLContext *GLContext::Get() {
     return &instance;
 }
 
-#ifdef __ANDROID__
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#ifdef QVIEWER_HOST
+static const int32_t DEFAULT_SURFACE_WIDTH = 1280;
+static const int32_t DEFAULT_SURFACE_HEIGHT = 720;
+#endif
+
 bool GLContext::invalidate() {
     terminate();
     m_eglContexInitialized = false;
@@ -24,22 +29,33 @@ void GLContext::suspend() {
 }
 
 bool GLContext::checkExtension(const char *extension) {
-    if (extension == nullptr) {
+    return HasExtension((const char *)glGetString(GL_EXTENSIONS), extension);
+}
+
+bool GLContext::HasExtension(const char *extensions, const char *extension) {
+    if (extensions == nullptr || extension == nullptr) {
         return false;
     }
 
-    std::string extensions = std::string((char*)glGetString(GL_EXTENSIONS));
-    std::string str = std::string(extension);
-    str.append(" ");
-
-    size_t pos = 0;
-    if (extensions.find(extension, pos) != std::string::npos) {
-      return true;
+    // whole names only, GL_EXT_foo must not match GL_EXT_foo_bar
+    size_t length = strlen(extension);
+    for (const char *found = strstr(extensions, extension); found;
+         found = strstr(found + length, extension)) {
+        if ((found == extensions || found[-1] == ' ') &&
+                (found[length] == ' ' || found[length] == '\0')) {
+            return true;
+        }
     }
-
     return false;
 }
 
+#ifdef QVIEWER_HOST
+void GLContext::setSurfaceSize(int32_t width, int32_t height) {
+    m_screenWidth = width;
+    m_screenHeight = height;
+}
+#endif
+
 GLContext::GLContext(const GLContext &) {
 
 }
@@ -70,6 +86,8 @@ void GLContext::initGLES() {
 }
 
 void GLContext::terminate() {
+    // its fences belong to the display
+    m_pacer.release();
     if (m_display != EGL_NO_DISPLAY) {
         eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
         if (m_context != EGL_NO_CONTEXT) {
@@ -87,15 +105,63 @@ void GLContext::terminate() {
     m_surface = EGL_NO_SURFACE;
     m_window = nullptr;
     m_contextValid = false;
+    // nothing of the old context's state or objects carries over
+    m_stateCache.reset();
+    m_stateCache.memory()->clear();
+    util::GLStateCache::MakeCurrent(nullptr);
+}
+
+EGLDisplay GLContext::getEGLDisplay() const {
+#ifdef QVIEWER_HOST
+    // prefer mesa's surfaceless platform so no X/wayland server is needed
+    const char *clientExts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (clientExts && strstr(clientExts, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+                eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay) {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                                    EGL_DEFAULT_DISPLAY, nullptr);
+            if (display != EGL_NO_DISPLAY) {
+                return display;
+            }
+        }
+    }
+#endif
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+EGLSurface GLContext::createEGLSurface() {
+#ifdef QVIEWER_HOST
+    const EGLint attribs[] = {
+        EGL_WIDTH, m_screenWidth > 0 ? m_screenWidth : DEFAULT_SURFACE_WIDTH,
+        EGL_HEIGHT, m_screenHeight > 0 ? m_screenHeight : DEFAULT_SURFACE_HEIGHT,
+        EGL_NONE
+    };
+    EGLSurface surface = eglCreatePbufferSurface(m_display, m_config, attribs);
+#else
+    EGLSurface surface = eglCreateWindowSurface(m_display, m_config, m_window, nullptr);
+#endif
+    eglQuerySurface(m_display, surface, EGL_WIDTH, &m_screenWidth);
+    eglQuerySurface(m_display, surface, EGL_HEIGHT, &m_screenHeight);
+    return surface;
 }
 
 bool GLContext::initEGLSurface() {
-    m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-    eglInitialize(m_display, 0, 0);
+    m_display = getEGLDisplay();
+    if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, 0, 0)) {
+        ALOGE("Unable to initialize EGL display!");
+        return false;
+    }
+#ifdef QVIEWER_HOST
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const EGLint surfaceType = EGL_PBUFFER_BIT;
+#else
+    const EGLint surfaceType = EGL_WINDOW_BIT;
+#endif
 
     const EGLint attribs[] = {
         EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
-        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_SURFACE_TYPE, surfaceType,
         EGL_BLUE_SIZE, 8,
         EGL_GREEN_SIZE, 8,
         EGL_RED_SIZE, 8,
@@ -111,7 +177,7 @@ bool GLContext::initEGLSurface() {
     if (!num_configs) {
         const EGLint attribs[] = {
             EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
-            EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+            EGL_SURFACE_TYPE, surfaceType,
             EGL_BLUE_SIZE, 8,
             EGL_GREEN_SIZE, 8,
             EGL_RED_SIZE, 8,
@@ -127,10 +193,7 @@ bool GLContext::initEGLSurface() {
         return false;
     }
 
-    m_surface = eglCreateWindowSurface(m_display, m_config, m_window, nullptr);
-    eglQuerySurface(m_display, m_surface, EGL_WIDTH, &m_screenWidth);
-    eglQuerySurface(m_display, m_surface, EGL_HEIGHT, &m_screenHeight);
-
+    m_surface = createEGLSurface();
     return true;
 }
 
@@ -146,9 +209,32 @@ bool GLContext::initEGLContext() {
     }
 
     m_contextValid = true;
+    m_stateCache.reset();
+    m_stateCache.memory()->clear();
+    util::GLStateCache::MakeCurrent(&m_stateCache);
+#ifdef QVIEWER_HOST
+    // a pbuffer has no vsync to pace to
+    m_pacer.init(m_display, false);
+#else
+    m_pacer.init(m_display, true);
+#endif
+    initParallelCompile();
     return true;
 }
 
+void GLContext::initParallelCompile() {
+    if (!checkExtension("GL_KHR_parallel_shader_compile")) {
+        return;
+    }
+    // let the driver pick as many compiler threads as it wants
+    typedef void (GL_APIENTRYP PFN_MAXSHADERCOMPILERTHREADS)(GLuint count);
+    PFN_MAXSHADERCOMPILERTHREADS maxShaderCompilerThreads = (PFN_MAXSHADERCOMPILERTHREADS)
+            eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    if (maxShaderCompilerThreads) {
+        maxShaderCompilerThreads(0xFFFFFFFF);
+    }
+}
+
 bool GLContext::init(ANativeWindow *window) {
     if (m_eglContexInitialized) {
         return true;
@@ -165,7 +251,16 @@ bool GLContext::init(ANativeWindow *window) {
 }
 
 EGLint GLContext::swap() {
+    m_stateCache.endFrame();
+    m_pacer.beginSwap(m_surface);
     bool success = eglSwapBuffers(m_display, m_surface);
+#ifdef QVIEWER_HOST
+    // swapping a pbuffer is a no-op, wait for the frame so timings are real
+    glFinish();
+#endif
+    if (success) {
+        m_pacer.endSwap();
+    }
     if (!success) {
         EGLint err = eglGetError();
         if (err == EGL_BAD_SURFACE) {
@@ -197,9 +292,7 @@ EGLint GLContext::resume(ANativeWindow *window) {
 
     // create surface
     m_window = window;
-    m_surface = eglCreateWindowSurface(m_display, m_config, m_window, nullptr);
-    eglQuerySurface(m_display, m_surface, EGL_WIDTH, &m_screenWidth);
-    eglQuerySurface(m_display, m_surface, EGL_HEIGHT, &m_screenHeight);
+    m_surface = createEGLSurface();
 
     if (m_screenWidth != original_width || m_screenHeight != original_height) {
         ALOGV("Screen resized");
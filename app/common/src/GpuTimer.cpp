@@ -0,0 +1,100 @@
+#include "GpuTimer.h"
+
+#include <string.h>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <EGL/egl.h>
+#endif
+
+#include "GLContext.h"
+
+namespace common {
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+GpuTimer::GpuTimer() :
+    m_getQueryObjectui64v(nullptr), m_begun(0), m_read(0), m_active(false) {
+    memset(m_queries, 0, sizeof (m_queries));
+}
+
+GpuTimer::~GpuTimer() {
+    release();
+}
+
+bool GpuTimer::init() {
+    release();
+    if (!GLContext::Get()->checkExtension("GL_EXT_disjoint_timer_query")) {
+        return false;
+    }
+    m_getQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)
+            eglGetProcAddress("glGetQueryObjectui64vEXT");
+    if (!m_getQueryObjectui64v) {
+        return false;
+    }
+    glGenQueries(QUERIES, m_queries);
+    // clear a disjoint left over from before
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    return true;
+}
+
+void GpuTimer::release() {
+    if (m_getQueryObjectui64v) {
+        if (m_active) {
+            glEndQuery(GL_TIME_ELAPSED_EXT);
+        }
+        glDeleteQueries(QUERIES, m_queries);
+        memset(m_queries, 0, sizeof (m_queries));
+    }
+    m_getQueryObjectui64v = nullptr;
+    m_begun = m_read = 0;
+    m_active = false;
+}
+
+void GpuTimer::begin() {
+    // every query in flight, skip measuring this frame
+    if (!isValid() || m_active || m_begun - m_read == QUERIES) {
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED_EXT, m_queries[m_begun % QUERIES]);
+    m_active = true;
+}
+
+void GpuTimer::end() {
+    if (!m_active) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED_EXT);
+    m_active = false;
+    m_begun++;
+}
+
+bool GpuTimer::poll(double &ms) {
+    if (!isValid() || m_begun == m_read) {
+        return false;
+    }
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        // every span in flight may be wrong
+        m_read = m_begun;
+        return false;
+    }
+    bool found = false;
+    while (m_read != m_begun) {
+        GLuint query = m_queries[m_read % QUERIES];
+        GLuint available = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+        GLuint64 ns = 0;
+        m_getQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        ms = ns * 1e-6;
+        found = true;
+        m_read++;
+    }
+    return found;
+}
+#endif
+
+} // namespace common
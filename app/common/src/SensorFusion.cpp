@@ -0,0 +1,136 @@
+#include "SensorFusion.h"
+
+#include <math.h>
+
+namespace common {
+
+static const float GRAVITY = 9.80665f;
+// samples further apart restart the integration, the sensor was off or the
+// queue overflowed
+static const int64_t MAX_GAP_NS = 100000000;
+
+// rotation by rate over dt, in the device frame
+static glm::quat rotation(const glm::vec3 &rate, float dt) {
+    float angle = glm::length(rate) * dt;
+    if (angle < 1e-6f) {
+        glm::vec3 half = rate * (dt * 0.5f);
+        return glm::normalize(glm::quat(1.0f, half.x, half.y, half.z));
+    }
+    return glm::angleAxis(angle, rate * (dt / angle));
+}
+
+// shortest rotation taking up to the world +z, up normalized
+static glm::quat level(const glm::vec3 &up) {
+    if (up.z < -0.9999f) {
+        return glm::quat(0.0f, 1.0f, 0.0f, 0.0f);
+    }
+    glm::vec3 axis = glm::cross(up, glm::vec3(0.0f, 0.0f, 1.0f));
+    return glm::normalize(glm::quat(1.0f + up.z, axis.x, axis.y, axis.z));
+}
+
+static bool inGap(int64_t last, int64_t time) {
+    return last && time > last && time - last < MAX_GAP_NS;
+}
+
+OrientationFilter::OrientationFilter(float kp) : m_kp(kp) {
+    reset();
+}
+
+void OrientationFilter::reset() {
+    m_orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    m_angularVelocity = glm::vec3(0.0f);
+    m_gravity = glm::vec3(0.0f, 0.0f, 1.0f);
+    m_hasGravity = false;
+    m_timeNs = 0;
+    m_accelerometerTimeNs = 0;
+    m_gyroscopeTimeNs = 0;
+    m_rotationTimeNs = 0;
+}
+
+void OrientationFilter::integrate(const glm::vec3 &rate, float dt) {
+    glm::vec3 omega = rate;
+    // the rotation vector carries its own tilt correction
+    if (m_hasGravity && !m_rotationTimeNs) {
+        // world up in the device frame as the estimate has it
+        glm::vec3 up = glm::conjugate(m_orientation) * glm::vec3(0.0f, 0.0f, 1.0f);
+        omega += m_kp * glm::cross(m_gravity, up);
+    }
+    m_orientation = glm::normalize(m_orientation * rotation(omega, dt));
+}
+
+void OrientationFilter::update(const SensorSample &sample) {
+    int64_t time = sample.TimeNs;
+    switch (sample.Type) {
+    case SENSOR_ACCELEROMETER:
+    {
+        glm::vec3 acceleration(sample.Value.x, sample.Value.y, sample.Value.z);
+        float g = glm::length(acceleration);
+        // a moving hand adds its own acceleration, trust only about 1 g
+        m_hasGravity = fabsf(g - GRAVITY) < 0.2f * GRAVITY;
+        if (m_hasGravity) {
+            m_gravity = acceleration / g;
+        }
+        bool alone = !inGap(m_gyroscopeTimeNs, time) && !inGap(m_rotationTimeNs, time);
+        if (alone && m_hasGravity) {
+            if (!m_timeNs) {
+                m_orientation = level(m_gravity);
+            } else if (inGap(m_accelerometerTimeNs, time)) {
+                m_angularVelocity = glm::vec3(0.0f);
+                integrate(m_angularVelocity, (time - m_accelerometerTimeNs) * 1e-9f);
+            }
+            m_timeNs = time;
+        }
+        m_accelerometerTimeNs = time;
+        break;
+    }
+    case SENSOR_GYROSCOPE:
+    {
+        m_angularVelocity = glm::vec3(sample.Value.x, sample.Value.y, sample.Value.z);
+        if (!m_timeNs && m_hasGravity) {
+            m_orientation = level(m_gravity);
+        }
+        // stale rotation vectors stop counting, the gyroscope takes over
+        if (!inGap(m_rotationTimeNs, time)) {
+            m_rotationTimeNs = 0;
+        }
+        if (inGap(m_gyroscopeTimeNs, time)) {
+            integrate(m_angularVelocity, (time - m_gyroscopeTimeNs) * 1e-9f);
+        }
+        m_gyroscopeTimeNs = time;
+        m_timeNs = time;
+        break;
+    }
+    case SENSOR_ROTATION_VECTOR:
+    {
+        glm::quat rotation = glm::normalize(glm::quat(sample.Value.w, sample.Value.x,
+                sample.Value.y, sample.Value.z));
+        if (!inGap(m_gyroscopeTimeNs, time) && inGap(m_rotationTimeNs, time)) {
+            // no gyroscope, the change since the last vector gives the rate
+            glm::quat delta = glm::conjugate(m_orientation) * rotation;
+            if (delta.w < 0.0f) {
+                delta = -delta;
+            }
+            glm::vec3 axis(delta.x, delta.y, delta.z);
+            float s = glm::length(axis);
+            float dt = (time - m_rotationTimeNs) * 1e-9f;
+            float scale = s > 1e-7f ? 2.0f * atan2f(s, delta.w) / s : 2.0f;
+            m_angularVelocity = axis * (scale / dt);
+        }
+        m_orientation = rotation;
+        m_rotationTimeNs = time;
+        m_timeNs = time;
+        break;
+    }
+    }
+}
+
+glm::quat OrientationFilter::predict(int64_t timeNs) const {
+    int64_t ahead = timeNs - m_timeNs;
+    // nothing to extrapolate from, or the estimate is stale
+    if (!m_timeNs || ahead <= 0 || ahead > MAX_PREDICTION_NS) {
+        return m_orientation;
+    }
+    return glm::normalize(m_orientation * rotation(m_angularVelocity, ahead * 1e-9f));
+}
+
+} // namespace common
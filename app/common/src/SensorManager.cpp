@@ -1,14 +1,42 @@
 #include "SensorManager.h"
 
+#include <algorithm>
+
 #ifdef __ANDROID__
 #include <dlfcn.h>
 #include <assert.h>
+#include <math.h>
+#include <time.h>
 #include "LogUtil.h"
+#else
+#include <chrono>
+#endif
 
 namespace common {
+#ifdef __ANDROID__
+// not in the headers of older NDKs
+static const int SENSOR_TYPE_GAME_ROTATION_VECTOR = 15;
+// events read per call
+static const int EVENT_BATCH = 32;
+// readers gone for longer let the sensors idle
+static const int64_t IDLE_AFTER_NS = 1000000000;
+// event periods in us: fusion, accelerometer only, nobody reading
+static const int32_t FUSION_PERIOD_US = 5000;
+static const int32_t STATE_PERIOD_US = (1000 / 60) * 1000;
+static const int32_t IDLE_PERIOD_US = 200000;
+// smaller changes are noise, not worth a frame
+static const float ACCELERATION_CHANGE = 0.1f;
+static const float ROTATION_RATE_CHANGE = 0.02f;
+// cos of half of 0.2 degrees
+static const float ROTATION_CHANGE = 0.9999985f;
+
 SensorManager::SensorManager() :
     m_sensorManger(nullptr), m_sensorEventQueue(nullptr),
-    m_accelerometerSensor(nullptr) {
+    m_accelerometerSensor(nullptr), m_gyroscopeSensor(nullptr), m_rotationSensor(nullptr),
+    m_accelerometerPeriodUs(0), m_orientationSensors(false), m_lastAcceleration(0.0f),
+    m_lastRotation(1.0f, 0.0f, 0.0f, 0.0f), m_dropped(0), m_overflowed(false), m_stateReadNs(0),
+    m_orientationReadNs(0), m_stateUsed(false), m_orientationUsed(false),
+    m_orientation(1.0f, 0.0f, 0.0f, 0.0f), m_stateRead(false), m_orientationRead(false) {
 
 }
 
@@ -20,23 +48,60 @@ void SensorManager::init(struct android_app *state) {
     m_sensorManger = AcquireASensorManagerInstance(state);
     m_accelerometerSensor = ASensorManager_getDefaultSensor(
                 m_sensorManger, ASENSOR_TYPE_ACCELEROMETER);
+    // optional, the filter makes do with whatever the device has
+    m_gyroscopeSensor = ASensorManager_getDefaultSensor(m_sensorManger, ASENSOR_TYPE_GYROSCOPE);
+    m_rotationSensor = ASensorManager_getDefaultSensor(m_sensorManger,
+                                                       SENSOR_TYPE_GAME_ROTATION_VECTOR);
     m_sensorEventQueue = ASensorManager_createEventQueue(
                 m_sensorManger, state->looper, LOOPER_ID_USER, nullptr, nullptr);
 }
 
 void SensorManager::suspend() {
-    if (m_accelerometerSensor) {
-        ASensorEventQueue_disableSensor(m_sensorEventQueue, m_accelerometerSensor);
+    const ASensor *sensors[] = { m_accelerometerSensor, m_gyroscopeSensor, m_rotationSensor };
+    for (const ASensor *sensor : sensors) {
+        if (sensor) {
+            ASensorEventQueue_disableSensor(m_sensorEventQueue, sensor);
+        }
     }
+    m_accelerometerPeriodUs = 0;
+    m_orientationSensors = false;
 }
 
 void SensorManager::resume() {
-    if (m_accelerometerSensor) {
-        ASensorEventQueue_enableSensor(m_sensorEventQueue, m_accelerometerSensor);
-        // We'd like to get 60 events per second (in us).
-        ASensorEventQueue_setEventRate(m_sensorEventQueue, m_accelerometerSensor,
-                                       (1000L / 60) * 1000);
+    // count on a reader until the frames show otherwise
+    int64_t now = NowNs();
+    m_stateReadNs.store(now, std::memory_order_relaxed);
+    m_orientationReadNs.store(now, std::memory_order_relaxed);
+    setRates(now);
+}
+
+void SensorManager::setRates(int64_t now) {
+    bool orientation = now - m_orientationReadNs.load(std::memory_order_relaxed) < IDLE_AFTER_NS;
+    bool state = orientation || now - m_stateReadNs.load(std::memory_order_relaxed) < IDLE_AFTER_NS;
+    int32_t period = orientation ? FUSION_PERIOD_US : (state ? STATE_PERIOD_US : IDLE_PERIOD_US);
+    if (m_accelerometerSensor && period != m_accelerometerPeriodUs) {
+        if (!m_accelerometerPeriodUs) {
+            ASensorEventQueue_enableSensor(m_sensorEventQueue, m_accelerometerSensor);
+        }
+        ASensorEventQueue_setEventRate(m_sensorEventQueue, m_accelerometerSensor, period);
+        m_accelerometerPeriodUs = period;
+    }
+    if (orientation == m_orientationSensors) {
+        return;
     }
+    const ASensor *sensors[] = { m_gyroscopeSensor, m_rotationSensor };
+    for (const ASensor *sensor : sensors) {
+        if (!sensor) {
+            continue;
+        }
+        if (orientation) {
+            ASensorEventQueue_enableSensor(m_sensorEventQueue, sensor);
+            ASensorEventQueue_setEventRate(m_sensorEventQueue, sensor, FUSION_PERIOD_US);
+        } else {
+            ASensorEventQueue_disableSensor(m_sensorEventQueue, sensor);
+        }
+    }
+    m_orientationSensors = orientation;
 }
 
 ASensorManager *SensorManager::AcquireASensorManagerInstance(struct android_app *app) {
@@ -79,18 +144,186 @@ ASensorManager *SensorManager::AcquireASensorManagerInstance(struct android_app
     return getInstanceFunc();
 }
 
-void SensorManager::processSensors(int32_t id) {
-    if (id == LOOPER_ID_USER) {
-        if (m_accelerometerSensor) {
-            ASensorEvent event;
-            while (ASensorEventQueue_getEvents(m_sensorEventQueue, &event, 1) > 0) {
-                m_acceleratorState.X = event.acceleration.x;
-                m_acceleratorState.Y = event.acceleration.y;
-                m_acceleratorState.Z = event.acceleration.z;
+bool SensorManager::processSensors(int32_t id) {
+    if (id != LOOPER_ID_USER || !m_sensorEventQueue) {
+        return false;
+    }
+    bool state = m_stateUsed.load(std::memory_order_relaxed);
+    bool orientation = m_orientationUsed.load(std::memory_order_relaxed);
+    bool changed = false;
+    ASensorEvent events[EVENT_BATCH];
+    ssize_t count;
+    while ((count = ASensorEventQueue_getEvents(m_sensorEventQueue, events, EVENT_BATCH)) > 0) {
+        for (ssize_t i = 0; i < count; ++i) {
+            const ASensorEvent &event = events[i];
+            SensorSample sample;
+            sample.TimeNs = event.timestamp;
+            if (event.type == ASENSOR_TYPE_ACCELEROMETER) {
+                sample.Type = SENSOR_ACCELEROMETER;
+                sample.Value = glm::vec4(event.acceleration.x, event.acceleration.y,
+                                         event.acceleration.z, 0.0f);
+                glm::vec3 acceleration(sample.Value.x, sample.Value.y, sample.Value.z);
+                if ((state || orientation) &&
+                        glm::length(acceleration - m_lastAcceleration) > ACCELERATION_CHANGE) {
+                    m_lastAcceleration = acceleration;
+                    changed = true;
+                }
+            } else if (event.type == ASENSOR_TYPE_GYROSCOPE) {
+                sample.Type = SENSOR_GYROSCOPE;
+                sample.Value = glm::vec4(event.data[0], event.data[1], event.data[2], 0.0f);
+                if (orientation && glm::length(glm::vec3(sample.Value.x, sample.Value.y,
+                        sample.Value.z)) > ROTATION_RATE_CHANGE) {
+                    changed = true;
+                }
+            } else if (event.type == SENSOR_TYPE_GAME_ROTATION_VECTOR) {
+                sample.Type = SENSOR_ROTATION_VECTOR;
+                sample.Value = glm::vec4(event.data[0], event.data[1], event.data[2], event.data[3]);
+                glm::quat rotation(sample.Value.w, sample.Value.x, sample.Value.y, sample.Value.z);
+                if (orientation && fabsf(glm::dot(rotation, m_lastRotation)) < ROTATION_CHANGE) {
+                    m_lastRotation = rotation;
+                    changed = true;
+                }
+            } else {
+                continue;
             }
+            pushSample(sample);
         }
     }
+    setRates(NowNs());
+    return changed;
+}
+
+int64_t SensorManager::NowNs() {
+    timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#else
+// no sensors on host builds, the state stays at rest unless samples are
+// pushed by hand
+SensorManager::SensorManager() :
+    m_dropped(0), m_overflowed(false), m_stateReadNs(0), m_orientationReadNs(0), m_stateUsed(false),
+    m_orientationUsed(false), m_orientation(1.0f, 0.0f, 0.0f, 0.0f), m_stateRead(false),
+    m_orientationRead(false) {}
+
+SensorManager::~SensorManager() {}
+
+void SensorManager::init(struct android_app *state) {}
+
+void SensorManager::suspend() {}
+
+void SensorManager::resume() {}
+
+bool SensorManager::processSensors(int32_t id) {
+    return false;
+}
+
+int64_t SensorManager::NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 #endif
 
+static int sampleSlot(SensorType type) {
+    switch (type) {
+    case SENSOR_GYROSCOPE: return 1;
+    case SENSOR_ROTATION_VECTOR: return 2;
+    default: return 0;
+    }
+}
+
+bool SensorManager::pushSample(const SensorSample &sample) {
+    if (m_samples.push(sample)) {
+        return true;
+    }
+    // the render thread hasn't drained for a while, e.g. idle on demand, what
+    // is queued is history by now
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(m_overflowMutex);
+    m_overflow[sampleSlot(sample.Type)] = sample;
+    m_overflowed.store(true, std::memory_order_release);
+    return false;
+}
+
+void SensorManager::applySample(const SensorSample &sample) {
+    if (sample.Type == SENSOR_ACCELEROMETER) {
+        m_acceleratorState.X = sample.Value.x;
+        m_acceleratorState.Y = sample.Value.y;
+        m_acceleratorState.Z = sample.Value.z;
+    }
+    m_filter.update(sample);
+}
+
+void SensorManager::update(int64_t displayTimeNs) {
+    // newest samples that didn't fit, oldest first, empty slots in front
+    SensorSample latest[SENSOR_SLOTS];
+    int next = SENSOR_SLOTS;
+    if (m_overflowed.load(std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::mutex> lock(m_overflowMutex);
+            for (int i = 0; i < SENSOR_SLOTS; ++i) {
+                latest[i] = m_overflow[i];
+                m_overflow[i] = SensorSample();
+            }
+            m_overflowed.store(false, std::memory_order_relaxed);
+        }
+        std::sort(latest, latest + SENSOR_SLOTS, [](const SensorSample &a, const SensorSample &b) {
+            return a.TimeNs < b.TimeNs;
+        });
+        for (next = 0; next < SENSOR_SLOTS && !latest[next].TimeNs; ++next) {
+        }
+    }
+    SensorSample sample;
+    while (m_samples.pop(sample)) {
+        // queued before the sample of the same sensor that didn't fit: the
+        // backlog it replaces
+        bool stale = false;
+        for (int i = 0; i < SENSOR_SLOTS; ++i) {
+            stale = stale || (latest[i].TimeNs && latest[i].Type == sample.Type &&
+                              latest[i].TimeNs >= sample.TimeNs);
+        }
+        if (stale) {
+            continue;
+        }
+        // queued after the overflow, what didn't fit and is older goes first
+        for (; next < SENSOR_SLOTS && latest[next].TimeNs <= sample.TimeNs; ++next) {
+            applySample(latest[next]);
+        }
+        applySample(sample);
+    }
+    for (; next < SENSOR_SLOTS; ++next) {
+        applySample(latest[next]);
+    }
+    m_orientation = m_filter.predict(displayTimeNs);
+
+    // tell the looper which sensors the last frame used
+    if (m_stateRead || m_orientationRead) {
+        int64_t now = NowNs();
+        if (m_stateRead) {
+            m_stateReadNs.store(now, std::memory_order_relaxed);
+            m_stateUsed.store(true, std::memory_order_relaxed);
+        }
+        if (m_orientationRead) {
+            m_orientationReadNs.store(now, std::memory_order_relaxed);
+            m_orientationUsed.store(true, std::memory_order_relaxed);
+        }
+        m_stateRead = m_orientationRead = false;
+    }
+}
+
+AcceleratorState SensorManager::getState() const {
+    m_stateRead = true;
+    return m_acceleratorState;
+}
+
+glm::quat SensorManager::getOrientation() const {
+    m_orientationRead = true;
+    return m_orientation;
+}
+
+glm::quat SensorManager::predictOrientation(int64_t timeNs) const {
+    m_orientationRead = true;
+    return m_filter.predict(timeNs);
+}
+
 } // namespace common
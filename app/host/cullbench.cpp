@@ -0,0 +1,352 @@
+// Frustum culling microbenchmark, SIMD kernel against the scalar loop and
+// the BVH over random boxes in front of and around a 60 degree camera. Then
+// ray picking on a million triangle sphere, and software occlusion on a
+// street level view of a city block grid, and the render queue sort.
+#include "Bvh.h"
+#include "FrustumCuller.h"
+#include "RenderQueue.h"
+#include "SoftwareOcclusion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <glm/gtc/matrix_transform.hpp>
+
+typedef std::chrono::steady_clock Clock;
+
+// best of several runs, in nanoseconds per box
+template <typename F>
+static double measure(uint32_t count, F cull) {
+    double best = 1e30;
+    int runs = std::max(5, (int)(20000000 / count));
+    for (int run = 0; run < runs; ++run) {
+        auto start = Clock::now();
+        cull();
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        best = std::min(best, elapsed.count() / count);
+    }
+    return best;
+}
+
+// brute force reference for the picking benchmark
+static bool intersectTriangles(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+        const glm::vec3 &origin, const glm::vec3 &direction, float &t) {
+    bool found = false;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        const glm::vec3 &v0 = positions[indices[i]];
+        glm::vec3 e1 = positions[indices[i + 1]] - v0, e2 = positions[indices[i + 2]] - v0;
+        glm::vec3 p = glm::cross(direction, e2), s = origin - v0, q = glm::cross(s, e1);
+        float inv = 1.0f / glm::dot(e1, p);
+        float u = glm::dot(s, p) * inv, v = glm::dot(direction, q) * inv, d = glm::dot(e2, q) * inv;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && d >= 0.0f && d < t) {
+            t = d;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// rays from random points around a 1M triangle unit sphere towards it
+static int benchPicking(util::ThreadPool &pool) {
+    const uint32_t rings = 708, segments = 708;
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    for (uint32_t r = 0; r <= rings; ++r) {
+        float theta = 3.14159265f * r / rings;
+        for (uint32_t s = 0; s <= segments; ++s) {
+            float phi = 2.0f * 3.14159265f * s / segments;
+            positions.push_back(glm::vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)));
+        }
+    }
+    for (uint32_t r = 0; r < rings; ++r) {
+        for (uint32_t s = 0; s < segments; ++s) {
+            uint32_t a = r * (segments + 1) + s, b = a + segments + 1;
+            uint32_t quad[6] = { a, a + 1, b, b, a + 1, b + 1 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    util::TriangleBvh mesh;
+    auto start = Clock::now();
+    mesh.build(positions, indices, &pool);
+    std::chrono::duration<double, std::milli> buildMs = Clock::now() - start;
+
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    const uint32_t rays = 10000;
+    std::vector<glm::vec3> origins(rays), directions(rays);
+    for (uint32_t i = 0; i < rays; ++i) {
+        origins[i] = glm::normalize(glm::vec3(unit(random), unit(random), unit(random))) * 3.0f;
+        glm::vec3 target(unit(random), unit(random), unit(random));
+        directions[i] = target - origins[i];
+    }
+    uint32_t hits = 0;
+    start = Clock::now();
+    for (uint32_t i = 0; i < rays; ++i) {
+        float t = 1e30f;
+        uint32_t triangle;
+        hits += mesh.intersect(origins[i], directions[i], t, triangle);
+    }
+    std::chrono::duration<double, std::micro> rayUs = Clock::now() - start;
+
+    // the bvh must find the same closest hits as a linear scan
+    for (uint32_t i = 0; i < 20; ++i) {
+        float t = 1e30f, reference = 1e30f;
+        uint32_t triangle;
+        bool hit = mesh.intersect(origins[i], directions[i], t, triangle);
+        if (hit != intersectTriangles(positions, indices, origins[i], directions[i], reference) ||
+                fabsf(t - reference) > 1e-4f * reference) {
+            fprintf(stderr, "ray %u: bvh %f, linear %f!\n", i, t, reference);
+            return 1;
+        }
+    }
+    printf("picking: %u triangles, %u nodes, build %.3f ms, %.2f us/ray, %u/%u hits\n",
+           mesh.triangleCount(), mesh.bvh().nodeCount(), buildMs.count(), rayUs.count() / rays, hits, rays);
+    return 0;
+}
+
+// closed box, counter clockwise seen from outside
+static void appendBox(const glm::vec3 &center, const glm::vec3 &extent, std::vector<glm::vec3> &positions,
+        std::vector<uint32_t> &indices) {
+    static const uint32_t boxIndices[] = {
+        0, 1, 2, 2, 3, 0,   1, 5, 6, 6, 2, 1,   7, 6, 5, 5, 4, 7,
+        4, 0, 3, 3, 7, 4,   4, 5, 1, 1, 0, 4,   3, 2, 6, 6, 7, 3,
+    };
+    static const float corners[8][3] = {
+        { -1, -1,  1 }, {  1, -1,  1 }, {  1,  1,  1 }, { -1,  1,  1 },
+        { -1, -1, -1 }, {  1, -1, -1 }, {  1,  1, -1 }, { -1,  1, -1 },
+    };
+    uint32_t base = positions.size();
+    for (auto &c : corners) {
+        positions.push_back(center + extent * glm::vec3(c[0], c[1], c[2]));
+    }
+    for (auto i : boxIndices) {
+        indices.push_back(base + i);
+    }
+}
+
+// slab test of the segment from a to b against any of the boxes
+static bool segmentHitsBox(const glm::vec3 &a, const glm::vec3 &b, const std::vector<glm::vec3> &centers,
+        const std::vector<glm::vec3> &extents) {
+    glm::vec3 d = b - a;
+    for (size_t i = 0; i < centers.size(); ++i) {
+        float t0 = 0.0f, t1 = 1.0f;
+        for (int k = 0; k < 3 && t0 <= t1; ++k) {
+            float lo = centers[i][k] - extents[i][k], hi = centers[i][k] + extents[i][k];
+            if (fabsf(d[k]) < 1e-6f) {
+                if (a[k] < lo || a[k] > hi) {
+                    t0 = 2.0f;
+                }
+                continue;
+            }
+            float u = (lo - a[k]) / d[k], v = (hi - a[k]) / d[k];
+            t0 = std::max(t0, std::min(u, v));
+            t1 = std::min(t1, std::max(u, v));
+        }
+        if (t0 <= t1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int benchSoftwareOcclusion(const glm::mat4 &viewProjection, const glm::vec3 &eye) {
+    // 20 x 20 blocks of 16 x 16 with 8 unit streets, one mesh per block
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> height(6.0f, 40.0f);
+    std::vector<std::vector<glm::vec3> > positions;
+    std::vector<std::vector<uint32_t> > indices;
+    std::vector<glm::vec3> blockCenters, blockExtents;
+    for (int x = -10; x < 10; ++x) {
+        for (int z = -20; z < 0; ++z) {
+            float h = height(random);
+            positions.push_back(std::vector<glm::vec3>());
+            indices.push_back(std::vector<uint32_t>());
+            blockCenters.push_back(glm::vec3(x * 24.0f + 12.0f, h - 2.0f, z * 24.0f + 4.0f));
+            blockExtents.push_back(glm::vec3(8.0f, h, 8.0f));
+            appendBox(blockCenters.back(), blockExtents.back(), positions.back(), indices.back());
+        }
+    }
+    std::vector<const std::vector<glm::vec3> *> positionPtrs;
+    std::vector<const std::vector<uint32_t> *> indexPtrs;
+    for (size_t i = 0; i < positions.size(); ++i) {
+        positionPtrs.push_back(&positions[i]);
+        indexPtrs.push_back(&indices[i]);
+    }
+
+    util::SoftwareOcclusionCuller culler;
+    // nothing stands between the camera and this box
+    culler.clear();
+    culler.renderOccluders(viewProjection, positionPtrs, indexPtrs);
+    if (!culler.testBox(viewProjection, glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.5f))) {
+        fprintf(stderr, "box in front of the occluders was culled!\n");
+        return 1;
+    }
+
+    printf("software occlusion: %ux%u tiles of %ux%u, %u threads, %zu occluders\n",
+           culler.width() / util::SoftwareOcclusionCuller::TILE_WIDTH,
+           culler.height() / util::SoftwareOcclusionCuller::TILE_HEIGHT,
+           util::SoftwareOcclusionCuller::TILE_WIDTH, util::SoftwareOcclusionCuller::TILE_HEIGHT,
+           culler.threadPool().threadCount(), positions.size());
+    uint32_t counts[] = { 10000, 100000 };
+    for (auto count : counts) {
+        // small props along the streets and inside the blocks, only the
+        // ones inside the frustum are tested
+        std::uniform_real_distribution<float> x(-240.0f, 240.0f), z(-480.0f, 0.0f), size(0.5f, 2.0f);
+        util::FrustumCuller frustum;
+        std::vector<glm::vec3> centers, extents;
+        std::vector<uint32_t> inside;
+        while (centers.size() < count) {
+            glm::vec3 extent(size(random), size(random), size(random));
+            glm::vec3 center(x(random), extent.y - 2.0f, z(random));
+            frustum.clear();
+            frustum.add(center, extent);
+            if (!frustum.cull(viewProjection, inside)) {
+                continue;
+            }
+            centers.push_back(center);
+            extents.push_back(extent);
+        }
+
+        std::vector<uint8_t> visible(count);
+        double rasterMs = 1e30, testMs = 1e30;
+        for (int run = 0; run < 10; ++run) {
+            auto start = Clock::now();
+            culler.clear();
+            culler.renderOccluders(viewProjection, positionPtrs, indexPtrs);
+            auto rasterEnd = Clock::now();
+            const uint32_t chunk = 256;
+            culler.threadPool().parallelFor((count + chunk - 1) / chunk, [&](uint32_t c) {
+                uint32_t end = std::min(count, (c + 1) * chunk);
+                for (uint32_t i = c * chunk; i < end; ++i) {
+                    visible[i] = culler.testBox(viewProjection, centers[i], extents[i]);
+                }
+            });
+            std::chrono::duration<double, std::milli> raster = rasterEnd - start, test = Clock::now() - rasterEnd;
+            rasterMs = std::min(rasterMs, raster.count());
+            testMs = std::min(testMs, test.count());
+        }
+
+        // a culled box must not see the eye from its center
+        uint32_t culled = 0, wrong = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!visible[i]) {
+                culled++;
+                wrong += !segmentHitsBox(eye, centers[i], blockCenters, blockExtents);
+            }
+        }
+        if (wrong) {
+            fprintf(stderr, "%u culled boxes are in plain sight!\n", wrong);
+            return 1;
+        }
+        printf("%7u occludees in frustum: %u occluder triangles, raster %.3f ms, test %.3f ms,"
+               " occluded %.1f%%\n",
+               count, culler.stats().Triangles, rasterMs, testMs, 100.0f * culled / count);
+    }
+    return 0;
+}
+
+// random opaque draws over a few programs, materials and meshes, radix
+// sort against std::sort on the same keys; only sorts, nothing is drawn
+static void benchRenderQueue() {
+    const uint32_t count = 100000;
+    std::mt19937 random(1);
+    std::uniform_int_distribution<uint32_t> program(1, 16), material(1, 256), vao(1, 1024);
+    std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+    util::RenderQueue queue;
+    std::vector<uint64_t> keys(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        util::DrawPacket packet;
+        packet.Program = program(random);
+        packet.Texture = material(random);
+        packet.VAO = vao(random);
+        keys[i] = util::RenderQueue::MakeKey(0, false, packet.Program, packet.Texture, packet.VAO, depth(random));
+        queue.submit(keys[i], packet);
+    }
+    queue.sort();
+    // later runs start from sorted input, which costs the radix sort the same
+    const util::RenderQueueStats stats = queue.stats();
+    double radixMs = stats.SortMs, stdMs = 1e30;
+    for (int run = 0; run < 10; ++run) {
+        queue.sort();
+        radixMs = std::min(radixMs, queue.stats().SortMs);
+        std::vector<uint64_t> sorted(keys);
+        auto start = Clock::now();
+        std::sort(sorted.begin(), sorted.end());
+        std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+        stdMs = std::min(stdMs, elapsed.count());
+    }
+    printf("render queue: %u packets, radix sort %.3f ms std::sort %.3f ms, program/material/vao changes"
+           " %u/%u/%u sorted, %u/%u/%u unsorted\n",
+           stats.Packets, radixMs, stdMs, stats.ProgramChanges, stats.TextureChanges, stats.VAOChanges,
+           stats.UnsortedProgramChanges, stats.UnsortedTextureChanges, stats.UnsortedVAOChanges);
+}
+
+int main(int argc, char **argv) {
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 500.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 viewProjection = projection * view;
+
+    util::ThreadPool pool;
+    printf("kernel: %s, %u threads\n", util::FrustumCuller::simdName(), pool.threadCount());
+    uint32_t counts[] = { 10000, 100000, 1000000 };
+    for (auto count : counts) {
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> position(-400.0f, 400.0f), size(0.5f, 4.0f);
+        util::FrustumCuller culler;
+        std::vector<glm::vec3> centers(count), extents(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            centers[i] = glm::vec3(position(random), position(random) * 0.25f, position(random));
+            extents[i] = glm::vec3(size(random), size(random), size(random));
+            culler.add(centers[i], extents[i]);
+        }
+        util::Bvh bvh;
+        auto buildStart = Clock::now();
+        bvh.build(centers, extents, &pool);
+        std::chrono::duration<double, std::milli> buildMs = Clock::now() - buildStart;
+
+        std::vector<uint32_t> scalarVisible, simdVisible, bvhVisible;
+        double scalarNs = measure(count, [&]() { culler.cullScalar(viewProjection, scalarVisible); });
+        double simdNs = measure(count, [&]() { culler.cull(viewProjection, simdVisible); });
+        double bvhNs = measure(count, [&]() { bvh.cull(viewProjection, bvhVisible); });
+        std::sort(bvhVisible.begin(), bvhVisible.end());
+        if (scalarVisible != simdVisible || scalarVisible != bvhVisible) {
+            fprintf(stderr, "visible lists differ at %u boxes!\n", count);
+            return 1;
+        }
+
+        // every box drifts a little, as moving objects would between frames
+        std::uniform_real_distribution<float> drift(-2.0f, 2.0f);
+        for (uint32_t i = 0; i < count; ++i) {
+            centers[i] += glm::vec3(drift(random), drift(random), drift(random));
+            culler.update(i, centers[i], extents[i]);
+        }
+        auto refitStart = Clock::now();
+        bvh.refit(centers, extents);
+        std::chrono::duration<double, std::milli> refitMs = Clock::now() - refitStart;
+        culler.cull(viewProjection, simdVisible);
+        bvh.cull(viewProjection, bvhVisible);
+        std::sort(bvhVisible.begin(), bvhVisible.end());
+        if (simdVisible != bvhVisible) {
+            fprintf(stderr, "visible lists differ after refit at %u boxes!\n", count);
+            return 1;
+        }
+        printf("%7u boxes: visible %6zu scalar %.2f ns/box (%.3f ms) simd %.2f ns/box (%.3f ms) %.1fx"
+               " bvh %.3f ms, build %.3f ms refit %.3f ms\n",
+               count, simdVisible.size(), scalarNs, scalarNs * count * 1e-6, simdNs, simdNs * count * 1e-6,
+               scalarNs / simdNs, bvhNs * count * 1e-6, buildMs.count(), refitMs.count());
+    }
+
+    if (benchPicking(pool)) {
+        return 1;
+    }
+    benchRenderQueue();
+
+    glm::vec3 eye(0.0f, 1.7f, 0.0f);
+    glm::mat4 street = glm::lookAt(eye, eye + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    return benchSoftwareOcclusion(projection * street, eye);
+}
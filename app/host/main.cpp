@@ -0,0 +1,511 @@
+#include "Engine.h"
+#include "CubeRenderer.h"
+#include "GLContext.h"
+#include "AssetHelper.h"
+#include "ProgramBinaryCache.h"
+#include "ShaderCompileQueue.h"
+#include "AsyncLoader.h"
+#include "TextureManager.h"
+#include "TextureStreamer.h"
+#include "LogUtil.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HostOptions {
+    std::string assetDir = QVIEWER_ASSET_DIR;
+    std::string dumpFile;
+    std::string cacheDir;
+    // upload one asset into a GL buffer and report peak memory
+    std::string uploadAsset;
+    bool uploadCopy = false;
+    // load textures by name, comma separated, and report their format and memory
+    std::vector<std::string> textures;
+    // texture families to pretend the context samples, 0 keeps what it has
+    uint32_t textureFormats = 0;
+    // streaming budget in kB, 0 keeps every level resident
+    size_t textureBudgetKb = 0;
+    // on-screen size every texture is drawn at, 0 never draws them
+    float textureSize = 0.0f;
+    // trim memory before this frame, as on APP_CMD_LOW_MEMORY
+    int32_t trimAt = -1;
+    // tier of the trim, none escalates like repeated warnings do
+    common::MemoryPressure trimLevel = common::MEMORY_PRESSURE_NONE;
+    CubeRenderer::OcclusionMode occlusion = CubeRenderer::OcclusionNone;
+    // copies of the cube for the instancing benchmark
+    uint32_t instances = 0;
+    bool instancing = true;
+    uint32_t framesInFlight = 3;
+    // frame pacing, 0 fps swaps as fast as possible
+    float targetFps = 0.0f;
+    uint32_t swapDepth = 2;
+    // GPU budget of the scene for dynamic resolution, 0 renders at native resolution
+    double sceneBudgetMs = 0.0;
+    // draw on the engine's render thread, this one plays the android looper
+    bool renderThread = false;
+    // every frame on the render thread instead of on demand
+    bool continuous = false;
+    // pick at this window position after the last frame
+    bool tap = false;
+    float tapX = 0.0f, tapY = 0.0f;
+    int32_t width = 1280;
+    int32_t height = 720;
+    int32_t frames = 300;
+};
+
+static void printUsage(const char *name) {
+    printf("usage: %s [--assets dir] [--frames n] [--width w] [--height h] [--dump file.ppm]"
+           " [--cache dir]"
+           " [--upload-asset name] [--upload-mode view|copy] [--occlusion queries|software|off]"
+           " [--tap x,y] [--instances n] [--instancing on|off] [--frames-in-flight n]"
+           " [--render-thread on|off] [--continuous on|off] [--target-fps n] [--swap-depth n]"
+           " [--scene-budget ms] [--texture name,...] [--texture-formats astc|etc2|none]"
+           " [--texture-budget kB] [--texture-size px] [--trim-at frame]"
+           " [--trim-level caches|budgets|hidden|context]\n",
+           name);
+}
+
+static bool parseOptions(int argc, char **argv, HostOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!value) {
+            return false;
+        }
+        if (!strcmp(arg, "--assets")) {
+            options.assetDir = value;
+        } else if (!strcmp(arg, "--frames")) {
+            options.frames = atoi(value);
+        } else if (!strcmp(arg, "--width")) {
+            options.width = atoi(value);
+        } else if (!strcmp(arg, "--height")) {
+            options.height = atoi(value);
+        } else if (!strcmp(arg, "--dump")) {
+            options.dumpFile = value;
+        } else if (!strcmp(arg, "--cache")) {
+            options.cacheDir = value;
+        } else if (!strcmp(arg, "--upload-asset")) {
+            options.uploadAsset = value;
+        } else if (!strcmp(arg, "--upload-mode")) {
+            options.uploadCopy = !strcmp(value, "copy");
+        } else if (!strcmp(arg, "--instances")) {
+            options.instances = atoi(value);
+        } else if (!strcmp(arg, "--instancing")) {
+            options.instancing = strcmp(value, "off") != 0;
+        } else if (!strcmp(arg, "--frames-in-flight")) {
+            options.framesInFlight = std::max(1, atoi(value));
+        } else if (!strcmp(arg, "--target-fps")) {
+            options.targetFps = atof(value);
+        } else if (!strcmp(arg, "--swap-depth")) {
+            options.swapDepth = atoi(value);
+        } else if (!strcmp(arg, "--scene-budget")) {
+            options.sceneBudgetMs = atof(value);
+        } else if (!strcmp(arg, "--texture")) {
+            for (const char *name = value; *name;) {
+                const char *end = strchr(name, ',');
+                size_t length = end ? end - name : strlen(name);
+                options.textures.push_back(std::string(name, length));
+                name += end ? length + 1 : length;
+            }
+        } else if (!strcmp(arg, "--texture-budget")) {
+            options.textureBudgetKb = atoi(value);
+        } else if (!strcmp(arg, "--texture-size")) {
+            options.textureSize = atof(value);
+        } else if (!strcmp(arg, "--trim-at")) {
+            options.trimAt = atoi(value);
+        } else if (!strcmp(arg, "--trim-level")) {
+            if (!strcmp(value, "caches")) {
+                options.trimLevel = common::MEMORY_PRESSURE_CACHES;
+            } else if (!strcmp(value, "budgets")) {
+                options.trimLevel = common::MEMORY_PRESSURE_BUDGETS;
+            } else if (!strcmp(value, "hidden")) {
+                options.trimLevel = common::MEMORY_PRESSURE_HIDDEN;
+            } else if (!strcmp(value, "context")) {
+                options.trimLevel = common::MEMORY_PRESSURE_CONTEXT;
+            } else {
+                return false;
+            }
+        } else if (!strcmp(arg, "--texture-formats")) {
+            // a device with at most this family
+            if (!strcmp(value, "astc")) {
+                options.textureFormats = util::TEXTURE_ASTC | util::TEXTURE_ETC2 | util::TEXTURE_UNCOMPRESSED;
+            } else if (!strcmp(value, "etc2")) {
+                options.textureFormats = util::TEXTURE_ETC2 | util::TEXTURE_UNCOMPRESSED;
+            } else if (!strcmp(value, "none")) {
+                options.textureFormats = util::TEXTURE_UNCOMPRESSED;
+            } else {
+                return false;
+            }
+        } else if (!strcmp(arg, "--continuous")) {
+            options.continuous = !strcmp(value, "on");
+        } else if (!strcmp(arg, "--render-thread")) {
+            options.renderThread = !strcmp(value, "on");
+        } else if (!strcmp(arg, "--tap")) {
+            options.tap = true;
+            if (sscanf(value, "%f,%f", &options.tapX, &options.tapY) != 2) {
+                return false;
+            }
+        } else if (!strcmp(arg, "--occlusion")) {
+            if (!strcmp(value, "software")) {
+                options.occlusion = CubeRenderer::OcclusionSoftware;
+            } else if (!strcmp(value, "off")) {
+                options.occlusion = CubeRenderer::OcclusionNone;
+            } else if (!strcmp(value, "queries")) {
+                options.occlusion = CubeRenderer::OcclusionQueries;
+            } else {
+                return false;
+            }
+        } else {
+            return false;
+        }
+        ++i;
+    }
+    return options.frames > 0 && options.width > 0 && options.height > 0;
+}
+
+// write the last frame as a binary ppm, used for image regression checks
+static bool dumpFrame(const std::string &filename, int32_t width, int32_t height) {
+    std::vector<uint8_t> pixels(width * height * 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        ALOGE("Cannot open a file: %s!", filename.c_str());
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    // gl origin is bottom left
+    for (int32_t y = height - 1; y >= 0; --y) {
+        const uint8_t *row = pixels.data() + y * width * 4;
+        for (int32_t x = 0; x < width; ++x) {
+            fwrite(row + x * 4, 1, 3, file);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// peak resident set (VmHWM) and current anonymous memory in kB, anonymous
+// pages are what a heap copy costs, file backed pages can be reclaimed
+static void printMemory(const char *label) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long rssAnon = 0;
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        while (fgets(line, sizeof (line), status)) {
+            if (sscanf(line, "RssAnon: %ld", &rssAnon) == 1) {
+                break;
+            }
+        }
+        fclose(status);
+    }
+    printf("%s: peak rss %ld kB, anon rss %ld kB\n", label, usage.ru_maxrss, rssAnon);
+}
+
+static bool uploadAsset(const std::string &name, bool copy) {
+    util::GLStateCache *state = util::GLStateCache::Current();
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    state->bindBuffer(GL_ARRAY_BUFFER, buffer);
+    bool success = false;
+    if (copy) {
+        std::vector<uint8_t> data;
+        success = util::AssetHelper::Get()->AssetReadFile(name, data);
+        if (success) {
+            glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+            glFinish();
+            printMemory("upload (copy)");
+        }
+    } else {
+        util::AssetView view;
+        success = util::AssetHelper::Get()->AssetOpenView(name, view);
+        if (success) {
+            glBufferData(GL_ARRAY_BUFFER, view.size(), view.data(), GL_STATIC_DRAW);
+            glFinish();
+            printMemory("upload (view)");
+        }
+    }
+    state->bindBuffer(GL_ARRAY_BUFFER, 0);
+    state->deleteBuffers(1, &buffer);
+    return success;
+}
+
+// Frames drawn by the engine's render thread while this thread sends a tap
+// every few frames, the way the looper would, to measure input latency. On
+// demand the scene settles and the render thread sleeps, then a tap after a
+// quiet while is what draws the next frame.
+static int runRenderThread(common::Engine &engine, const HostOptions &options) {
+    common::GLContext *context = common::GLContext::Get();
+    engine.startRenderThread();
+    bool ready = false;
+    engine.runOnRenderThread([&]() {
+        engine.onInitDisplay(nullptr);
+        ready = context->getDisplay() && context->getSurface() != EGL_NO_SURFACE;
+    });
+    if (!ready) {
+        ALOGE("Unable to create an offscreen EGL surface!");
+        engine.stopRenderThread();
+        return 1;
+    }
+
+    common::InputEvent tap;
+    tap.Type = common::GESTURE_TAP;
+    tap.Pointer = options.tap ? glm::vec2(options.tapX, options.tapY) :
+                                glm::vec2(options.width * 0.5f, options.height * 0.5f);
+    const uint64_t tapInterval = 10;
+    const auto quiet = std::chrono::milliseconds(20);
+    uint64_t lastTap = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto lastTapTime = start;
+    engine.setFocus(true);
+    while (engine.frameCount() < (uint64_t)options.frames) {
+        uint64_t frame = engine.frameCount();
+        auto now = std::chrono::steady_clock::now();
+        if (frame >= lastTap + tapInterval || now - lastTapTime > quiet) {
+            tap.TimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        now.time_since_epoch()).count();
+            engine.postInput(tap);
+            lastTap = frame;
+            lastTapTime = now;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+        if (waited.count() > 60.0) {
+            ALOGE("Timed out waiting for frames!");
+            break;
+        }
+    }
+    engine.setFocus(false);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    uint64_t frames = engine.frameCount();
+
+    bool success = true;
+    engine.runOnRenderThread([&]() {
+        if (!options.dumpFile.empty()) {
+            success = dumpFrame(options.dumpFile, context->getScreenWidth(), context->getScreenHeight());
+        }
+        engine.unloadResources();
+    });
+    engine.stopRenderThread();
+
+    common::InputLatencyStats latency = engine.inputLatency();
+    common::RenderLoopStats loop = engine.renderLoopStats();
+    printf("render thread: %llu frames avg: %.3f ms, idle %.1f%% of %.3f ms (%s)\n",
+           (unsigned long long)frames, frames ? elapsed.count() / frames : 0.0,
+           loop.TotalMs > 0.0 ? 100.0 * loop.IdleMs / loop.TotalMs : 0.0, loop.TotalMs,
+           options.continuous ? "continuous" : "on demand");
+    printf("input to swap: %u events %u dropped, avg: %.3f ms max: %.3f ms\n", latency.Events,
+           latency.Dropped, latency.AvgMs, latency.MaxMs);
+    return success ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    HostOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // initialize engine
+    auto renderer = std::make_shared<CubeRenderer>();
+    renderer->setOcclusionMode(options.occlusion);
+    renderer->setInstanceCount(options.instances);
+    renderer->setInstancing(options.instancing);
+    renderer->setFramesInFlight(options.framesInFlight);
+    renderer->setContinuous(options.continuous);
+    common::Engine engine(renderer);
+    engine.setState(nullptr);
+    engine.getDynamicResolution()->setBudget(options.sceneBudgetMs);
+    util::AssetHelper::Get()->Init(options.assetDir);
+    util::ProgramBinaryCache::Get()->Init(options.cacheDir);
+
+    common::GLContext *context = common::GLContext::Get();
+    context->setSurfaceSize(options.width, options.height);
+    common::FramePacer *pacer = context->getFramePacer();
+    // a pbuffer refreshes at whatever rate it is paced to
+    pacer->setRefreshRate(options.targetFps);
+    pacer->setTargetRate(options.targetFps);
+    pacer->setMaxFramesInFlight(options.swapDepth);
+    if (options.renderThread) {
+        return runRenderThread(engine, options);
+    }
+    engine.onInitDisplay(nullptr);
+    if (!context->getDisplay() || context->getSurface() == EGL_NO_SURFACE) {
+        ALOGE("Unable to create an offscreen EGL surface!");
+        return 1;
+    }
+    printf("GL_RENDERER: %s\nGL_VERSION: %s\nsurface: %dx%d\n",
+           (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION),
+           context->getScreenWidth(), context->getScreenHeight());
+
+    if (!options.uploadAsset.empty()) {
+        printMemory("before upload");
+        if (!uploadAsset(options.uploadAsset, options.uploadCopy)) {
+            ALOGE("Cannot open a file: %s!", options.uploadAsset.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<util::TexturePtr> textures;
+    if (options.textureFormats) {
+        util::TextureManager::Get()->init(options.textureFormats);
+    }
+    util::TextureStreamer::Get()->setBudget(options.textureBudgetKb * 1024);
+    for (const std::string &name : options.textures) {
+        textures.push_back(util::TextureManager::Get()->load(name));
+    }
+
+    // draw until shaders and async loads are done, this is the startup cost
+    auto loadStart = std::chrono::steady_clock::now();
+    int32_t loadFrames = 0;
+    while (util::ShaderCompileQueue::Get()->pendingCount() ||
+           util::AsyncLoader::Get()->pendingCount()) {
+        engine.draw();
+        loadFrames++;
+        std::this_thread::yield();
+        std::chrono::duration<double> waited = std::chrono::steady_clock::now() - loadStart;
+        if (waited.count() > 30.0) {
+            ALOGE("Timed out waiting for resources to load!");
+            return 1;
+        }
+    }
+    std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - loadStart;
+    printf("resources ready after %d frames, %.3f ms\n", loadFrames, loadTime.count());
+    for (size_t i = 0; i < textures.size(); ++i) {
+        const util::Texture &texture = *textures[i];
+        if (!texture.isReady()) {
+            ALOGE("Unable to load the texture %s!", options.textures[i].c_str());
+            return 1;
+        }
+        printf("texture: %s %dx%d format 0x%x, %u levels from %u, %.1f kB (%.1f kB as RGBA8)\n",
+               texture.Asset.c_str(), texture.Width, texture.Height, texture.InternalFormat,
+               texture.Levels, texture.BaseLevel, texture.Bytes / 1024.0, texture.UncompressedBytes / 1024.0);
+    }
+
+    // driver loop, replaces the looper in android_main
+    pacer->resetStats();
+    std::vector<double> frameTimes;
+    frameTimes.reserve(options.frames);
+    double renderCpuMs = 0.0;
+    util::TextureStreamer *streamer = util::TextureStreamer::Get();
+    for (int32_t i = 0; i < options.frames; ++i) {
+        if (i == options.trimAt) {
+            if (options.trimLevel != common::MEMORY_PRESSURE_NONE) {
+                engine.trimMemory(options.trimLevel);
+            } else {
+                engine.trimMemory();
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        // what the renderer would report for the textures it draws
+        if (options.textureSize > 0.0f) {
+            for (auto &texture : textures) {
+                streamer->request(*texture, options.textureSize);
+            }
+        }
+        engine.draw();
+        std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+        frameTimes.push_back(elapsed.count());
+        renderCpuMs += renderer->cpuMs();
+    }
+
+    std::vector<double> sorted(frameTimes);
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (double t : frameTimes) {
+        total += t;
+    }
+    printf("frames: %d avg: %.3f ms min: %.3f ms p50: %.3f ms p99: %.3f ms max: %.3f ms\n",
+           options.frames, total / options.frames, sorted.front(),
+           sorted[sorted.size() / 2], sorted[(sorted.size() * 99) / 100], sorted.back());
+    const util::RenderQueueStats &queue = renderer->queueStats();
+    printf("render cpu avg: %.3f ms, %u draw calls\n", renderCpuMs / options.frames, queue.DrawCalls);
+    printf("render queue: %u packets, program/vao/texture changes sorted %u/%u/%u unsorted %u/%u/%u,"
+           " sort: %.3f ms\n", queue.Packets, queue.ProgramChanges, queue.VAOChanges, queue.TextureChanges,
+           queue.UnsortedProgramChanges, queue.UnsortedVAOChanges, queue.UnsortedTextureChanges, queue.SortMs);
+    const util::FrameRingStats &ring = renderer->ringStats();
+    printf("frame ring: %u frames in flight, %.1f of %.1f kB used, %u allocations %u failed,"
+           " %u grows, %u stalls %.3f ms\n", options.framesInFlight, ring.Used / 1024.0, ring.RegionSize / 1024.0,
+           ring.Allocations, ring.Failed, ring.Grows, ring.Stalls, ring.StallMs);
+    const common::FramePacingStats &pacing = pacer->stats();
+    printf("frame pacing: %.1f fps target, swap depth %u, interval avg: %.3f ms jitter: %.3f ms"
+           " max: %.3f ms, %u missed, %u gpu waits %.3f ms\n", options.targetFps > 0.0f ? pacer->targetRate() : 0.0f,
+           pacer->maxFramesInFlight(), pacing.AvgIntervalMs, pacing.JitterMs, pacing.MaxIntervalMs, pacing.Missed,
+           pacing.Waits, pacing.WaitMs);
+    common::DynamicResolution *resolution = engine.getDynamicResolution();
+    if (resolution->isActive()) {
+        const common::DynamicResolutionStats &scaling = resolution->stats();
+        printf("dynamic resolution: %dx%d, scale %.3f, scene gpu %.3f ms of %.3f ms, %u changes\n",
+               scaling.Width, scaling.Height, scaling.Scale, scaling.GpuMs, options.sceneBudgetMs,
+               scaling.Changes);
+    }
+    if (!textures.empty()) {
+        util::TextureStats textureStats = util::TextureManager::Get()->stats();
+        printf("textures: %u, %.1f kB (%.1f kB as RGBA8), %u fallbacks\n", textureStats.Textures,
+               textureStats.Bytes / 1024.0, textureStats.UncompressedBytes / 1024.0, textureStats.Fallbacks);
+    }
+    if (streamer->isEnabled()) {
+        util::TextureStreamingStats streaming = streamer->stats();
+        printf("texture streaming: %u textures %.1f of %.1f kB, %u levels missing, %u paged in %u evicted,"
+               " %.1f kB uploaded, %u direct\n", streaming.Textures, streaming.ResidentBytes / 1024.0,
+               streaming.Budget / 1024.0, streaming.MissingLevels, streaming.PageIns, streaming.Evictions,
+               streaming.UploadedBytes / 1024.0, streaming.DirectUploads);
+    }
+    util::GpuMemoryStats gpuMemory = engine.gpuMemory();
+    printf("gpu memory: %.1f kB, peak %.1f kB,", gpuMemory.Total / 1024.0, gpuMemory.Peak / 1024.0);
+    for (int i = 0; i < util::GPU_MEMORY_CATEGORIES; ++i) {
+        printf(" %s %.1f kB in %u%s", util::GpuMemory::CategoryName((util::GpuMemoryCategory)i),
+               gpuMemory.Bytes[i] / 1024.0, gpuMemory.Objects[i], i + 1 < util::GPU_MEMORY_CATEGORIES ? "," : "\n");
+    }
+    const util::GLStateStats &glState = context->getStateCache()->frameStats();
+    printf("gl state, last frame: %u calls issued, %u skipped\n", glState.Issued, glState.Skipped);
+
+    const util::ProgramBinaryStats &cacheStats = util::ProgramBinaryCache::Get()->getStats();
+    printf("program cache: %u hits %u misses %u invalid %u stores, compile: %.3f ms (latency %.3f ms)"
+           " load: %.3f ms parallel compile: %s\n",
+           cacheStats.hits, cacheStats.misses, cacheStats.invalid, cacheStats.stores,
+           cacheStats.compileMs, cacheStats.compileLatencyMs, cacheStats.loadMs,
+           util::ShaderCompileQueue::Get()->isParallel() ? "yes" : "no");
+
+    if (options.occlusion == CubeRenderer::OcclusionSoftware) {
+        const util::SoftwareOcclusionStats &occlusion = renderer->softwareOcclusionStats();
+        printf("software occlusion (last frame): %u occluders %u triangles, %u/%u culled,"
+               " raster: %.3f ms test: %.3f ms\n",
+               occlusion.Occluders, occlusion.Triangles, occlusion.Culled, occlusion.Occludees,
+               occlusion.RasterMs, occlusion.TestMs);
+    }
+
+    if (options.tap) {
+        uint32_t model = 0, triangle = 0;
+        auto start = std::chrono::steady_clock::now();
+        bool hit = renderer->pick(options.tapX, options.tapY, model, triangle);
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        if (hit) {
+            printf("tap %.0f,%.0f: model %u triangle %u, %.2f us\n", options.tapX, options.tapY,
+                   model, triangle, elapsed.count());
+        } else {
+            printf("tap %.0f,%.0f: nothing, %.2f us\n", options.tapX, options.tapY, elapsed.count());
+        }
+    }
+
+    bool success = true;
+    if (!options.dumpFile.empty()) {
+        success = dumpFrame(options.dumpFile, context->getScreenWidth(),
+                            context->getScreenHeight());
+    }
+
+    textures.clear();
+    engine.unloadResources();
+    engine.terminate();
+    return success ? 0 : 1;
+}
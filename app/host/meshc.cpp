@@ -0,0 +1,395 @@
+// Offline converter from Wavefront OBJ to the runtime .qmesh format,
+// also reports memory and load time against the float32 layout.
+#include "MeshFormat.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedMs(const Clock::time_point &start) {
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    return elapsed.count();
+}
+
+// "v/vt/vn", "v//vn", "v/vt" or "v", 1-based or negative (relative)
+static bool parseFaceVertex(const char *token, int counts[3], int out[3]) {
+    out[0] = out[1] = out[2] = -1;
+    const char *p = token;
+    for (int i = 0; i < 3 && *p; ++i) {
+        if (*p != '/') {
+            int value = atoi(p);
+            if (value == 0) {
+                return false;
+            }
+            out[i] = value > 0 ? value - 1 : counts[i] + value;
+            if (out[i] < 0 || out[i] >= counts[i]) {
+                return false;
+            }
+        }
+        while (*p && *p != '/') {
+            ++p;
+        }
+        if (*p == '/') {
+            ++p;
+        }
+    }
+    return out[0] >= 0;
+}
+
+static bool loadObj(const char *filename, util::MeshData &mesh) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open a file: %s!\n", filename);
+        return false;
+    }
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> uvs;
+    std::map<std::tuple<int, int, int>, uint32_t> welded;
+    bool hasNormals = true, hasUVs = true;
+
+    char line[1024];
+    while (fgets(line, sizeof (line), file)) {
+        float x = 0, y = 0, z = 0;
+        if (!strncmp(line, "v ", 2) && sscanf(line + 2, "%f %f %f", &x, &y, &z) == 3) {
+            positions.push_back(glm::vec3(x, y, z));
+        } else if (!strncmp(line, "vn ", 3) && sscanf(line + 3, "%f %f %f", &x, &y, &z) == 3) {
+            normals.push_back(glm::vec3(x, y, z));
+        } else if (!strncmp(line, "vt ", 3) && sscanf(line + 3, "%f %f", &x, &y) == 2) {
+            uvs.push_back(glm::vec2(x, y));
+        } else if (!strncmp(line, "f ", 2)) {
+            int counts[3] = { (int)positions.size(), (int)uvs.size(), (int)normals.size() };
+            std::vector<uint32_t> face;
+            for (char *token = strtok(line + 2, " \t\r\n"); token; token = strtok(nullptr, " \t\r\n")) {
+                int ids[3];
+                if (!parseFaceVertex(token, counts, ids)) {
+                    fprintf(stderr, "Invalid face: %s\n", token);
+                    fclose(file);
+                    return false;
+                }
+                hasUVs = hasUVs && ids[1] >= 0;
+                hasNormals = hasNormals && ids[2] >= 0;
+                auto key = std::make_tuple(ids[0], ids[1], ids[2]);
+                auto it = welded.find(key);
+                if (it == welded.end()) {
+                    it = welded.insert(std::make_pair(key, (uint32_t)mesh.Positions.size())).first;
+                    mesh.Positions.push_back(positions[ids[0]]);
+                    mesh.UVs.push_back(ids[1] >= 0 ? uvs[ids[1]] : glm::vec2(0.0f));
+                    mesh.Normals.push_back(ids[2] >= 0 ? normals[ids[2]] : glm::vec3(0.0f));
+                }
+                face.push_back(it->second);
+            }
+            // fan triangulation
+            for (size_t i = 2; i < face.size(); ++i) {
+                mesh.Indices.push_back(face[0]);
+                mesh.Indices.push_back(face[i - 1]);
+                mesh.Indices.push_back(face[i]);
+            }
+        }
+    }
+    fclose(file);
+    if (!hasNormals) {
+        mesh.Normals.clear();
+    }
+    if (!hasUVs) {
+        mesh.UVs.clear();
+    }
+    return !mesh.Indices.empty();
+}
+
+// uv sphere with normals and uvs, for measurements without an input file
+static void makeSphere(int segments, util::MeshData &mesh) {
+    int rings = segments / 2;
+    for (int r = 0; r <= rings; ++r) {
+        float theta = 3.14159265f * r / rings;
+        for (int s = 0; s <= segments; ++s) {
+            float phi = 2.0f * 3.14159265f * s / segments;
+            glm::vec3 n(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            mesh.Positions.push_back(n);
+            mesh.Normals.push_back(n);
+            mesh.UVs.push_back(glm::vec2((float)s / segments, (float)r / rings));
+        }
+    }
+    for (int r = 0; r < rings; ++r) {
+        for (int s = 0; s < segments; ++s) {
+            uint32_t a = r * (segments + 1) + s, b = a + segments + 1;
+            uint32_t quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+            mesh.Indices.insert(mesh.Indices.end(), quad, quad + 6);
+        }
+    }
+}
+
+// triangle and vertex order of a badly exported mesh
+static void shuffleMesh(util::MeshData &mesh) {
+    std::mt19937 random(1);
+    size_t triCount = mesh.Indices.size() / 3;
+    std::vector<uint32_t> order(triCount);
+    for (size_t t = 0; t < triCount; ++t) {
+        order[t] = t;
+    }
+    std::shuffle(order.begin(), order.end(), random);
+    std::vector<uint32_t> indices;
+    indices.reserve(mesh.Indices.size());
+    for (auto t : order) {
+        indices.insert(indices.end(), mesh.Indices.begin() + t * 3, mesh.Indices.begin() + t * 3 + 3);
+    }
+    mesh.Indices.swap(indices);
+
+    std::vector<uint32_t> remap(mesh.Positions.size());
+    for (size_t v = 0; v < remap.size(); ++v) {
+        remap[v] = v;
+    }
+    std::shuffle(remap.begin(), remap.end(), random);
+    util::MeshData shuffled = mesh;
+    for (size_t v = 0; v < remap.size(); ++v) {
+        shuffled.Positions[remap[v]] = mesh.Positions[v];
+        if (!mesh.Normals.empty()) {
+            shuffled.Normals[remap[v]] = mesh.Normals[v];
+        }
+        if (!mesh.UVs.empty()) {
+            shuffled.UVs[remap[v]] = mesh.UVs[v];
+        }
+    }
+    for (auto &index : shuffled.Indices) {
+        index = remap[index];
+    }
+    mesh = shuffled;
+}
+
+static void printCacheStats(const char *label, const util::MeshData &mesh) {
+    util::VertexCacheStats stats = util::AnalyzeVertexCache(mesh.Indices, mesh.Positions.size());
+    printf("%s: vertices %zu triangles %u ACMR %.3f ATVR %.3f\n", label, mesh.Positions.size(),
+           stats.TriangleCount, stats.ACMR, stats.ATVR);
+}
+
+static const uint32_t MAX_LODS = 6;
+
+static void printLods(const util::MeshData &mesh) {
+    for (size_t i = 0; i < mesh.Lods.size(); ++i) {
+        printf("lod %zu: triangles %u error %g\n", i, mesh.Lods[i].IndexCount / 3, mesh.Lods[i].Error);
+    }
+}
+
+// 1000 copies spread between 2 and 200 radii from a 1080p, 45 degree camera,
+// triangles drawn with LOD 0 everywhere against the 1 pixel error selection
+static void printLodScene(const util::MeshData &mesh) {
+    glm::vec3 boundsMin = mesh.Positions[0], boundsMax = mesh.Positions[0];
+    for (auto &p : mesh.Positions) {
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+    float radius = 0.5f * glm::length(boundsMax - boundsMin);
+    float projScale = 1080.0f / (2.0f * tanf(22.5f * 3.14159265f / 180.0f));
+
+    util::ModelDrawable model;
+    model.Lods = mesh.Lods;
+    uint64_t full = 0, selected = 0;
+    for (int i = 0; i < 1000; ++i) {
+        float distance = radius * (2.0f + 198.0f * i / 999.0f);
+        model.selectLod(projScale / distance);
+        full += mesh.Lods[0].IndexCount / 3;
+        selected += mesh.Lods[model.Lod].IndexCount / 3;
+    }
+    printf("  scene of 1000: %llu -> %llu triangles (%.1fx fewer)\n", (unsigned long long)full,
+           (unsigned long long)selected, (double)full / selected);
+}
+
+// ACMR/ATVR before and after on a set of large meshes, and the time of the
+// whole set on one thread against all cores
+static int runBenchmark(int count, char **files) {
+    std::vector<util::MeshData> sources;
+    std::vector<std::string> names;
+    for (int i = 0; i < count; ++i) {
+        sources.push_back(util::MeshData());
+        if (!loadObj(files[i], sources.back())) {
+            return 1;
+        }
+        names.push_back(files[i]);
+    }
+    if (sources.empty()) {
+        int segments[] = { 256, 512, 1024 };
+        for (auto n : segments) {
+            sources.push_back(util::MeshData());
+            makeSphere(n, sources.back());
+            names.push_back("sphere " + std::to_string(n));
+            sources.push_back(sources.back());
+            shuffleMesh(sources.back());
+            names.push_back("sphere " + std::to_string(n) + " shuffled");
+        }
+    }
+
+    std::vector<util::MeshData> meshes;
+    std::vector<util::MeshData *> pointers;
+    double elapsed[2] = {};
+    unsigned int threads[2] = { 1, std::max(1u, std::thread::hardware_concurrency()) };
+    for (int run = 0; run < 2; ++run) {
+        meshes = sources;
+        pointers.clear();
+        for (auto &mesh : meshes) {
+            pointers.push_back(&mesh);
+        }
+        auto start = Clock::now();
+        util::OptimizeMeshes(pointers, 1, threads[run]);
+        elapsed[run] = elapsedMs(start);
+    }
+
+    for (size_t i = 0; i < sources.size(); ++i) {
+        util::VertexCacheStats before = util::AnalyzeVertexCache(sources[i].Indices,
+                sources[i].Positions.size());
+        util::VertexCacheStats after = util::AnalyzeVertexCache(meshes[i].Indices,
+                meshes[i].Positions.size());
+        printf("%-22s triangles %8u ACMR %.3f -> %.3f ATVR %.3f -> %.3f\n", names[i].c_str(),
+               before.TriangleCount, before.ACMR, after.ACMR, before.ATVR, after.ATVR);
+    }
+    printf("optimize %zu meshes: 1 thread %.1f ms, %u threads %.1f ms\n", sources.size(),
+           elapsed[0], threads[1], elapsed[1]);
+
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        auto start = Clock::now();
+        util::BuildLodChain(meshes[i], MAX_LODS);
+        printf("%-22s lod chain %.1f ms:", names[i].c_str(), elapsedMs(start));
+        for (auto &lod : meshes[i].Lods) {
+            printf(" %u (%.2g)", lod.IndexCount / 3, lod.Error);
+        }
+        printf("\n");
+        printLodScene(meshes[i]);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    bool optimize = true, shuffle = false;
+    int sphere = 0;
+    uint32_t lods = MAX_LODS;
+    int arg = 1;
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); ++arg) {
+        if (!strcmp(argv[arg], "--bench")) {
+            return runBenchmark(argc - arg - 1, argv + arg + 1);
+        } else if (!strcmp(argv[arg], "--no-optimize")) {
+            optimize = false;
+        } else if (!strcmp(argv[arg], "--lods") && arg + 1 < argc) {
+            lods = std::max(1, atoi(argv[++arg]));
+        } else if (!strcmp(argv[arg], "--shuffle")) {
+            shuffle = true;
+        } else if (!strcmp(argv[arg], "--sphere") && arg + 1 < argc) {
+            sphere = std::max(4, atoi(argv[++arg]));
+        } else {
+            break;
+        }
+    }
+    if (argc - arg != (sphere ? 1 : 2)) {
+        printf("usage: %s [--no-optimize] [--lods n] [--shuffle] input.obj output.qmesh\n"
+               "       %s [--no-optimize] [--lods n] [--shuffle] --sphere segments output.qmesh\n"
+               "       %s --bench [input.obj...]\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    util::MeshData mesh;
+    const char *output = argv[argc - 1];
+    if (sphere) {
+        makeSphere(sphere, mesh);
+    } else if (!loadObj(argv[arg], mesh)) {
+        return 1;
+    }
+    if (shuffle) {
+        shuffleMesh(mesh);
+    }
+    if (optimize) {
+        printCacheStats("source", mesh);
+        auto start = Clock::now();
+        util::OptimizeMesh(mesh, lods);
+        printf("optimize: %.3f ms\n", elapsedMs(start));
+        util::MeshData lod0 = mesh;
+        lod0.Indices.resize(mesh.Lods.empty() ? mesh.Indices.size() : mesh.Lods[0].IndexCount);
+        printCacheStats("optimized", lod0);
+        printLods(mesh);
+    }
+
+    auto start = Clock::now();
+    std::vector<uint8_t> blob;
+    if (!util::EncodePackedMesh(mesh, blob)) {
+        fprintf(stderr, "Unable to encode mesh!\n");
+        return 1;
+    }
+    double encodeMs = elapsedMs(start);
+
+    FILE *file = fopen(output, "wb");
+    if (!file || fwrite(blob.data(), 1, blob.size(), file) != blob.size()) {
+        fprintf(stderr, "Cannot write a file: %s!\n", output);
+        if (file) {
+            fclose(file);
+        }
+        return 1;
+    }
+    fclose(file);
+
+    // float32 reference: vec4 position (as CubeRenderer used), vec3 normal,
+    // vec2 uv, 32 bit indices, interleaved into one upload buffer
+    size_t vertexCount = mesh.Positions.size();
+    size_t floatStride = sizeof (glm::vec4) + (mesh.Normals.empty() ? 0 : sizeof (glm::vec3)) +
+            (mesh.UVs.empty() ? 0 : sizeof (glm::vec2));
+    size_t floatBytes = vertexCount * floatStride + mesh.Indices.size() * sizeof (uint32_t);
+
+    start = Clock::now();
+    std::vector<uint8_t> interleaved(vertexCount * floatStride);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        uint8_t *vertex = interleaved.data() + i * floatStride;
+        glm::vec4 position(mesh.Positions[i], 1.0f);
+        memcpy(vertex, &position, sizeof (position));
+        vertex += sizeof (position);
+        if (!mesh.Normals.empty()) {
+            memcpy(vertex, &mesh.Normals[i], sizeof (glm::vec3));
+            vertex += sizeof (glm::vec3);
+        }
+        if (!mesh.UVs.empty()) {
+            memcpy(vertex, &mesh.UVs[i], sizeof (glm::vec2));
+        }
+    }
+    double floatLoadMs = elapsedMs(start);
+
+    // runtime load of the packed format is a header check, the blob is uploaded as is
+    start = Clock::now();
+    util::PackedMeshView view;
+    if (!util::ParsePackedMesh(blob.data(), blob.size(), view)) {
+        fprintf(stderr, "Unable to parse the encoded mesh!\n");
+        return 1;
+    }
+    double packedLoadMs = elapsedMs(start);
+    size_t packedBytes = view.vertexBytes() + view.indexBytes();
+
+    start = Clock::now();
+    std::vector<glm::vec3> positions(vertexCount), normals(vertexCount);
+    util::DecodePositions(view, positions.data());
+    util::DecodeNormals(view, normals.data());
+    double decodeMs = elapsedMs(start);
+
+    float maxPositionError = 0.0f, maxNormalError = 0.0f;
+    for (size_t i = 0; i < vertexCount; ++i) {
+        maxPositionError = std::max(maxPositionError, glm::length(positions[i] - mesh.Positions[i]));
+        if (!mesh.Normals.empty() && glm::length(mesh.Normals[i]) > 0.0f) {
+            float d = glm::dot(normals[i], glm::normalize(mesh.Normals[i]));
+            maxNormalError = std::max(maxNormalError, acosf(std::min(1.0f, d)) * 57.29578f);
+        }
+    }
+
+    printf("vertices: %zu triangles: %u lods: %u stride: %u bytes index: %s\n", vertexCount,
+           view.Lods[0].indexCount / 3, view.Header->lodCount, view.Header->stride,
+           view.indexType() == GL_UNSIGNED_SHORT ? "u16" : "u32");
+    printf("gpu memory: float32 %zu bytes, packed %zu bytes (%.2fx smaller)\n",
+           floatBytes, packedBytes, (double)floatBytes / packedBytes);
+    printf("load: float32 interleave %.3f ms, packed parse %.3f ms\n", floatLoadMs, packedLoadMs);
+    printf("encode: %.3f ms, cpu decode (positions+normals): %.3f ms\n", encodeMs, decodeMs);
+    printf("max error: position %g, normal %.3f deg\n", maxPositionError, maxNormalError);
+    return 0;
+}
@@ -0,0 +1,13 @@
+#version 300 es
+layout(location = 0) in vec4 inPos;
+// rows of the model matrix, dequantization included
+layout(location = 3) in vec4 inModel0;
+layout(location = 4) in vec4 inModel1;
+layout(location = 5) in vec4 inModel2;
+layout(std140) uniform Camera {
+    mat4 viewProjection;
+};
+void main() {
+    vec4 world = vec4(dot(inModel0, inPos), dot(inModel1, inPos), dot(inModel2, inPos), 1.0);
+    gl_Position = viewProjection * world;
+}
\ No newline at end of file
@@ -1,7 +1,10 @@
 #version 300 es
 layout(location = 0) in vec4 inPos;
 out vec4 fColor;
-uniform mat4 mvp;
+// per object range of the frame ring
+layout(std140) uniform Object {
+    mat4 mvp;
+};
 void main() {
     gl_Position = mvp * inPos;
 }
\ No newline at end of file
@@ -1,9 +1,17 @@
 #include "CubeRenderer.h"
 
+#include <algorithm>
+#include <chrono>
+#include <math.h>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "LogUtil.h"
 #include "SensorManager.h"
+#include "ShaderCompileQueue.h"
+#include "AsyncLoader.h"
+#include "GLStateCache.h"
+#include "MeshFormat.h"
+#include "MeshOptimizer.h"
 
 static glm::vec4 Vertices[] = {
     // front
@@ -39,8 +47,18 @@ static GLuint Indices[] = {
     6, 7, 3,
 };
 
+// screen space error of the LODs drawn, in pixels, and what memory
+// pressure raises it to
+static const float LOD_THRESHOLD = 1.0f;
+static const float TRIMMED_LOD_THRESHOLD = 4.0f;
+
 CubeRenderer::CubeRenderer() :
-    m_camera(glm::mat4(1.0f)) {
+    m_camera(glm::mat4(1.0f)), m_eye(0.0f), m_projScale(1.0f), m_lodThreshold(LOD_THRESHOLD),
+    m_sceneChanged(false), m_occlusionMode(OcclusionNone), m_settleFrames(0), m_continuous(false),
+    m_framesInFlight(3), m_far(100.0f),
+    m_instancing(true), m_instanceCount(0), m_cpuMs(0.0), m_objectBlock(false), m_cameraBlock(false) {
+    m_viewport[0] = m_viewport[1] = 0;
+    m_viewport[2] = m_viewport[3] = 1;
 }
 
 CubeRenderer::~CubeRenderer() {
@@ -48,29 +66,280 @@ CubeRenderer::~CubeRenderer() {
 }
 
 void CubeRenderer::render() {
-#ifdef __ANDROID__
+    auto start = std::chrono::steady_clock::now();
     common::AcceleratorState state = m_sensorManager->getState();
+    bool ready = m_program->isReady();
+    // before any GL call, software occlusion runs while the GPU finishes the last frame
+    if (ready) {
+        cullModels();
+    }
     glClearColor(state.X / 10.0, state.Y / 10.0, state.Z / 10.0, 1.0f);
-#endif
     glClear (GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
-    m_program->bind();
-    m_program->setMat4("mvp", m_camera);
-    for (auto model : m_models) {
-        glBindVertexArray(model->VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, nullptr);
+    // still compiling, only show the clear color
+    if (!ready) {
+        return;
+    }
+    if (!m_objectBlock) {
+        m_objectBlock = m_program->bindUniformBlock("Object", util::RenderQueue::OBJECT_BINDING);
+    }
+
+    // per object data goes through the frame ring, sized for a uniform range per model,
+    // more than the instance rows of a model take
+    const GLsizeiptr alignment = m_ring.uniformAlignment();
+    const GLsizeiptr objectSize = (sizeof (glm::mat4) + alignment - 1) / alignment * alignment;
+    m_ring.beginFrame((m_occluders.size() + m_occludees.size() + 1) * objectSize);
+
+    // occluders go in the first pass, the occludees and their proxies are tested against them
+    m_queue.clear();
+    if (m_instancing && m_instancedProgram->isReady()) {
+        if (!m_cameraBlock) {
+            m_cameraBlock = m_instancedProgram->bindUniformBlock("Camera", CAMERA_BINDING);
+        }
+        util::RingAllocation camera = m_ring.allocateUniform(sizeof (glm::mat4));
+        if (camera.Data) {
+            *(glm::mat4 *)camera.Data = m_camera;
+            m_ring.bindUniform(CAMERA_BINDING, camera);
+        }
+        queueInstanced();
+    } else {
+        for (auto model : m_occluders) {
+            queueModel(*model, PassOccluders);
+        }
+        for (auto model : m_occludees) {
+            if (!model->isCulled) {
+                queueModel(*model, PassScene);
+            }
+        }
+    }
+    // unmapped before any draw reads it
+    m_ring.flush();
+    m_queue.sort();
+    // the proxies are tested against the occluders only, not against the
+    // occludees they stand for
+    m_queue.execute(PassOccluders);
+    if (m_occlusionMode == OcclusionQueries) {
+        m_occlusion.query(m_camera, m_eye, m_occluders, m_occludees);
     }
+    m_queue.execute(PassScene);
+    if (m_settleFrames) {
+        m_settleFrames--;
+        requestFrame();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    m_cpuMs = elapsed.count();
+    // not timed, drivers may flush on glFenceSync and start executing the frame
+    m_ring.endFrame();
 }
 
-GLint CubeRenderer::getTextureType() {
-    return 0;
+void CubeRenderer::cullModels() {
+    if (m_sceneChanged) {
+        m_settleFrames = SETTLE_FRAMES;
+        std::vector<glm::vec3> centers, extents;
+        for (auto &model : m_models) {
+            centers.push_back(model->WorldCenter);
+            extents.push_back(model->WorldExtent);
+        }
+        m_sceneBvh.build(centers, extents);
+        m_sceneChanged = false;
+    }
+    m_culler.cull(m_camera, m_visible);
+    m_occluders.clear();
+    m_occludees.clear();
+    for (auto id : m_visible) {
+        if (m_models[id]->occludingAttrib == util::ModelDrawable::OCCLUDER) {
+            m_occluders.push_back(m_models[id].get());
+        } else {
+            m_occludees.push_back(m_models[id].get());
+        }
+    }
+
+    switch (m_occlusionMode) {
+    case OcclusionQueries:
+        m_occlusion.update(m_occluders, m_occludees);
+        if (m_occlusion.stats().Changed) {
+            m_settleFrames = SETTLE_FRAMES;
+        }
+        break;
+    case OcclusionSoftware:
+        m_softwareOcclusion.cull(m_camera, m_occluders, m_occludees);
+        break;
+    default:
+        for (auto model : m_occludees) {
+            model->isCulled = false;
+        }
+        break;
+    }
 }
 
-void CubeRenderer::unload() {
-    for (auto model : m_models) {
-        model.reset();
+float CubeRenderer::selectLod(util::ModelDrawable &model) {
+    // distance to the bounding sphere, LOD errors are in object space
+    float center = glm::length(model.WorldCenter - m_eye);
+    float distance = center - model.Radius * model.Scale;
+    model.selectLod(m_projScale * model.Scale / std::max(distance, 0.001f), m_lodThreshold);
+    return center;
+}
+
+void CubeRenderer::trimMemory(common::MemoryPressure level) {
+    // set, not scaled, repeated warnings must not compound
+    float threshold = m_lodThreshold;
+    if (level == common::MEMORY_PRESSURE_NONE) {
+        threshold = LOD_THRESHOLD;
+    } else if (level == common::MEMORY_PRESSURE_BUDGETS) {
+        threshold = TRIMMED_LOD_THRESHOLD;
+    }
+    if (threshold != m_lodThreshold) {
+        m_lodThreshold = threshold;
+        ALOGV("LOD threshold set to %.1f px", m_lodThreshold);
+        requestFrame();
+    }
+}
+
+void CubeRenderer::queueModel(util::ModelDrawable &model, uint32_t pass) {
+    float depth = selectLod(model) / m_far;
+    const util::MeshLod &lod = model.Lods[model.Lod];
+    util::RingAllocation object = m_ring.allocateUniform(sizeof (glm::mat4));
+    if (!object.Data) {
+        return;
+    }
+    *(glm::mat4 *)object.Data = m_camera * model.World;
+
+    util::DrawPacket packet;
+    packet.Program = m_program->programID();
+    packet.VAO = model.VAO;
+    packet.IndexType = model.IndexType;
+    packet.IndexCount = lod.IndexCount;
+    packet.IndexOffset = lod.IndexOffset * model.indexSize();
+    packet.UniformBuffer = object.Buffer;
+    packet.UniformOffset = object.Offset;
+    packet.UniformSize = object.Size;
+    m_queue.submit(util::RenderQueue::MakeKey(pass, false, packet.Program, 0, packet.VAO, depth), packet);
+}
+
+void CubeRenderer::queueInstanced() {
+    m_batches.clear();
+    m_batchIds.clear();
+    m_modelBatches.clear();
+    uint64_t lastKey = ~0ull;
+    uint32_t lastBatch = 0;
+    for (uint32_t pass = PassOccluders; pass <= PassScene; ++pass) {
+        for (auto model : pass == PassOccluders ? m_occluders : m_occludees) {
+            if (pass != PassOccluders && model->isCulled) {
+                continue;
+            }
+            float depth = selectLod(*model) / m_far;
+            uint64_t key = (uint64_t)pass << 63 | (uint64_t)model->VAO << 32 | model->Lod;
+            // neighbours tend to share a batch, skip the hash lookup for them
+            if (key != lastKey) {
+                auto it = m_batchIds.find(key);
+                if (it == m_batchIds.end()) {
+                    const util::MeshLod &lod = model->Lods[model->Lod];
+                    InstanceBatch batch = { model->VAO, model->IndexType, (GLsizei)lod.IndexCount,
+                                            (GLsizeiptr)(lod.IndexOffset * model->indexSize()), 0, 0,
+                                            pass, depth };
+                    it = m_batchIds.insert(std::make_pair(key, (uint32_t)m_batches.size())).first;
+                    m_batches.push_back(batch);
+                }
+                lastKey = key;
+                lastBatch = it->second;
+            }
+            InstanceBatch &batch = m_batches[lastBatch];
+            batch.Count++;
+            batch.Depth = std::min(batch.Depth, depth);
+            m_modelBatches.push_back(lastBatch);
+        }
+    }
+    if (m_modelBatches.empty()) {
+        return;
+    }
+
+    // instances of a batch are contiguous, First is the write cursor first
+    uint32_t first = 0;
+    for (auto &batch : m_batches) {
+        batch.First = first;
+        first += batch.Count;
     }
+    const GLsizeiptr stride = util::RenderQueue::INSTANCE_ROWS * sizeof (glm::vec4);
+    util::RingAllocation instances = m_ring.allocate(m_modelBatches.size() * stride);
+    if (!instances.Data) {
+        return;
+    }
+    // write only memory, every row is stored once and never read back
+    glm::vec4 *data = (glm::vec4 *)instances.Data;
+    uint32_t index = 0;
+    for (uint32_t pass = PassOccluders; pass <= PassScene; ++pass) {
+        for (auto model : pass == PassOccluders ? m_occluders : m_occludees) {
+            if (pass != PassOccluders && model->isCulled) {
+                continue;
+            }
+            const glm::mat4 &m = model->World;
+            glm::vec4 *rows = &data[m_batches[m_modelBatches[index++]].First++ *
+                                    util::RenderQueue::INSTANCE_ROWS];
+            for (int r = 0; r < 3; ++r) {
+                rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+            }
+        }
+    }
+    for (auto &batch : m_batches) {
+        util::DrawPacket packet;
+        packet.Program = m_instancedProgram->programID();
+        packet.VAO = batch.VAO;
+        packet.IndexType = batch.IndexType;
+        packet.IndexCount = batch.IndexCount;
+        packet.IndexOffset = batch.IndexOffset;
+        packet.InstanceCount = batch.Count;
+        packet.InstanceBuffer = instances.Buffer;
+        // the cursor stopped at the start of the next batch
+        packet.InstanceOffset = instances.Offset + (batch.First - batch.Count) * stride;
+        m_queue.submit(util::RenderQueue::MakeKey(batch.Pass, false, packet.Program, 0, packet.VAO, batch.Depth),
+                       packet);
+    }
+}
+
+void CubeRenderer::onTap(float x, float y) {
+    uint32_t model, triangle;
+    if (pick(x, y, model, triangle)) {
+        ALOGV("Picked model %u, triangle %u", model, triangle);
+    }
+}
+
+bool CubeRenderer::pick(float x, float y, uint32_t &model, uint32_t &triangle) {
+    // segment from the near to the far plane through the pixel
+    glm::vec2 ndc(2.0f * (x - m_viewport[0]) / m_viewport[2] - 1.0f,
+                  1.0f - 2.0f * (y - m_viewport[1]) / m_viewport[3]);
+    glm::mat4 inverse = glm::inverse(m_camera);
+    glm::vec4 near = inverse * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    glm::vec4 far = inverse * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(near) / near.w;
+    glm::vec3 direction = glm::vec3(far) / far.w - origin;
+
+    // t is the same along the segment in object space
+    float t = 1.0f;
+    model = m_sceneBvh.intersect(origin, direction, t, [&](uint32_t id, float &tMax) {
+        const util::ModelDrawable &drawable = *m_models[id];
+        if (!drawable.PickBvh) {
+            return false;
+        }
+        glm::mat4 toObject = glm::inverse(drawable.Transform);
+        uint32_t hit;
+        if (drawable.PickBvh->intersect(glm::vec3(toObject * glm::vec4(origin, 1.0f)),
+                                        glm::vec3(toObject * glm::vec4(direction, 0.0f)), tMax, hit)) {
+            triangle = hit;
+            return true;
+        }
+        return false;
+    });
+    return model != ~0u;
+}
+
+void CubeRenderer::unload() {
+    m_models.clear();
+    m_culler.clear();
+    m_sceneBvh.clear();
+    m_occlusion.release();
+    m_ring.release();
     m_program.reset();
+    m_instancedProgram.reset();
 }
 
 void CubeRenderer::setup() {
@@ -78,40 +347,98 @@ void CubeRenderer::setup() {
     m_program = std::make_shared<util::OpenGLShaderProgram>();
     m_program->addShaderFromSourceFile(util::OpenGLShader::Vertex, "Shaders/shader.vs");
     m_program->addShaderFromSourceFile(util::OpenGLShader::Fragment, "Shaders/shader.fs");
-    m_program->link();
+    util::ShaderCompileQueue::Get()->enqueue(m_program);
+    m_objectBlock = false;
+    m_instancedProgram = std::make_shared<util::OpenGLShaderProgram>();
+    m_instancedProgram->addShaderFromSourceFile(util::OpenGLShader::Vertex, "Shaders/instanced.vs");
+    m_instancedProgram->addShaderFromSourceFile(util::OpenGLShader::Fragment, "Shaders/shader.fs");
+    util::ShaderCompileQueue::Get()->enqueue(m_instancedProgram);
+    m_cameraBlock = false;
+    // grows with the scene in beginFrame()
+    m_ring.init(64 * 1024, m_framesInFlight);
+    m_occlusion.init();
 
-    // model
-    auto model = std::make_shared<util::ModelDrawable>();
-    m_models.push_back(model);
-    // VAO
-    glGenVertexArrays(1, &model->VAO);
-    glBindVertexArray(model->VAO);
-    // VBO
-    glGenBuffers(1, &model->VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, model->VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof (Vertices), Vertices, GL_STATIC_DRAW);
-    // IBO
-    glGenBuffers(1, &model->IBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->IBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof (Indices), Indices, GL_STATIC_DRAW);
-    // attrib
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof (glm::vec4), nullptr);
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    // model, encoded on a loader thread and uploaded from Engine::draw()
+    util::AsyncLoader::Get()->submit([this]() -> util::AsyncLoader::UploadTask {
+        // a real model would be read from a .qmesh asset instead
+        util::MeshData mesh;
+        for (auto &v : Vertices) {
+            mesh.Positions.push_back(glm::vec3(v));
+        }
+        mesh.Indices.assign(std::begin(Indices), std::end(Indices));
+        util::OptimizeMesh(mesh, 4);
+        auto blob = std::make_shared<std::vector<uint8_t> >();
+        if (!util::EncodePackedMesh(mesh, *blob)) {
+            return util::AsyncLoader::UploadTask();
+        }
+        auto pickBvh = std::make_shared<util::TriangleBvh>();
+        const util::MeshLod &lod = mesh.Lods.front();
+        pickBvh->build(mesh.Positions, std::vector<uint32_t>(mesh.Indices.begin() + lod.IndexOffset,
+                mesh.Indices.begin() + lod.IndexOffset + lod.IndexCount));
+        return [this, blob, pickBvh]() {
+            uploadModel(*blob, pickBvh);
+        };
+    });
 
     // simple camera, will replace with tap camera
-    int32_t viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    glm::mat4 projection = glm::perspective(45.0f, float(1440)/float(2960), 0.1f, 100.0f);
-    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 5.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glGetIntegerv(GL_VIEWPORT, m_viewport);
+    glm::mat4 projection = glm::perspective(45.0f, float(1440)/float(2960), 0.1f, m_far);
+    m_eye = glm::vec3(0.0f, 5.0f, 5.0f);
+    glm::mat4 view = glm::lookAt(m_eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     m_camera = projection * view;
+    m_projScale = 0.5f * m_viewport[3] * projection[1][1];
+}
+
+void CubeRenderer::uploadModel(const std::vector<uint8_t> &blob,
+        const std::shared_ptr<util::TriangleBvh> &pickBvh) {
+    util::PackedMeshView view;
+    auto model = std::make_shared<util::ModelDrawable>();
+    if (!util::ParsePackedMesh(blob.data(), blob.size(), view) ||
+            !util::UploadPackedMesh(view, *model)) {
+        return;
+    }
+    // per instance rows of the model matrix, enabled and pointed at the
+    // batch only while RenderQueue draws it instanced
+    util::GLStateCache *state = util::GLStateCache::Current();
+    state->bindVertexArray(model->VAO);
+    for (GLuint r = 0; r < util::RenderQueue::INSTANCE_ROWS; ++r) {
+        glVertexAttribDivisor(util::RenderQueue::INSTANCE_ATTRIBUTE + r, 1);
+    }
+    state->bindVertexArray(0);
+    model->PickBvh = pickBvh;
+
+    if (m_instanceCount > 1) {
+        // side^3 cells filling the bounds of the single model
+        uint32_t side = (uint32_t)ceilf(cbrtf((float)m_instanceCount));
+        float spacing = 2.0f * glm::length(model->Extent) / side;
+        float size = 0.4f * spacing / glm::length(model->Extent);
+        for (uint32_t i = 0; i < m_instanceCount; ++i) {
+            glm::vec3 cell(i % side, (i / side) % side, i / (side * side));
+            glm::vec3 offset = (cell - glm::vec3(0.5f * (side - 1))) * spacing;
+            glm::mat4 transform = glm::scale(glm::translate(glm::mat4(1.0f), offset), glm::vec3(size));
+            if (i == 0) {
+                model->setTransform(transform);
+                addModel(model, view);
+            } else {
+                addModel(util::InstanceModel(model, transform), view);
+            }
+        }
+    } else {
+        addModel(model, view);
+    }
+}
+
+void CubeRenderer::addModel(const util::ModelDrawablePtr &model, const util::PackedMeshView &view) {
+    m_culler.add(model->WorldCenter, model->WorldExtent);
+    if (model->occludingAttrib == util::ModelDrawable::OCCLUDER) {
+        // simplified LODs may grow past the surface, only LOD 0 is conservative
+        util::SetOccluderGeometry(*model, view);
+    }
+    m_models.push_back(model);
+    m_sceneChanged = true;
 }
 
-#ifdef __ANDROID__
 void CubeRenderer::init() {
     // initialization should be here
     setup();
 }
-#endif
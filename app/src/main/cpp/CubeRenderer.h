@@ -3,11 +3,18 @@
 
 #include "Renderer.h"
 
+#include <unordered_map>
 #include <vector>
 #include <glm/glm.hpp>
 
+#include "Bvh.h"
+#include "FrameRingAllocator.h"
+#include "FrustumCuller.h"
 #include "ModelDrawable.h"
+#include "OcclusionCuller.h"
 #include "OpenGLShaderProgram.h"
+#include "RenderQueue.h"
+#include "SoftwareOcclusion.h"
 
 // A test class to render cube
 class CubeRenderer : public common::Renderer
@@ -15,25 +22,118 @@ class CubeRenderer : public common::Renderer
 public:
     CubeRenderer();
     virtual ~CubeRenderer();
-#ifdef __ANDROID__
     virtual void init();
-#endif
     virtual void render();
-    virtual GLint getTextureType();
     virtual void unload();
+    virtual void onTap(float x, float y);
+    // coarser LODs under budget pressure until it is over; the meshes keep
+    // every LOD, this saves vertex bandwidth, not memory
+    virtual void trimMemory(common::MemoryPressure level);
+    virtual bool isContinuous() const { return m_continuous; }
+
+    // closest model and LOD 0 triangle under a window position
+    bool pick(float x, float y, uint32_t &model, uint32_t &triangle);
+
+    // none by default, queries cost a draw per occludee and only pay off
+    // in scenes with large occluders
+    enum OcclusionMode {
+        OcclusionNone,
+        // GPU queries, results a frame or two late
+        OcclusionQueries,
+        // CPU rasterized occluders, same frame
+        OcclusionSoftware
+    };
+    void setOcclusionMode(OcclusionMode mode) { m_occlusionMode = mode; }
+    const util::SoftwareOcclusionStats &softwareOcclusionStats() const { return m_softwareOcclusion.stats(); }
+
+    // one glDrawElementsInstanced per mesh and LOD instead of a draw per model
+    void setInstancing(bool instancing) { m_instancing = instancing; }
+    // benchmark scene, count copies of the model on a grid, set before init()
+    void setInstanceCount(uint32_t count) { m_instanceCount = count; }
+    const util::RenderQueueStats &queueStats() const { return m_queue.stats(); }
+    // regions of the per frame data ring, set before init()
+    void setFramesInFlight(uint32_t frames) { m_framesInFlight = frames; }
+    const util::FrameRingStats &ringStats() const { return m_ring.stats(); }
+    // CPU time of the last render(), culling and GL submission without the GPU wait
+    double cpuMs() const { return m_cpuMs; }
+    // draw every frame instead of on demand
+    void setContinuous(bool continuous) { m_continuous = continuous; }
 
 private:
     void setup();
+    void cullModels();
+    void uploadModel(const std::vector<uint8_t> &blob, const std::shared_ptr<util::TriangleBvh> &pickBvh);
+    void addModel(const util::ModelDrawablePtr &model, const util::PackedMeshView &view);
+    // returns the distance to the model's center
+    float selectLod(util::ModelDrawable &model);
+    void queueModel(util::ModelDrawable &model, uint32_t pass);
+    void queueInstanced();
 
 private:
     // simple camera (glm)
     glm::mat4 m_camera;
+    glm::vec3 m_eye;
+    // viewport pixels per unit at distance 1, for LOD selection
+    float m_projScale;
+    // LOD error allowed on screen, in pixels
+    float m_lodThreshold;
+    int32_t m_viewport[4];
 
-    // models
+    // models, culler ids are indices into m_models
     std::vector<util::ModelDrawablePtr> m_models;
+    util::FrustumCuller m_culler;
+    // same ids as m_culler, rebuilt when models are added
+    util::Bvh m_sceneBvh;
+    bool m_sceneChanged;
+    std::vector<uint32_t> m_visible;
+    OcclusionMode m_occlusionMode;
+    util::OcclusionCuller m_occlusion;
+    util::SoftwareOcclusionCuller m_softwareOcclusion;
+    std::vector<util::ModelDrawable *> m_occluders;
+    std::vector<util::ModelDrawable *> m_occludees;
+    // frames to draw after the scene or occlusion results changed, the
+    // queries answer a frame or two late
+    uint32_t m_settleFrames;
+    static const uint32_t SETTLE_FRAMES = 3;
+    bool m_continuous;
+
+    // render queue passes
+    enum {
+        PassOccluders,
+        PassScene
+    };
+    util::RenderQueue m_queue;
+    // uniform ranges and instance rows, rewritten every frame
+    util::FrameRingAllocator m_ring;
+    uint32_t m_framesInFlight;
+    static const GLuint CAMERA_BINDING = 0;
+    // far plane, depth keys are distances over it
+    float m_far;
+
+    // instancing, batches of models sharing a VAO and LOD
+    struct InstanceBatch {
+        GLuint VAO;
+        GLenum IndexType;
+        GLsizei IndexCount;
+        GLsizeiptr IndexOffset;
+        uint32_t First, Count;
+        uint32_t Pass;
+        // nearest instance
+        float Depth;
+    };
+    bool m_instancing;
+    uint32_t m_instanceCount;
+    std::vector<InstanceBatch> m_batches;
+    std::unordered_map<uint64_t, uint32_t> m_batchIds;
+    std::vector<uint32_t> m_modelBatches;
+    double m_cpuMs;
 
     // program
     util::OpenGLShaderProgramPtr m_program;
+    util::OpenGLShaderProgramPtr m_instancedProgram;
+    // uniform blocks bound to their binding points, once linked
+    bool m_objectBlock;
+    bool m_cameraBlock;
 };
 
 #endif // CUBERENDERER_H
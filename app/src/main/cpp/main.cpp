@@ -1,5 +1,7 @@
 #include "Engine.h"
 #include "CubeRenderer.h"
+#include "GLContext.h"
+#include "TextureStreamer.h"
 
 #ifdef __ANDROID__
 #include <android/sensor.h>
@@ -11,16 +13,11 @@ class NativeRenderer : public common::Renderer {
 public:
     NativeRenderer() {}
     virtual ~NativeRenderer() {}
-#ifdef __ANDROID__
     virtual void init() {}
-#endif
     virtual void render() {
         glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
         glClearColor(1.0f, 0.5f, 0.5f, 1.0f);
     }
-    virtual GLint getTextureType() {
-        return 0;
-    }
     virtual void unload() {}
 };
 
@@ -30,11 +27,25 @@ void android_main(struct android_app* state) {
 #ifdef __ANDROID__
     common::Engine g_engine(renderer);
     g_engine.setState(state);
+    // scale the scene down rather than miss 60 Hz frames, the rest of the
+    // frame goes to the upscale and composition
+    g_engine.getDynamicResolution()->setBudget(12.0);
+    // mip levels past what's on screen are paged in within this much GPU
+    // memory, low memory warnings halve it
+    util::TextureStreamer::Get()->setBudget(128 * 1024 * 1024);
+    // every refresh of whatever rate the display runs at, 2 for half of it;
+    // two frames queued at most, input is never more than that behind
+    common::FramePacer *pacer = common::GLContext::Get()->getFramePacer();
+    pacer->setRateDivisor(1);
+    pacer->setMaxFramesInFlight(2);
 
     state->userData = &g_engine;
     state->onAppCmd = common::Engine::handleCmd;
     state->onInputEvent = common::Engine::handleInput;
 
+    // frames are drawn on the render thread, this one only handles events
+    g_engine.startRenderThread();
+
     // loop waiting for stuff to do.
     while (1) {
         // Read all pending events.
@@ -42,11 +53,8 @@ void android_main(struct android_app* state) {
         int events;
         android_poll_source* source;
 
-        // If not animating, we will block forever waiting for events.
-        // If animating, we loop until all events are read, then continue
-        // to draw the next frame of animation.
-        while ((id = ALooper_pollAll(g_engine.isReady() ? 0 : -1, NULL, &events,
-                                     (void**)&source)) >= 0) {
+        // Block until there is an event, a slow frame never delays input.
+        while ((id = ALooper_pollAll(-1, NULL, &events, (void**)&source)) >= 0) {
             // Process this event.
             if (source) {
                 source->process(state, source);
@@ -57,14 +65,10 @@ void android_main(struct android_app* state) {
 
             // Check if we are exiting.
             if (state->destroyRequested != 0) {
-                g_engine.terminate();
+                g_engine.stopRenderThread();
                 return;
             }
         }
-
-        if (g_engine.isReady()) {
-            g_engine.draw();
-        }
     }
 #endif
 }
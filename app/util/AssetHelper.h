@@ -3,17 +3,58 @@
 
 #include <string>
 #include <vector>
+#include <stddef.h>
+#include <stdint.h>
 
 struct AAssetManager;
+struct AAsset;
 
 namespace util {
+
+// read-only view of an asset without copying it, backed by a mapping of
+// the (uncompressed) file or by AAsset_getBuffer. The memory stays valid
+// until the view is reset or destroyed.
+class AssetView {
+public:
+    AssetView();
+    ~AssetView();
+    AssetView(AssetView &&other);
+    AssetView &operator=(AssetView &&other);
+
+    const uint8_t *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool isValid() const { return m_data != nullptr; }
+    // true if backed by a file mapping rather than a decompressed buffer
+    bool isMapped() const { return m_map != nullptr; }
+    void reset();
+
+private:
+    AssetView(const AssetView &);
+    AssetView &operator=(const AssetView &);
+    friend class AssetHelper;
+
+private:
+    const uint8_t *m_data;
+    size_t m_size;
+    // whole pages mapped, m_data may start inside the first one
+    void *m_map;
+    size_t m_mapSize;
+    struct AAsset *m_asset;
+};
+
 // read asset file
 
 class AssetHelper {
 public:
     static AssetHelper *Get();
     void Init(struct AAssetManager *mgr);
+#ifdef QVIEWER_HOST
+    // host builds read assets from a directory instead of the apk
+    void Init(const std::string &rootDir);
+#endif
     bool AssetReadFile(const std::string &name, std::vector<uint8_t> &buf);
+    // zero-copy alternative to AssetReadFile
+    bool AssetOpenView(const std::string &name, AssetView &view);
     ~AssetHelper();
 
 protected:
@@ -21,6 +62,9 @@ protected:
 
 private:
     struct AAssetManager *m_aassetMgr;
+#ifdef QVIEWER_HOST
+    std::string m_rootDir;
+#endif
 
 };
 
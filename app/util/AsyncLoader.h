@@ -0,0 +1,67 @@
+#ifndef _ASYNCLOADER_H_
+#define _ASYNCLOADER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+namespace util {
+
+// Loads resources off the render thread. Each job's work function runs on a
+// worker (file I/O, decoding) and returns the GL upload step, which is run on
+// the render thread by drainUploads() within a per-frame time budget.
+class AsyncLoader {
+public:
+    typedef std::function<void()> UploadTask;
+    typedef std::function<UploadTask()> WorkTask;
+
+    static AsyncLoader *Get();
+    ~AsyncLoader();
+
+    // work may return an empty task if there is nothing to upload
+    void submit(const WorkTask &work);
+    // render thread only, returns the number of uploads run
+    uint32_t drainUploads(double budgetMs);
+    // drops queued work and any results still in flight, e.g. on context loss
+    void cancelAll();
+
+    // jobs submitted and not uploaded yet
+    uint32_t pendingCount() const;
+    // uploads waiting for drainUploads()
+    bool hasUploads() const;
+    // called on a worker whenever an upload gets ready, to wake the render
+    // thread; runs with the loader locked and must not call back into it
+    void setUploadListener(const std::function<void()> &listener);
+
+private:
+    AsyncLoader();
+    void workerLoop();
+
+private:
+    struct Job {
+        uint32_t generation;
+        WorkTask work;
+    };
+    struct Completion {
+        uint32_t generation;
+        UploadTask upload;
+    };
+
+    std::vector<std::thread> m_workers;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Job> m_jobs;
+    std::deque<Completion> m_completions;
+    std::function<void()> m_uploadListener;
+    uint32_t m_generation;
+    uint32_t m_pending;
+    bool m_quit;
+};
+
+} // namespace util
+
+#endif // _ASYNCLOADER_H_
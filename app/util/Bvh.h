@@ -0,0 +1,84 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <functional>
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "ThreadPool.h"
+
+namespace util {
+
+// 32 bytes, two per cache line
+struct BvhNode {
+    glm::vec3 Min;
+    // leaf: first primitive slot, inner: left child, the right one follows it
+    uint32_t First;
+    glm::vec3 Max;
+    // primitives in a leaf, 0 for inner nodes
+    uint32_t Count;
+};
+
+// Bounding volume hierarchy over AABBs given as center and half size, like
+// FrustumCuller. Built top down with binned SAH; the nodes are stored as one
+// array in depth first order with siblings next to each other, and the
+// primitive boxes are copied in leaf order so that a leaf reads them from
+// one place. Primitive ids are the indices into the arrays given to build().
+class Bvh {
+public:
+    Bvh();
+
+    // pool splits the subtrees below the top levels between its threads
+    void build(const std::vector<glm::vec3> &centers, const std::vector<glm::vec3> &extents,
+               ThreadPool *pool = nullptr);
+    // new boxes for the same primitives, keeps the topology; quality degrades
+    // as primitives move far from where they were at build()
+    void refit(const std::vector<glm::vec3> &centers, const std::vector<glm::vec3> &extents);
+    void clear();
+
+    uint32_t size() const { return m_ids.size(); }
+    uint32_t nodeCount() const { return m_nodes.size(); }
+    const std::vector<BvhNode> &nodes() const { return m_nodes; }
+
+    // hierarchical frustum test, nodes fully inside skip the remaining
+    // planes; ids are in tree order, not sorted
+    uint32_t cull(const glm::mat4 &viewProjection, std::vector<uint32_t> &visible) const;
+
+    // Nearest first traversal of the boxes hit by origin + t * direction for
+    // t in [0, tMax]. hit(id, tMax) is called for every primitive whose box
+    // is hit closer than tMax; it returns true and lowers tMax when the
+    // primitive itself is hit. Returns the id of the closest hit or ~0u.
+    uint32_t intersect(const glm::vec3 &origin, const glm::vec3 &direction, float &tMax,
+                       const std::function<bool(uint32_t, float &)> &hit) const;
+
+private:
+    std::vector<BvhNode> m_nodes;
+    // per primitive slot, in leaf order
+    std::vector<uint32_t> m_ids;
+    std::vector<glm::vec3> m_centers;
+    std::vector<glm::vec3> m_extents;
+};
+
+// Triangles of one mesh with a Bvh over them, for picking. Keeps its own
+// copy of the positions and indices.
+class TriangleBvh {
+public:
+    void build(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+               ThreadPool *pool = nullptr);
+
+    // closest triangle hit from either side, t is in and out like Bvh::intersect
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, float &t, uint32_t &triangle) const;
+
+    uint32_t triangleCount() const { return m_indices.size() / 3; }
+    const Bvh &bvh() const { return m_bvh; }
+
+private:
+    Bvh m_bvh;
+    std::vector<glm::vec3> m_positions;
+    std::vector<uint32_t> m_indices;
+};
+
+} // namespace util
+
+#endif // _BVH_H_
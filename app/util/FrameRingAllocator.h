@@ -0,0 +1,96 @@
+#ifndef _FRAMERINGALLOCATOR_H_
+#define _FRAMERINGALLOCATOR_H_
+
+#include <vector>
+#include <stdint.h>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#else // edit mode
+#include <GL/gl.h>
+#endif
+
+namespace util {
+
+// part of the ring written this frame, Data is write only and valid until
+// the next flush()
+struct RingAllocation {
+    GLuint Buffer = 0;
+    GLintptr Offset = 0;
+    GLsizeiptr Size = 0;
+    void *Data = nullptr;
+};
+
+struct FrameRingStats {
+    GLsizeiptr Used = 0;        // bytes allocated last frame
+    GLsizeiptr RegionSize = 0;
+    uint32_t Allocations = 0;   // last frame
+    uint32_t Failed = 0;        // last frame, region full
+    uint32_t Stalls = 0;        // total, frames that waited for the GPU
+    uint32_t Grows = 0;         // total
+    double StallMs = 0.0;       // total
+};
+
+// One buffer for everything written once per frame: uniform ranges, instance
+// data, streamed vertices and indices. The buffer is split into one region
+// per frame in flight; a frame writes its region through
+// glMapBufferRange(GL_MAP_UNSYNCHRONIZED_BIT) and fences it after its draws,
+// the region comes around again framesInFlight frames later. Only when the
+// GPU is that far behind does beginFrame() wait on the fence.
+//
+// GLES can't draw from a mapped buffer, so allocate() maps the rest of the
+// region on demand and flush() unmaps it before the draws that read it.
+class FrameRingAllocator {
+public:
+    FrameRingAllocator();
+    ~FrameRingAllocator();
+
+    // needs a current context, regionSize bytes per frame
+    bool init(GLsizeiptr regionSize, uint32_t framesInFlight = 3);
+    void release();
+    bool isValid() const { return m_buffer != 0; }
+
+    // moves to the next region; minimumSize grows all regions first, with a
+    // new buffer so the frames still in flight keep theirs
+    void beginFrame(GLsizeiptr minimumSize = 0);
+    // Data is null when the region is full
+    RingAllocation allocate(GLsizeiptr size, GLsizeiptr alignment = 16);
+    // offset aligned for glBindBufferRange(GL_UNIFORM_BUFFER)
+    RingAllocation allocateUniform(GLsizeiptr size) { return allocate(size, m_uniformAlignment); }
+    // makes the writes visible, call before drawing from the ring
+    void flush();
+    // after the last draw reading this frame's region
+    void endFrame();
+
+    void bindUniform(GLuint binding, const RingAllocation &allocation) const;
+
+    GLuint buffer() const { return m_buffer; }
+    uint32_t framesInFlight() const { return m_fences.size(); }
+    GLsizeiptr uniformAlignment() const { return m_uniformAlignment; }
+    const FrameRingStats &stats() const { return m_stats; }
+
+private:
+    void allocateBuffer(GLsizeiptr regionSize);
+    bool map();
+    void waitFence(uint32_t region);
+
+private:
+    GLuint m_buffer;
+    GLsizeiptr m_regionSize;
+    GLsizeiptr m_uniformAlignment;
+    // one per region, null when the region is free
+    std::vector<GLsync> m_fences;
+    uint32_t m_region;
+    // within the current region
+    GLsizeiptr m_head;
+    GLsizeiptr m_mapStart;
+    uint8_t *m_mapped;
+    bool m_inFrame;
+    uint32_t m_allocations;
+    uint32_t m_failed;
+    FrameRingStats m_stats;
+};
+
+} // namespace util
+
+#endif // _FRAMERINGALLOCATOR_H_
@@ -0,0 +1,47 @@
+#ifndef _FRUSTUMCULLER_H_
+#define _FRUSTUMCULLER_H_
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+namespace util {
+
+// World space AABBs kept as structure of arrays, so that the plane tests run
+// on 4 boxes per instruction (SSE on x86, NEON on ARM). The visible list
+// holds the ids returned by add(), in increasing order.
+class FrustumCuller {
+public:
+    FrustumCuller();
+
+    // center and half size, returns the box id
+    uint32_t add(const glm::vec3 &center, const glm::vec3 &extent);
+    void update(uint32_t id, const glm::vec3 &center, const glm::vec3 &extent);
+    void clear();
+    uint32_t size() const { return m_count; }
+
+    // viewProjection maps world space to clip space, returns the visible count
+    uint32_t cull(const glm::mat4 &viewProjection, std::vector<uint32_t> &visible) const;
+    // one box at a time, for reference and benchmarks
+    uint32_t cullScalar(const glm::mat4 &viewProjection, std::vector<uint32_t> &visible) const;
+
+    // name of the kernel cull() uses
+    static const char *simdName();
+
+    // x, y, z, w of the six planes, inside when dot(n, p) + w >= 0
+    static void extractPlanes(const glm::mat4 &m, float planes[6][4]);
+
+private:
+    uint32_t m_count;
+    // padded to a multiple of 4
+    std::vector<float> m_centerX, m_centerY, m_centerZ;
+    std::vector<float> m_extentX, m_extentY, m_extentZ;
+};
+
+// bounds of a transformed AABB (Arvo)
+void TransformBounds(const glm::mat4 &transform, const glm::vec3 &center, const glm::vec3 &extent,
+        glm::vec3 &outCenter, glm::vec3 &outExtent);
+
+} // namespace util
+
+#endif // _FRUSTUMCULLER_H_
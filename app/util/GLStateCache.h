@@ -0,0 +1,138 @@
+#ifndef _GLSTATECACHE_H_
+#define _GLSTATECACHE_H_
+
+#include <stdint.h>
+
+#include "GpuMemory.h"
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#else // edit mode
+#include <GL/gl.h>
+#endif
+
+namespace util {
+
+struct GLStateStats {
+    uint32_t Issued = 0;    // calls that reached the driver
+    uint32_t Skipped = 0;   // calls dropped as redundant
+};
+
+// Shadow copy of the GL state the renderers touch: program, VAO, buffer,
+// framebuffer and texture bindings, enable bits, depth, blend and cull state and the
+// viewport. Calls setting what is already set never reach the driver. The
+// shadow is only right as long as every change goes through the cache, code
+// calling GL directly must reset() afterwards. Names are deleted through the
+// cache too, GL unbinds deleted objects and may hand their names out again.
+// GLContext owns one per context and resets it whenever the context is
+// created or lost; everything starts unknown, so the first call of each kind
+// is always issued. The cache also holds the context's GpuMemory, the
+// deletes release what was tracked for the names.
+class GLStateCache {
+public:
+    GLStateCache();
+
+    // the cache of the current context, a shared fallback until a context exists
+    static GLStateCache *Current();
+    static void MakeCurrent(GLStateCache *cache);
+
+    void reset();
+    // counters of the frame in progress move to frameStats()
+    void endFrame();
+    const GLStateStats &frameStats() const { return m_lastFrame; }
+    // what the objects of the context take, survives reset()
+    GpuMemory *memory() { return &m_memory; }
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void bindBuffer(GLenum target, GLuint buffer);
+    // indexed binding, also moves the generic binding of target like GL does;
+    // only GL_UNIFORM_BUFFER ranges are shadowed
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    // GL_FRAMEBUFFER sets both the draw and the read binding
+    void bindFramebuffer(GLenum target, GLuint framebuffer);
+    void activeTexture(GLenum unit);
+    // on the active unit
+    void bindTexture(GLenum target, GLuint texture);
+
+    void setEnabled(GLenum cap, bool enabled);
+    void enable(GLenum cap) { setEnabled(cap, true); }
+    void disable(GLenum cap) { setEnabled(cap, false); }
+    void depthFunc(GLenum func);
+    void depthMask(bool write);
+    void colorMask(bool red, bool green, bool blue, bool alpha);
+    void cullFace(GLenum face);
+    void frontFace(GLenum mode);
+    void blendFunc(GLenum src, GLenum dst) { blendFuncSeparate(src, dst, src, dst); }
+    void blendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+    void blendEquation(GLenum mode);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    void deleteProgram(GLuint program);
+    void deleteVertexArrays(GLsizei count, const GLuint *arrays);
+    void deleteBuffers(GLsizei count, const GLuint *buffers);
+    void deleteTextures(GLsizei count, const GLuint *textures);
+    void deleteFramebuffers(GLsizei count, const GLuint *framebuffers);
+    void deleteRenderbuffers(GLsizei count, const GLuint *renderbuffers);
+
+    static const uint32_t MAX_TEXTURE_UNITS = 16;
+    static const uint32_t MAX_UNIFORM_BINDINGS = 8;
+
+private:
+    // counts the call and updates the shadow, true if it has to be issued
+    template <typename T>
+    bool update(T &cached, const T &value) {
+        if (cached == value) {
+            m_frame.Skipped++;
+            return false;
+        }
+        cached = value;
+        m_frame.Issued++;
+        return true;
+    }
+
+    // slots of the tracked targets and caps, -1 for untracked ones
+    static int bufferSlot(GLenum target);
+    static int textureSlot(GLenum target);
+    static int capSlot(GLenum cap);
+
+private:
+    enum {
+        BUFFER_TARGETS = 10,
+        TEXTURE_TARGETS = 4,
+        CAPS = 11
+    };
+
+    GLuint m_program;
+    GLuint m_vao;
+    GLuint m_buffers[BUFFER_TARGETS];
+    struct BufferRange {
+        GLuint Buffer;
+        GLintptr Offset;
+        GLsizeiptr Size;
+    };
+    BufferRange m_uniformRanges[MAX_UNIFORM_BINDINGS];
+    GLuint m_drawFramebuffer;
+    GLuint m_readFramebuffer;
+    GLenum m_activeUnit;
+    GLuint m_textures[MAX_TEXTURE_UNITS][TEXTURE_TARGETS];
+    // 0 off, 1 on, -1 unknown
+    int8_t m_caps[CAPS];
+    GLenum m_depthFunc;
+    int8_t m_depthMask;
+    // red, green, blue and alpha in the low 4 bits, ~0 unknown
+    uint32_t m_colorMask;
+    GLenum m_cullFace;
+    GLenum m_frontFace;
+    GLenum m_blend[4];
+    GLenum m_blendEquation;
+    GLint m_viewport[4];
+
+    GLStateStats m_frame;
+    GLStateStats m_lastFrame;
+    GpuMemory m_memory;
+};
+
+} // namespace util
+
+#endif // _GLSTATECACHE_H_
@@ -0,0 +1,72 @@
+#ifndef _GPUMEMORY_H_
+#define _GPUMEMORY_H_
+
+#include <unordered_map>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#else // edit mode
+#include <GL/gl.h>
+#endif
+
+namespace util {
+
+enum GpuMemoryCategory {
+    // vertex and index buffers
+    GPU_MEMORY_GEOMETRY,
+    // rewritten every frame, rings, staging and instance data
+    GPU_MEMORY_STREAMING,
+    GPU_MEMORY_TEXTURES,
+    // offscreen color and depth buffers
+    GPU_MEMORY_RENDER_TARGETS,
+    // driver binaries, as GL_PROGRAM_BINARY_LENGTH reports them
+    GPU_MEMORY_PROGRAMS,
+    GPU_MEMORY_CATEGORIES
+};
+
+struct GpuMemoryStats {
+    size_t Bytes[GPU_MEMORY_CATEGORIES] = {};
+    uint32_t Objects[GPU_MEMORY_CATEGORIES] = {};
+    size_t Total = 0;
+    size_t Peak = 0;
+};
+
+// Bytes of the GL objects of a context by category. Whoever allocates
+// storage reports it with track(), GLStateCache's delete calls release it;
+// the sizes are what the data takes, drivers add alignment and padding on
+// top. Render thread only, like the cache owning it.
+class GpuMemory {
+public:
+    // GL names are only unique within a kind
+    enum Kind {
+        BUFFER,
+        TEXTURE,
+        RENDERBUFFER,
+        PROGRAM,
+        KINDS
+    };
+
+    // replaces what the object had, e.g. after glBufferData orphaned it
+    void track(Kind kind, GLuint name, GpuMemoryCategory category, size_t bytes);
+    void release(Kind kind, GLuint name);
+    // the context is gone and its objects with it
+    void clear();
+
+    const GpuMemoryStats &stats() const { return m_stats; }
+    static const char *CategoryName(GpuMemoryCategory category);
+
+private:
+    struct Allocation {
+        GpuMemoryCategory Category;
+        size_t Bytes;
+    };
+
+    std::unordered_map<GLuint, Allocation> m_objects[KINDS];
+    GpuMemoryStats m_stats;
+};
+
+} // namespace util
+
+#endif // _GPUMEMORY_H_
@@ -0,0 +1,38 @@
+#ifndef _HASHUTIL_H_
+#define _HASHUTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace util {
+
+// FNV-1a, usable at compile time for string literals
+static const uint32_t FNV32_OFFSET = 2166136261u;
+static const uint32_t FNV32_PRIME = 16777619u;
+static const uint64_t FNV64_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV64_PRIME = 1099511628211ull;
+
+constexpr uint32_t HashString(const char *str, uint32_t hash = FNV32_OFFSET) {
+    return *str ? HashString(str + 1, (hash ^ static_cast<uint8_t>(*str)) * FNV32_PRIME) : hash;
+}
+
+inline uint32_t HashString(const std::string &str) {
+    uint32_t hash = FNV32_OFFSET;
+    for (char c : str) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * FNV32_PRIME;
+    }
+    return hash;
+}
+
+inline uint64_t HashBytes(const void *data, size_t size, uint64_t hash = FNV64_OFFSET) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * FNV64_PRIME;
+    }
+    return hash;
+}
+
+} // namespace util
+
+#endif // _HASHUTIL_H_
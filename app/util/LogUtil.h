@@ -6,6 +6,11 @@
 #define LOG_TAG "QViewer"
 #define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 #define ALOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
+#elif defined(QVIEWER_HOST)
+#include <stdio.h>
+#define LOG_TAG "QViewer"
+#define ALOGE(...) (fprintf(stderr, LOG_TAG " E: " __VA_ARGS__), fputc('\n', stderr))
+#define ALOGV(...) (fprintf(stderr, LOG_TAG " V: " __VA_ARGS__), fputc('\n', stderr))
 #endif // __ANDROID__
 
 #endif // LOG_UTIL_H
@@ -0,0 +1,97 @@
+#ifndef _MESHFORMAT_H_
+#define _MESHFORMAT_H_
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#else // edit mode
+#include <GL/gl.h>
+#endif
+
+#include "ModelDrawable.h"
+
+namespace util {
+
+// Runtime mesh format (.qmesh). Vertices are stored in the layout the GPU
+// reads, so loading is a header check plus an upload:
+//   location 0: position, 4 x unorm16 in the bounding box, w = 1
+//   location 1: normal, 2 x snorm16 octahedral (optional)
+//   location 2: uv, 2 x half float (optional)
+// Indices are 16 bit whenever the vertex count allows it. All LODs share the
+// vertex block, their index ranges follow each other in the index block.
+
+enum MeshFlags {
+    MESH_NORMALS = 1,
+    MESH_UVS = 2,
+    MESH_SHORT_INDICES = 4
+};
+
+static const uint32_t MESH_MAGIC = 0x48534d51; // "QMSH"
+static const uint32_t MESH_VERSION = 2;
+
+struct PackedMeshHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t stride;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t lodCount;
+    uint32_t reserved[3];
+};
+
+// lodCount entries follow the header
+struct PackedMeshLod {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;
+    uint32_t reserved;
+};
+
+// float32 source data, Normals and UVs are either empty or per vertex
+struct MeshData {
+    std::vector<glm::vec3> Positions;
+    std::vector<glm::vec3> Normals;
+    std::vector<glm::vec2> UVs;
+    std::vector<uint32_t> Indices;
+    // empty means a single LOD over all Indices
+    std::vector<MeshLod> Lods;
+};
+
+// points into an encoded blob, no ownership
+struct PackedMeshView {
+    const PackedMeshHeader *Header = nullptr;
+    const PackedMeshLod *Lods = nullptr;
+    const uint8_t *Vertices = nullptr;
+    const uint8_t *Indices = nullptr;
+
+    size_t vertexBytes() const { return (size_t)((uint64_t)Header->vertexCount * Header->stride); }
+    size_t indexBytes() const;
+    GLenum indexType() const;
+    // maps the unorm16 positions back to object space
+    glm::mat4 dequantizeMatrix() const;
+};
+
+bool EncodePackedMesh(const MeshData &mesh, std::vector<uint8_t> &blob);
+bool ParsePackedMesh(const uint8_t *data, size_t size, PackedMeshView &view);
+
+// CPU side decoders, e.g. for picking or culling, out holds vertexCount entries
+void DecodePositions(const PackedMeshView &view, glm::vec3 *out);
+void DecodeNormals(const PackedMeshView &view, glm::vec3 *out);
+void DecodeUVs(const PackedMeshView &view, glm::vec2 *out);
+
+// creates VAO/VBO/IBO with the packed layout, needs a current context
+bool UploadPackedMesh(const PackedMeshView &view, ModelDrawable &model);
+
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t value);
+
+} // namespace util
+
+#endif // _MESHFORMAT_H_
@@ -0,0 +1,57 @@
+#ifndef _MESHOPTIMIZER_H_
+#define _MESHOPTIMIZER_H_
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "MeshFormat.h"
+
+namespace util {
+
+// Import-time mesh optimization, run on MeshData before it is encoded and
+// uploaded. OptimizeMesh() applies the stages in the order they depend on:
+//   1. weld exactly equal vertices, drop degenerate triangles
+//   2. triangle order for the post-transform cache (Forsyth)
+//   3. overdraw: split into clusters at cache boundaries, sort outside-in
+//   4. vertex order by first use, for fetch locality
+//   5. optionally a LOD chain appended to Indices, see BuildLodChain()
+
+struct VertexCacheStats {
+    uint32_t TriangleCount = 0;
+    uint32_t VertexCount = 0;   // distinct vertices referenced
+    uint32_t Misses = 0;        // vertex shader invocations
+    float ACMR = 0.0f;          // misses per triangle, 0.5 is optimal on a grid
+    float ATVR = 0.0f;          // misses per vertex, 1.0 is optimal
+};
+
+// fifo cache simulation, 16 entries is typical for mobile GPUs
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount,
+        uint32_t cacheSize = 16);
+
+// returns the number of vertices removed
+size_t WeldVertices(MeshData &mesh);
+void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+// indices should be cache optimized, threshold is the allowed ACMR increase
+void OptimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+        float threshold = 1.05f);
+void OptimizeVertexFetch(MeshData &mesh);
+
+// Quadric error edge collapse onto existing vertices, so the result still
+// indexes the same vertex buffer. Vertices on open borders and attribute
+// seams are kept in place. Returns the object space error reached.
+float SimplifyMesh(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+        size_t targetIndexCount);
+// Indices must hold LOD 0 only. Each further LOD has about ratio times the
+// triangles of the previous one, the chain ends early when the simplifier
+// gets stuck.
+void BuildLodChain(MeshData &mesh, uint32_t maxLods, float ratio = 0.5f);
+
+void OptimizeMesh(MeshData &mesh, uint32_t maxLods = 1);
+// one mesh per task, threads = 0 uses all cores
+void OptimizeMeshes(const std::vector<MeshData *> &meshes, uint32_t maxLods = 1,
+        unsigned int threads = 0);
+
+} // namespace util
+
+#endif // _MESHOPTIMIZER_H_
@@ -1,9 +1,15 @@
 #ifndef MODELDRAWABLE_H
 #define MODELDRAWABLE_H
 
+#include <algorithm>
 #include <memory>
+#include <vector>
+#include <stdint.h>
 #include <glm/glm.hpp>
 
+#include "FrustumCuller.h"
+#include "GLStateCache.h"
+
 #if defined(__WIN32) || defined(__WIN64)
 #define GL_GLEXT_PROTOTYPES
 #include <GL/glcorearb.h>
@@ -11,6 +17,16 @@
 #endif
 
 namespace util {
+
+class TriangleBvh;
+
+// range of the shared index buffer, Error is the object space deviation from LOD 0
+struct MeshLod {
+    uint32_t IndexOffset;
+    uint32_t IndexCount;
+    float Error;
+};
+
 class ModelDrawable {
 public:
     enum OccludingAttrib {
@@ -21,28 +37,105 @@ public:
 
     explicit ModelDrawable() {}
     ~ModelDrawable() {
-        // release everything
-        glDeleteVertexArrays(1, &VAO);
-        glDeleteVertexArrays(1, &bbVAO);
-        glDeleteBuffers(1, &VBO);
-        glDeleteBuffers(1, &IBO);
-        glDeleteBuffers(1, &bbVBO);
-        glDeleteBuffers(1, &bbIBO);
+        // release everything, instances leave the buffers to their source
+        if (!Source) {
+            GLStateCache *state = GLStateCache::Current();
+            const GLuint arrays[] = { VAO, bbVAO };
+            const GLuint buffers[] = { VBO, IBO, bbVBO, bbIBO };
+            state->deleteVertexArrays(2, arrays);
+            state->deleteBuffers(4, buffers);
+        }
         glDeleteQueries(1, &Query);
     }
 
+    // places the model in the world, the world bounds follow; call again
+    // after changing Dequantize or the object space bounds
+    void setTransform(const glm::mat4 &transform) {
+        Transform = transform;
+        World = Transform * Dequantize;
+        TransformBounds(Transform, Center, Extent, WorldCenter, WorldExtent);
+        Scale = std::max(glm::length(glm::vec3(Transform[0])),
+                         std::max(glm::length(glm::vec3(Transform[1])), glm::length(glm::vec3(Transform[2]))));
+    }
+
+    // pixelsPerUnit is the projected size of one object space unit at the
+    // model's distance. Picks the coarsest LOD whose error stays under
+    // thresholdPx, moving to a coarser one only below the hysteresis band
+    uint32_t selectLod(float pixelsPerUnit, float thresholdPx = 1.0f, float hysteresis = 0.25f) {
+        if (Lods.empty()) {
+            return Lod = 0;
+        }
+        if (Lod >= Lods.size()) {
+            Lod = Lods.size() - 1;
+        }
+        while (Lod > 0 && Lods[Lod].Error * pixelsPerUnit > thresholdPx) {
+            Lod--;
+        }
+        while (Lod + 1 < Lods.size() &&
+               Lods[Lod + 1].Error * pixelsPerUnit <= thresholdPx * (1.0f - hysteresis)) {
+            Lod++;
+        }
+        return Lod;
+    }
+
+    GLsizeiptr indexSize() const {
+        return IndexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    }
+
     GLuint VAO = 0, VBO = 0, IBO = 0;
     GLuint bbVAO = 0, bbVBO = 0, bbIBO = 0;
     float BBGeo[24];
     int BBindices[32];
     GLuint Query = 0;
+    // set by OcclusionCuller
+    bool QueryPending = false;
+    uint32_t OcclusionFrame = 0;
+    // results in a row that found it hidden
+    uint32_t OccludedResults = 0;
+    // CPU copy for SoftwareOcclusionCuller, world space
+    std::vector<glm::vec3> OccluderPositions;
+    std::vector<uint32_t> OccluderIndices;
+    // LOD 0 triangles in object space, for picking
+    std::shared_ptr<const TriangleBvh> PickBvh;
     GLuint TriCount = 0;
+    GLenum IndexType = GL_UNSIGNED_INT;
+    // maps quantized vertex positions to object space
+    glm::mat4 Dequantize = glm::mat4(1.0f);
+    // object space bounds, Extent is the half size
     glm::vec3 Center = glm::vec3(0.0f);
+    glm::vec3 Extent = glm::vec3(0.0f);
+    float Radius = 0.0f;
+    glm::mat4 Transform = glm::mat4(1.0f);
+    // Transform * Dequantize, quantized positions to world space
+    glm::mat4 World = glm::mat4(1.0f);
+    // largest axis scale of Transform, for world space distances
+    float Scale = 1.0f;
+    glm::vec3 WorldCenter = glm::vec3(0.0f);
+    glm::vec3 WorldExtent = glm::vec3(0.0f);
+    // set on instances, they share its GL objects and keep it alive
+    std::shared_ptr<const ModelDrawable> Source;
+    // finest first, all LODs index the same VBO
+    std::vector<MeshLod> Lods;
+    uint32_t Lod = 0;
     bool isCulled = true;
     OccludingAttrib occludingAttrib = OCCLUDEE;
 };
 
 typedef std::shared_ptr<ModelDrawable> ModelDrawablePtr;
+
+// another placement of the same mesh, drawn with the same VAO
+inline ModelDrawablePtr InstanceModel(const ModelDrawablePtr &source, const glm::mat4 &transform) {
+    auto model = std::make_shared<ModelDrawable>(*source);
+    model->Source = source->Source ? source->Source : source;
+    model->Query = 0;
+    model->QueryPending = false;
+    model->OccludedResults = 0;
+    model->OccluderPositions.clear();
+    model->OccluderIndices.clear();
+    model->occludingAttrib = ModelDrawable::OCCLUDEE;
+    model->setTransform(transform);
+    return model;
+}
 }
 
 #endif // MODELDRAWABLE_H
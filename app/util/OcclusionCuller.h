@@ -0,0 +1,74 @@
+#ifndef _OCCLUSIONCULLER_H_
+#define _OCCLUSIONCULLER_H_
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#else // edit mode
+#include <GL/gl.h>
+#endif
+
+#include "ModelDrawable.h"
+#include "OpenGLShaderProgram.h"
+
+namespace util {
+
+struct OcclusionStats {
+    uint32_t Issued = 0;    // queries started this frame
+    uint32_t Pending = 0;   // results not available yet, previous result kept
+    uint32_t Occluded = 0;  // occludees skipped this frame
+    uint32_t Changed = 0;   // occludees whose visibility flipped this frame
+};
+
+// Hardware occlusion queries on bounding box proxies. Each frame:
+//   1. update() reads back the queries that finished, without waiting, and
+//      sets isCulled on the occludees
+//   2. the renderer draws the occluders
+//   3. query() tests the proxies of the occludees against their depth with
+//      GL_ANY_SAMPLES_PASSED_CONSERVATIVE queries around them
+//   4. the renderer draws the occludees that are not culled
+// The proxies go before the occludees, a box tested against the model's
+// own depth would z-fight it. Results arrive one or two frames late, a
+// model keeps its last result until then and is only culled after
+// OCCLUDED_RESULTS hidden results in a row. The proxy boxes of a frame are
+// one vertex buffer, each query draws its 36 indices of it.
+class OcclusionCuller {
+public:
+    OcclusionCuller();
+    ~OcclusionCuller();
+
+    // needs a current context, the proxy program links in the background
+    void init();
+    void release();
+
+    // occluders and models (occludees) that passed frustum culling this
+    // frame, nothing is queried or culled when there are no occluders
+    void update(const std::vector<ModelDrawable *> &occluders,
+                const std::vector<ModelDrawable *> &models);
+    void query(const glm::mat4 &viewProjection, const glm::vec3 &eye,
+               const std::vector<ModelDrawable *> &occluders,
+               const std::vector<ModelDrawable *> &models);
+
+    const OcclusionStats &stats() const { return m_stats; }
+
+    static const uint32_t OCCLUDED_RESULTS = 2;
+
+private:
+    OpenGLShaderProgramPtr m_program;
+    Uniform<glm::mat4> m_viewProjection;
+    GLuint m_proxyVAO, m_proxyVBO, m_proxyIBO;
+    // world space corners of every proxy drawn this frame
+    std::vector<glm::vec3> m_corners;
+    // boxes the index buffer holds, it only grows
+    size_t m_proxyCapacity;
+    std::vector<ModelDrawable *> m_queried;
+    uint32_t m_frame;
+    OcclusionStats m_stats;
+};
+
+} // namespace util
+
+#endif // _OCCLUSIONCULLER_H_
@@ -1,19 +1,79 @@
 #ifndef _OPENGLSHADERPROGRAM_H_
 #define _OPENGLSHADERPROGRAM_H_
 
+#include <chrono>
 #include <list>
 #include <memory>
 #include <string>
+#include <vector>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
-#ifdef __ANDROID__
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
 #include <GLES3/gl32.h>
 #else // edit mode
 #include <GL/gl.h>
 #endif
 
+#include "HashUtil.h"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 namespace util {
 
+// uniform name reduced to its hash, literals are hashed at compile time
+class UniformName {
+public:
+    template <size_t N>
+    constexpr UniformName(const char (&name)[N]) : m_hash(HashString(name)) {}
+    UniformName(const std::string &name) : m_hash(HashString(name)) {}
+    constexpr uint32_t hash() const { return m_hash; }
+
+private:
+    uint32_t m_hash;
+};
+
+// glUniform* overloads by value type
+struct OpenGLUniform {
+    static void Set(GLint location, bool value) { glUniform1i(location, value); }
+    static void Set(GLint location, int value) { glUniform1i(location, value); }
+    static void Set(GLint location, float value) { glUniform1f(location, value); }
+    static void Set(GLint location, const glm::vec2 &value) {
+        glUniform2fv(location, 1, glm::value_ptr(value));
+    }
+    static void Set(GLint location, const glm::vec3 &value) {
+        glUniform3fv(location, 1, glm::value_ptr(value));
+    }
+    static void Set(GLint location, const glm::vec4 &value) {
+        glUniform4fv(location, 1, glm::value_ptr(value));
+    }
+    static void Set(GLint location, const glm::mat2 &value) {
+        glUniformMatrix2fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+    static void Set(GLint location, const glm::mat3 &value) {
+        glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+    static void Set(GLint location, const glm::mat4 &value) {
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+};
+
+// typed handle resolved once after link, setting it does no lookup at all
+template <typename T>
+class Uniform {
+public:
+    Uniform() : m_location(-1) {}
+    explicit Uniform(GLint location) : m_location(location) {}
+    bool isValid() const { return m_location >= 0; }
+    GLint location() const { return m_location; }
+    void set(const T &value) const { OpenGLUniform::Set(m_location, value); }
+
+private:
+    GLint m_location;
+};
+
 class OpenGLShader {
 public:
     enum ShaderType {
@@ -29,11 +89,13 @@ public:
     ~OpenGLShader();
     bool compileSourceCode(const std::string &source);
     bool compileSourceFile(const std::string &filename);
+    // starts compilation without waiting for the result
+    bool submitSourceCode(const std::string &source);
+    bool checkCompileErrors() const;
     GLuint shaderID() const { return m_shaderID; }
 
 private:
     void init();
-    bool checkCompileErrors() const;
 
 private:
     GLuint m_shaderID;
@@ -44,39 +106,93 @@ typedef std::shared_ptr<OpenGLShader> OpenGLShaderPtr;
 
 class OpenGLShaderProgram {
 public:
+    enum Status {
+        Unlinked,
+        Pending,
+        Ready,
+        Failed
+    };
+
     explicit OpenGLShaderProgram();
     ~OpenGLShaderProgram();
 
+    // sources are only recorded here, link() compiles them unless the
+    // program binary cache already holds the linked result
     bool addShaderFromSourceCode(OpenGLShader::ShaderType type, const std::string &source);
     bool addShaderFromSourceFile(OpenGLShader::ShaderType type, const std::string &filename);
+    // injected after the #version line of every stage
+    void addDefine(const std::string &name, const std::string &value = std::string());
 
+    // blocking, same as submit() followed by finish()
     bool link();
+    // non-blocking compile + link, Ready right away on a binary cache hit
+    bool submit();
+    // GL_COMPLETION_STATUS_KHR, only meaningful with KHR_parallel_shader_compile
+    bool isLinkComplete() const;
+    // waits for a pending link and checks its result
+    Status finish();
+    Status status() const { return m_status; }
+    bool isReady() const { return m_status == Ready; }
+
     void bind();
     void release();
 
     GLuint programID() const { return m_programID; }
 
+    // active uniforms are reflected after link, -1 if not active
+    GLint uniformLocation(UniformName name) const;
+    template <typename T>
+    Uniform<T> uniform(UniformName name) const { return Uniform<T>(uniformLocation(name)); }
+    // GLES 3.0 has no binding layout qualifier, blocks are bound after link
+    bool bindUniformBlock(const char *name, GLuint binding) const;
+
     // uniform functions
-    void setBoolean(const std::string &name, bool value) const;
-    void setInt(const std::string &name, int value) const;
-    void setFloat(const std::string &name, float value) const;
-    void setVec2(const std::string &name, const glm::vec2 &value) const;
-    void setVec2(const std::string &name, float x, float y) const;
-    void setVec3(const std::string &name, const glm::vec3 &value) const;
-    void setVec3(const std::string &name, float x, float y, float z) const;
-    void setVec4(const std::string &name, const glm::vec4 &value) const;
-    void setVec4(const std::string &name, float x, float y, float z, float w) const;
-    void setMat2(const std::string &name, const glm::mat2 &mat) const;
-    void setMat3(const std::string &name, const glm::mat3 &mat) const;
-    void setMat4(const std::string &name, const glm::mat4 &mat) const;
+    void setBoolean(UniformName name, bool value) const;
+    void setInt(UniformName name, int value) const;
+    void setFloat(UniformName name, float value) const;
+    void setVec2(UniformName name, const glm::vec2 &value) const;
+    void setVec2(UniformName name, float x, float y) const;
+    void setVec3(UniformName name, const glm::vec3 &value) const;
+    void setVec3(UniformName name, float x, float y, float z) const;
+    void setVec4(UniformName name, const glm::vec4 &value) const;
+    void setVec4(UniformName name, float x, float y, float z, float w) const;
+    void setMat2(UniformName name, const glm::mat2 &mat) const;
+    void setMat3(UniformName name, const glm::mat3 &mat) const;
+    void setMat4(UniformName name, const glm::mat4 &mat) const;
 
 private:
+    std::string preprocess(const std::string &source) const;
+    uint64_t sourceHash() const;
     bool checkLinkErrors() const;
+    void reflectUniforms();
+    void trackMemory() const;
+    void insertUniform(uint32_t hash, GLint location);
 
 private:
+    struct ShaderSource {
+        OpenGLShader::ShaderType type;
+        std::string source;
+    };
+
+    struct UniformSlot {
+        uint32_t hash;
+        GLint location;
+    };
+
     GLuint m_programID;
-    bool m_isLinked;
+    Status m_status;
+    bool m_useCache;
+    uint64_t m_cacheKey;
+    std::chrono::steady_clock::time_point m_submitTime;
+    // spent inside submit() and finish() so far
+    double m_blockedMs;
     std::list<OpenGLShaderPtr> m_shaders;
+    std::vector<ShaderSource> m_sources;
+    std::vector<std::pair<std::string, std::string> > m_defines;
+
+    // open addressing table, power of two sized, location -1 marks empty
+    std::vector<UniformSlot> m_uniforms;
+    uint32_t m_uniformMask;
 };
 
 typedef std::shared_ptr<OpenGLShaderProgram> OpenGLShaderProgramPtr;
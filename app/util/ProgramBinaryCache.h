@@ -0,0 +1,64 @@
+#ifndef _PROGRAMBINARYCACHE_H_
+#define _PROGRAMBINARYCACHE_H_
+
+#include <string>
+#include <stdint.h>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#else // edit mode
+#include <GL/gl.h>
+#endif
+
+namespace util {
+
+struct ProgramBinaryStats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    // binaries rejected by the driver or corrupted on disk
+    uint32_t invalid = 0;
+    uint32_t stores = 0;
+    // time the calling thread spent blocked compiling+linking from source
+    // and loading binaries
+    double compileMs = 0.0;
+    double loadMs = 0.0;
+    // wall time from submit to the finished link, includes the frames and
+    // idle waits in between
+    double compileLatencyMs = 0.0;
+};
+
+// disk cache of linked program binaries (glGetProgramBinary/glProgramBinary),
+// keyed by the program sources and the driver that produced them
+class ProgramBinaryCache {
+public:
+    static ProgramBinaryCache *Get();
+    void Init(const std::string &cacheDir);
+
+    // needs a current context, false if no dir is set or the driver has no binary formats
+    bool isEnabled();
+    // mixes GL_RENDERER/GL_VERSION into a hash of the program sources
+    uint64_t makeKey(uint64_t sourceHash) const;
+    bool load(GLuint program, uint64_t key);
+    bool store(GLuint program, uint64_t key);
+
+    void recordCompile(double blockedMs, double latencyMs) {
+        m_stats.compileMs += blockedMs;
+        m_stats.compileLatencyMs += latencyMs;
+    }
+    const ProgramBinaryStats &getStats() const { return m_stats; }
+    void resetStats() { m_stats = ProgramBinaryStats(); }
+
+private:
+    ProgramBinaryCache();
+    std::string entryPath(uint64_t key) const;
+
+private:
+    std::string m_cacheDir;
+    bool m_formatsChecked;
+    bool m_supported;
+    ProgramBinaryStats m_stats;
+};
+
+} // namespace util
+
+#endif // _PROGRAMBINARYCACHE_H_
@@ -0,0 +1,107 @@
+#ifndef _RENDERQUEUE_H_
+#define _RENDERQUEUE_H_
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#else // edit mode
+#include <GL/gl.h>
+#endif
+
+namespace util {
+
+// everything execute() needs for one draw, GL names rather than objects
+struct DrawPacket {
+    GLuint Program = 0;
+    GLuint VAO = 0;
+    // bound to unit 0, 0 for none
+    GLuint Texture = 0;
+    GLenum IndexType = GL_UNSIGNED_INT;
+    GLsizei IndexCount = 0;
+    // in bytes
+    GLsizeiptr IndexOffset = 0;
+    // per object uniform block range bound at OBJECT_BINDING, 0 for none
+    GLuint UniformBuffer = 0;
+    GLintptr UniformOffset = 0;
+    GLsizeiptr UniformSize = 0;
+    // instanced draws read INSTANCE_ROWS vec4 per instance from
+    // InstanceBuffer at INSTANCE_ATTRIBUTE, the first one at InstanceOffset
+    // bytes; the arrays are only enabled for the draw, the VAO sets the divisor
+    GLsizei InstanceCount = 0;
+    GLuint InstanceBuffer = 0;
+    GLintptr InstanceOffset = 0;
+};
+
+struct RenderQueueStats {
+    uint32_t Packets = 0;
+    uint32_t DrawCalls = 0;
+    // binds in sorted order
+    uint32_t ProgramChanges = 0;
+    uint32_t VAOChanges = 0;
+    uint32_t TextureChanges = 0;
+    // what the same packets cost in submission order
+    uint32_t UnsortedProgramChanges = 0;
+    uint32_t UnsortedVAOChanges = 0;
+    uint32_t UnsortedTextureChanges = 0;
+    double SortMs = 0.0;
+};
+
+// Draw packets with 64 bit sort keys, radix sorted and executed once per
+// frame. Keys group draws by state so that program, texture and VAO binds
+// only happen on changes:
+//   opaque:      pass | 0 | program | material | vao | depth
+//   translucent: pass | 1 | ~depth  | program | material | vao
+// so opaque draws with equal state go front to back for early-Z, and
+// translucent ones back to front regardless of state.
+class RenderQueue {
+public:
+    static const uint32_t PASS_BITS = 2;
+    static const uint32_t PROGRAM_BITS = 8;
+    static const uint32_t MATERIAL_BITS = 12;
+    static const uint32_t VAO_BITS = 16;
+    static const uint32_t DEPTH_BITS = 25;
+    static const GLuint INSTANCE_ATTRIBUTE = 3;
+    static const GLuint INSTANCE_ROWS = 3;
+    static const GLuint OBJECT_BINDING = 1;
+
+    // ids are masked to their field, depth is in [0, 1] from near to far
+    static uint64_t MakeKey(uint32_t pass, bool translucent, uint32_t program, uint32_t material,
+                            uint32_t vao, float depth);
+
+    void clear();
+    void submit(uint64_t key, const DrawPacket &packet);
+
+    void sort();
+    // needs a current context, leaves the last program bound
+    void execute();
+    // only the packets of one pass, e.g. to test against the pass before
+    // the next one draws
+    void execute(uint32_t pass);
+
+    uint32_t size() const { return m_packets.size(); }
+    const RenderQueueStats &stats() const { return m_stats; }
+
+private:
+    struct SortItem {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    void execute(size_t begin, size_t end);
+    void countStateChanges(const std::vector<SortItem> &order, uint32_t &programs, uint32_t &vaos,
+                           uint32_t &textures) const;
+
+private:
+    std::vector<DrawPacket> m_packets;
+    // submission order, sorted in place by sort()
+    std::vector<SortItem> m_items;
+    std::vector<SortItem> m_scratch;
+    RenderQueueStats m_stats;
+};
+
+} // namespace util
+
+#endif // _RENDERQUEUE_H_
@@ -0,0 +1,39 @@
+#ifndef _SHADERCOMPILEQUEUE_H_
+#define _SHADERCOMPILEQUEUE_H_
+
+#include <vector>
+
+#include "OpenGLShaderProgram.h"
+
+namespace util {
+
+// programs are submitted up front and their link results collected later,
+// so the driver compiles them in parallel instead of syncing on each one
+class ShaderCompileQueue {
+public:
+    static ShaderCompileQueue *Get();
+
+    // call once per context, parallel = GL_KHR_parallel_shader_compile is present
+    void init(bool parallel);
+    void enqueue(const OpenGLShaderProgramPtr &program);
+    // finishes programs the driver reports complete, never blocks with
+    // parallel compile; without it every pending program is finished
+    void poll();
+    // blocks until every pending program is finished
+    void finish();
+    void clear();
+
+    size_t pendingCount() const { return m_pending.size(); }
+    bool isParallel() const { return m_parallel; }
+
+private:
+    ShaderCompileQueue();
+
+private:
+    bool m_parallel;
+    std::vector<OpenGLShaderProgramPtr> m_pending;
+};
+
+} // namespace util
+
+#endif // _SHADERCOMPILEQUEUE_H_
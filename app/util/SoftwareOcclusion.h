@@ -0,0 +1,90 @@
+#ifndef _SOFTWAREOCCLUSION_H_
+#define _SOFTWAREOCCLUSION_H_
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "MeshFormat.h"
+#include "ModelDrawable.h"
+#include "ThreadPool.h"
+
+namespace util {
+
+struct SoftwareOcclusionStats {
+    uint32_t Occluders = 0;
+    uint32_t Triangles = 0;     // occluder triangles left after setup
+    uint32_t Occludees = 0;
+    uint32_t Culled = 0;
+    double RasterMs = 0.0;      // transform, setup and rasterization
+    double TestMs = 0.0;
+
+    float culledPercent() const { return Occludees ? 100.0f * Culled / Occludees : 0.0f; }
+};
+
+// CPU occlusion culling in the style of Masked Occlusion Culling (Andersson
+// et al.). Occluders are rasterized into a low resolution buffer of 8x4
+// pixel tiles, each keeping a coverage mask and two conservative max depths
+// instead of per pixel depth, with 4 wide SIMD edge tests (SSE2 / NEON).
+// Occludee boxes are tested against the tiles they cover, in the same frame
+// and before any GL call, so the CPU work overlaps the GPU still busy with
+// the previous frame. Rasterization is split into bands of tile rows and the
+// box tests into chunks, both run on a ThreadPool.
+class SoftwareOcclusionCuller {
+public:
+    // width and height are rounded up to whole tiles, threads = 0 uses all cores
+    SoftwareOcclusionCuller(uint32_t width = 256, uint32_t height = 128, unsigned int threads = 0);
+
+    // sets isCulled on the occludees, occluders need OccluderPositions and OccluderIndices
+    void cull(const glm::mat4 &viewProjection, const std::vector<ModelDrawable *> &occluders,
+              const std::vector<ModelDrawable *> &occludees);
+
+    // the steps of cull(), for callers without ModelDrawables
+    void clear();
+    void renderOccluders(const glm::mat4 &viewProjection,
+                         const std::vector<const std::vector<glm::vec3> *> &positions,
+                         const std::vector<const std::vector<uint32_t> *> &indices);
+    // world space box, true if any part of it may be visible
+    bool testBox(const glm::mat4 &viewProjection, const glm::vec3 &center, const glm::vec3 &extent) const;
+
+    const SoftwareOcclusionStats &stats() const { return m_stats; }
+    ThreadPool &threadPool() { return m_pool; }
+    uint32_t width() const { return m_tilesX * TILE_WIDTH; }
+    uint32_t height() const { return m_tilesY * TILE_HEIGHT; }
+
+    static const uint32_t TILE_WIDTH = 8;
+    static const uint32_t TILE_HEIGHT = 4;
+
+private:
+    struct Triangle {
+        // edge functions, inside when a * x + b * y + c >= 0 for all three
+        float a[3], b[3], c[3];
+        // depth plane z = za * x + zb * y + zc and the farthest vertex
+        float za, zb, zc, zMax;
+        uint16_t minTileX, maxTileX, minTileY, maxTileY;
+    };
+
+    void setupTriangles(const glm::mat4 &viewProjection, const std::vector<glm::vec3> &positions,
+                        const std::vector<uint32_t> &indices, std::vector<Triangle> &triangles) const;
+    void rasterizeBand(uint32_t band);
+    void mergeTile(uint32_t tile, uint32_t coverage, float depth);
+
+private:
+    uint32_t m_tilesX, m_tilesY;
+    // per tile, structure of arrays so that box tests load 4 tiles at once:
+    // zMax0 is the reference layer covering the whole tile, zMax1 the
+    // working layer covering the samples in mask
+    std::vector<float> m_zMax0, m_zMax1;
+    std::vector<uint32_t> m_mask;
+    std::vector<std::vector<Triangle> > m_triangles;
+    ThreadPool m_pool;
+    SoftwareOcclusionStats m_stats;
+};
+
+// CPU copy of a LOD for use as a static occluder, decoded and placed with
+// the model's Transform
+void SetOccluderGeometry(ModelDrawable &model, const PackedMeshView &view, uint32_t lod = 0);
+
+} // namespace util
+
+#endif // _SOFTWAREOCCLUSION_H_
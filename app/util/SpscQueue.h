@@ -0,0 +1,59 @@
+#ifndef _SPSCQUEUE_H_
+#define _SPSCQUEUE_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace util {
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Head and tail live on their own cache lines, each side only writes its
+// own index and reads the other's with acquire ordering.
+template <typename T, uint32_t Capacity>
+class SpscQueue {
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "capacity must be a power of two");
+
+public:
+    SpscQueue() : m_head(0), m_tail(0) {}
+
+    // producer, false when full
+    bool push(const T &value) {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        m_items[tail & (Capacity - 1)] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer, false when empty
+    bool pop(T &value) {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = m_items[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // a snapshot, exact only on the consumer side when nothing is pushed
+    uint32_t size() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+private:
+    static const size_t CACHE_LINE = 64;
+
+    std::atomic<uint32_t> m_head;
+    char m_headPad[CACHE_LINE - sizeof (std::atomic<uint32_t>)];
+    std::atomic<uint32_t> m_tail;
+    char m_tailPad[CACHE_LINE - sizeof (std::atomic<uint32_t>)];
+    T m_items[Capacity];
+};
+
+} // namespace util
+
+#endif // _SPSCQUEUE_H_
@@ -0,0 +1,72 @@
+#ifndef _TEXTUREFORMAT_H_
+#define _TEXTUREFORMAT_H_
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+#include <GLES3/gl32.h>
+#else // edit mode
+#include <GL/gl.h>
+#endif
+
+namespace util {
+
+// Texture containers, KTX 1.1 and KTX 2.0 holding a 2D texture and its mip
+// chain. Levels are uploaded straight from the file, compressed ones with
+// glCompressedTexImage2D, so loading is a header check plus the upload.
+// Supercompressed KTX 2 (Basis Universal, zstd) needs a transcoder and is
+// rejected.
+
+// groups of internal formats a context may or may not sample
+enum TextureFamily {
+    TEXTURE_UNCOMPRESSED = 1,
+    // core in ES 3.0
+    TEXTURE_ETC2 = 2,
+    // GL_KHR_texture_compression_astc_ldr, core in ES 3.2
+    TEXTURE_ASTC = 4
+};
+
+// points into the container, no ownership
+struct TextureLevel {
+    const uint8_t *Data = nullptr;
+    size_t Size = 0;
+    int32_t Width = 0;
+    int32_t Height = 0;
+};
+
+struct TextureView {
+    GLenum InternalFormat = 0;
+    // pixel format and type of uncompressed data, 0 when compressed
+    GLenum Format = 0;
+    GLenum Type = 0;
+    int32_t Width = 0;
+    int32_t Height = 0;
+    // largest first
+    std::vector<TextureLevel> Levels;
+    // the container has level 0 only and asks for the rest to be generated
+    bool GenerateMipmaps = false;
+    // of uncompressed rows, KTX 1 pads them to 4 bytes and KTX 2 doesn't
+    GLint RowAlignment = 4;
+
+    bool isCompressed() const { return Format == 0; }
+};
+
+// either container version, told apart by the identifier
+bool ParseKtx(const uint8_t *data, size_t size, TextureView &view);
+
+// TextureFamily of an internal format, 0 if unknown
+uint32_t TextureFormatFamily(GLenum internalFormat);
+// bytes of one level without row padding, 0 for an unknown format
+size_t TextureLevelSize(GLenum internalFormat, int32_t width, int32_t height);
+// GPU memory of the whole mip chain, generated levels included
+size_t TextureMemorySize(const TextureView &view);
+
+// creates a GL_TEXTURE_2D with every level of the view and trilinear
+// filtering, needs a current context
+bool UploadTexture(const TextureView &view, GLuint &texture);
+
+} // namespace util
+
+#endif // _TEXTUREFORMAT_H_
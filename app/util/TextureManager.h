@@ -0,0 +1,104 @@
+#ifndef _TEXTUREMANAGER_H_
+#define _TEXTUREMANAGER_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "AssetHelper.h"
+#include "TextureFormat.h"
+
+namespace util {
+
+// a GL texture loaded from a KTX asset, Id stays 0 until it is uploaded
+class Texture {
+public:
+    Texture() {}
+    ~Texture();
+
+    bool isReady() const { return Id != 0; }
+
+    GLuint Id = 0;
+    GLenum InternalFormat = 0;
+    int32_t Width = 0;
+    int32_t Height = 0;
+    uint32_t Levels = 0;
+    // GPU memory of the resident levels
+    size_t Bytes = 0;
+    // the same levels as RGBA8, what the compression saves
+    size_t UncompressedBytes = 0;
+    // asset the texture was loaded from
+    std::string Asset;
+
+    // streaming, see TextureStreamer. Levels from BaseLevel on are on the
+    // GPU, Width, Height and Levels describe the whole chain.
+    uint32_t BaseLevel = 0;
+    // finest level asked for by the last frame that drew the texture
+    uint32_t WantedLevel = 0;
+    uint64_t LastUsed = 0;
+    // stays mapped so levels can be paged in again, null unless streamed
+    std::shared_ptr<AssetView> Source;
+    std::shared_ptr<TextureView> SourceView;
+
+private:
+    Texture(const Texture &);
+    Texture &operator=(const Texture &);
+};
+
+typedef std::shared_ptr<Texture> TexturePtr;
+
+// live textures, render thread
+struct TextureStats {
+    uint32_t Textures = 0;
+    size_t Bytes = 0;
+    size_t UncompressedBytes = 0;
+    // loaded uncompressed, no compressed variant the context samples
+    // was found
+    uint32_t Fallbacks = 0;
+    uint32_t Failed = 0;
+};
+
+// Loads textures through the AsyncLoader in the best format the context
+// samples. A texture name refers to a set of asset variants, tried in order:
+//   name.astc.ktx2, name.astc.ktx   ASTC, smallest at the same quality
+//   name.etc2.ktx2, name.etc2.ktx   ETC2, every ES 3.0 context
+//   name.ktx2, name.ktx             uncompressed, only when nothing else fits
+// A name with a .ktx or .ktx2 extension is loaded as is. Textures are shared
+// by name while someone holds them. With a TextureStreamer budget, textures
+// with a mip chain only get their small levels and are streamed from there.
+class TextureManager {
+public:
+    static TextureManager *Get();
+
+    // call once per context, formats = the TextureFamily bits it samples
+    void init(uint32_t formats);
+    uint32_t formats() const { return m_formats; }
+    // the family textures are loaded in when all variants exist
+    uint32_t preferredFamily() const;
+
+    // render thread, the texture is uploaded by AsyncLoader::drainUploads()
+    TexturePtr load(const std::string &name);
+    // deletes every texture, their holders keep empty ones; before the
+    // context goes away
+    void clear();
+
+    // walks the live textures
+    TextureStats stats();
+
+private:
+    TextureManager();
+    void upload(const std::weak_ptr<Texture> &texture, const std::shared_ptr<AssetView> &file,
+                const std::shared_ptr<TextureView> &view, const std::string &asset);
+
+private:
+    uint32_t m_formats;
+    std::unordered_map<std::string, std::weak_ptr<Texture> > m_textures;
+    uint32_t m_fallbacks;
+    uint32_t m_failed;
+};
+
+} // namespace util
+
+#endif // _TEXTUREMANAGER_H_
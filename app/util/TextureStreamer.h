@@ -0,0 +1,108 @@
+#ifndef _TEXTURESTREAMER_H_
+#define _TEXTURESTREAMER_H_
+
+#include <memory>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FrameRingAllocator.h"
+#include "TextureManager.h"
+
+namespace util {
+
+struct TextureStreamingStats {
+    uint32_t Textures = 0;
+    size_t ResidentBytes = 0;
+    size_t Budget = 0;
+    // levels short of what the last frame asked for
+    uint32_t MissingLevels = 0;
+    uint32_t PageIns = 0;       // total
+    uint32_t Evictions = 0;     // total
+    size_t UploadedBytes = 0;   // total
+    // levels larger than a staging region, uploaded from the mapped file
+    uint32_t DirectUploads = 0; // total
+};
+
+// Keeps the mip chains of streamed textures within a GPU memory budget.
+// The small levels, up to the tail size, are always resident. The renderer
+// reports the screen size of every texture it draws, and after the frame
+// update() pages in one finer level of the textures that need one, as
+// long as the budget allows. When it doesn't, the levels finer than asked
+// for are evicted first, then the textures the longest undrawn.
+//
+// Changing the resident levels makes a new texture from the mapped source.
+// The levels are staged in a FrameRingAllocator used as a pixel unpack
+// buffer, so the copy happens on the GPU and a region is only reused once
+// its fence has passed. The ring is only created for the first texture
+// added while streaming is on, or levels to page in.
+class TextureStreamer {
+public:
+    static TextureStreamer *Get();
+
+    // GPU bytes of all streamed textures, 0 keeps every level of every
+    // texture resident and turns streaming off
+    void setBudget(size_t bytes) { m_baseBudget = m_budget = bytes; }
+    // in effect, the one set scaled by memory pressure
+    size_t budget() const { return m_budget; }
+    bool isEnabled() const { return m_budget > 0; }
+    // memory pressure, the budget becomes the one set times scale and is
+    // evicted down to right away, 1 restores it; false with streaming off
+    bool setBudgetScale(float scale);
+    // memory pressure, drops the levels finer than the last frame drew and
+    // the staging buffer unless levels are still to page in
+    void dropUnrequested();
+    // memory pressure, also drops the textures the last frame didn't draw
+    // down to their tail
+    void dropHidden();
+    // staged per frame, larger levels are uploaded directly; before init()
+    void setUploadBudget(size_t bytes) { m_uploadBudget = bytes; }
+    // levels with both sides at most this size are never evicted
+    void setTailSize(int32_t pixels) { m_tailSize = pixels; }
+
+    // needs a current context
+    bool init();
+    void release();
+
+    // from TextureManager, uploads the tail of a texture with Source set
+    bool add(const TexturePtr &texture);
+    // while drawing, the texture covers about screenSize pixels along its
+    // longer side
+    void request(Texture &texture, float screenSize);
+    // once per frame after the draws
+    void update();
+    // levels still to page in, another frame would make progress
+    bool hasPendingWork() const { return m_pending; }
+
+    TextureStreamingStats stats() const;
+
+private:
+    TextureStreamer();
+    uint32_t tailLevel(const Texture &texture) const;
+    // GPU bytes of the levels from base on
+    size_t chainSize(const Texture &texture, uint32_t base) const;
+    // a new texture holding the levels from base on
+    bool rebuild(Texture &texture, uint32_t base);
+    // creates the staging ring if streaming is on, false without one
+    bool stage();
+    // drops levels until the resident size is within target; only
+    // textures last drawn before the frame lose levels they were asked for
+    size_t evict(size_t resident, size_t target, uint64_t before);
+    size_t residentBytes() const;
+
+private:
+    size_t m_baseBudget;
+    size_t m_budget;
+    size_t m_uploadBudget;
+    int32_t m_tailSize;
+    // frames, update() ends one
+    uint64_t m_frame;
+    bool m_pending;
+    std::vector<std::weak_ptr<Texture> > m_textures;
+    FrameRingAllocator m_staging;
+    TextureStreamingStats m_stats;
+};
+
+} // namespace util
+
+#endif // _TEXTURESTREAMER_H_
@@ -0,0 +1,46 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+namespace util {
+
+// Persistent workers for per-frame data parallel work. parallelFor() hands
+// out indices to the workers and the calling thread and returns when all of
+// them are done, so it can be used from the render loop without spawning
+// threads every frame.
+class ThreadPool {
+public:
+    // threads = 0 uses all cores, the caller counts as one of them
+    explicit ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)> &task);
+    unsigned int threadCount() const { return m_workers.size() + 1; }
+
+private:
+    void workerLoop();
+    void runTasks();
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(uint32_t)> *m_task;
+    uint32_t m_count;
+    std::atomic<uint32_t> m_next;
+    uint32_t m_generation;
+    uint32_t m_busy;
+    bool m_quit;
+};
+
+} // namespace util
+
+#endif // _THREADPOOL_H_
@@ -2,10 +2,86 @@
 #ifdef __ANDROID__
 #include <android/asset_manager.h>
 #endif
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
 #include "LogUtil.h"
 
 namespace util {
 
+// map [offset, offset + length) of fd, offset need not be page aligned
+static bool mapRegion(int fd, off_t offset, size_t length,
+                      const uint8_t *&data, void *&map, size_t &mapSize) {
+    // mmap refuses empty ranges, an empty file is still a valid view
+    if (length == 0) {
+        static const uint8_t empty = 0;
+        data = &empty;
+        map = nullptr;
+        mapSize = 0;
+        return true;
+    }
+    off_t pageSize = sysconf(_SC_PAGESIZE);
+    off_t alignedOffset = offset - (offset % pageSize);
+    size_t delta = (size_t)(offset - alignedOffset);
+    void *ptr = mmap(nullptr, length + delta, PROT_READ, MAP_PRIVATE, fd, alignedOffset);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    map = ptr;
+    mapSize = length + delta;
+    data = static_cast<const uint8_t *>(ptr) + delta;
+    return true;
+}
+
+AssetView::AssetView() :
+    m_data(nullptr), m_size(0), m_map(nullptr), m_mapSize(0), m_asset(nullptr) {
+}
+
+AssetView::~AssetView() {
+    reset();
+}
+
+AssetView::AssetView(AssetView &&other) :
+    m_data(other.m_data), m_size(other.m_size), m_map(other.m_map),
+    m_mapSize(other.m_mapSize), m_asset(other.m_asset) {
+    other.m_data = nullptr;
+    other.m_size = 0;
+    other.m_map = nullptr;
+    other.m_mapSize = 0;
+    other.m_asset = nullptr;
+}
+
+AssetView &AssetView::operator=(AssetView &&other) {
+    if (this != &other) {
+        reset();
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_map, other.m_map);
+        std::swap(m_mapSize, other.m_mapSize);
+        std::swap(m_asset, other.m_asset);
+    }
+    return *this;
+}
+
+void AssetView::reset() {
+    if (m_map) {
+        munmap(m_map, m_mapSize);
+    }
+#ifdef __ANDROID__
+    if (m_asset) {
+        AAsset_close(m_asset);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_asset = nullptr;
+}
+
 AssetHelper *AssetHelper::Get() {
     static AssetHelper helper;
     return &helper;
@@ -15,12 +91,21 @@ void AssetHelper::Init(AAssetManager *mgr) {
     m_aassetMgr = mgr;
 }
 
+#ifdef QVIEWER_HOST
+void AssetHelper::Init(const std::string &rootDir) {
+    m_rootDir = rootDir;
+    if (!m_rootDir.empty() && m_rootDir[m_rootDir.size() - 1] != '/') {
+        m_rootDir.append("/");
+    }
+}
+#endif
+
 bool AssetHelper::AssetReadFile(const std::string &name, std::vector<uint8_t> &buf)
 {
+#ifdef __ANDROID__
     if (name.empty() || !m_aassetMgr) {
         return false;
     }
-#ifdef __ANDROID__
     AAsset *asset_dsc = AAssetManager_open(m_aassetMgr, name.c_str(), AASSET_MODE_BUFFER);
     if (!asset_dsc) {
         return false;
@@ -32,6 +117,78 @@ bool AssetHelper::AssetReadFile(const std::string &name, std::vector<uint8_t> &b
 
     AAsset_close(asset_dsc);
     return (read_size == buf.size());
+#else
+    if (name.empty()) {
+        return false;
+    }
+    FILE *file = fopen((m_rootDir + name).c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    buf.resize(file_len > 0 ? file_len : 0);
+    std::size_t read_size = fread(buf.data(), 1, buf.size(), file);
+
+    fclose(file);
+    return (read_size == buf.size());
+#endif
+}
+
+bool AssetHelper::AssetOpenView(const std::string &name, AssetView &view)
+{
+    view.reset();
+#ifdef __ANDROID__
+    if (name.empty() || !m_aassetMgr) {
+        return false;
+    }
+    AAsset *asset_dsc = AAssetManager_open(m_aassetMgr, name.c_str(), AASSET_MODE_STREAMING);
+    if (!asset_dsc) {
+        return false;
+    }
+
+    // stored (uncompressed) assets are a plain range of the apk, map it
+    off64_t start = 0, length = 0;
+    int fd = AAsset_openFileDescriptor64(asset_dsc, &start, &length);
+    if (fd >= 0) {
+        bool mapped = mapRegion(fd, start, (size_t)length, view.m_data, view.m_map,
+                                view.m_mapSize);
+        close(fd);
+        if (mapped) {
+            view.m_size = (size_t)length;
+            AAsset_close(asset_dsc);
+            return true;
+        }
+    }
+
+    // compressed, the asset keeps its inflated buffer alive until closed
+    const void *buffer = AAsset_getBuffer(asset_dsc);
+    if (!buffer) {
+        AAsset_close(asset_dsc);
+        return false;
+    }
+    view.m_data = static_cast<const uint8_t *>(buffer);
+    view.m_size = (size_t)AAsset_getLength64(asset_dsc);
+    view.m_asset = asset_dsc;
+    return true;
+#else
+    if (name.empty()) {
+        return false;
+    }
+    int fd = open((m_rootDir + name).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    bool mapped = fstat(fd, &st) == 0 &&
+            mapRegion(fd, 0, (size_t)st.st_size, view.m_data, view.m_map, view.m_mapSize);
+    close(fd);
+    if (mapped) {
+        view.m_size = (size_t)st.st_size;
+    }
+    return mapped;
 #endif
 }
 
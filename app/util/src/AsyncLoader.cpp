@@ -0,0 +1,124 @@
+#include "AsyncLoader.h"
+
+#include <chrono>
+
+namespace util {
+
+AsyncLoader *AsyncLoader::Get() {
+    static AsyncLoader loader;
+    return &loader;
+}
+
+AsyncLoader::AsyncLoader() :
+    m_generation(0), m_pending(0), m_quit(false) {
+    // leave one core to the render thread
+    unsigned int count = std::thread::hardware_concurrency();
+    count = count > 2 ? count - 1 : 1;
+    for (unsigned int i = 0; i < count; ++i) {
+        m_workers.push_back(std::thread(&AsyncLoader::workerLoop, this));
+    }
+}
+
+AsyncLoader::~AsyncLoader() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_all();
+    for (auto &worker : m_workers) {
+        worker.join();
+    }
+}
+
+void AsyncLoader::submit(const WorkTask &work) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Job job = { m_generation, work };
+        m_jobs.push_back(job);
+        m_pending++;
+    }
+    m_condition.notify_one();
+}
+
+uint32_t AsyncLoader::drainUploads(double budgetMs) {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t count = 0;
+    while (true) {
+        Completion completion;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_completions.empty()) {
+                break;
+            }
+            completion = m_completions.front();
+            m_completions.pop_front();
+            m_pending--;
+        }
+        if (completion.upload) {
+            completion.upload();
+        }
+        count++;
+
+        // always make progress, then stop once the budget is spent
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() >= budgetMs) {
+            break;
+        }
+    }
+    return count;
+}
+
+void AsyncLoader::cancelAll() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // results of jobs already running are dropped when they complete
+    m_generation++;
+    m_pending -= m_jobs.size() + m_completions.size();
+    m_jobs.clear();
+    m_completions.clear();
+}
+
+uint32_t AsyncLoader::pendingCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pending;
+}
+
+bool AsyncLoader::hasUploads() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_completions.empty();
+}
+
+void AsyncLoader::setUploadListener(const std::function<void()> &listener) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_uploadListener = listener;
+}
+
+void AsyncLoader::workerLoop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_quit || !m_jobs.empty(); });
+            if (m_quit) {
+                return;
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        UploadTask upload = job.work();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (job.generation == m_generation) {
+            Completion completion = { job.generation, upload };
+            m_completions.push_back(completion);
+            // under the lock, so that nobody still calls a listener once it is replaced
+            if (m_uploadListener) {
+                m_uploadListener();
+            }
+        } else {
+            m_pending--;
+        }
+    }
+}
+
+} // namespace util
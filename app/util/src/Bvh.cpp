@@ -0,0 +1,440 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <math.h>
+
+#include "FrustumCuller.h"
+
+namespace util {
+
+namespace {
+
+const uint32_t BINS = 16;
+// never split at or below this size
+const uint32_t MIN_LEAF_SIZE = 2;
+// SAH may stop splitting up to this size
+const uint32_t MAX_LEAF_SIZE = 8;
+// median splits from here on, keeps the depth within the traversal stacks
+const uint32_t MAX_SAH_DEPTH = 32;
+const uint32_t STACK_SIZE = 128;
+// below this the build stays on the calling thread
+const uint32_t PARALLEL_BUILD_SIZE = 4096;
+
+struct BuildTask {
+    uint32_t node, first, count, depth;
+};
+
+// partitioned by value, so that the passes over a node read memory in order
+struct BuildPrimitive {
+    glm::vec3 center, extent;
+    uint32_t id;
+};
+
+struct Builder {
+    std::vector<BvhNode> &nodes;
+    std::vector<BuildPrimitive> &primitives;
+    std::atomic<uint32_t> nodeCount;
+
+    Builder(std::vector<BvhNode> &n, std::vector<BuildPrimitive> &p) :
+        nodes(n), primitives(p), nodeCount(1) {
+    }
+};
+
+struct Bin {
+    glm::vec3 min, max;
+    uint32_t count;
+};
+
+inline float halfArea(const glm::vec3 &min, const glm::vec3 &max) {
+    glm::vec3 d = max - min;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+inline uint32_t binIndex(float c, float lo, float scale) {
+    return std::min(BINS - 1, (uint32_t)((c - lo) * scale));
+}
+
+// Builds the node of task, and its subtree unless it is small enough to be
+// deferred to the parallel phase
+void subdivide(Builder &b, const BuildTask &task, std::vector<BuildTask> *deferred, uint32_t deferBelow) {
+    if (deferred && task.count <= deferBelow) {
+        deferred->push_back(task);
+        return;
+    }
+    BuildPrimitive *begin = &b.primitives[task.first], *end = begin + task.count;
+    glm::vec3 min(FLT_MAX), max(-FLT_MAX), cmin(FLT_MAX), cmax(-FLT_MAX);
+    for (BuildPrimitive *p = begin; p != end; ++p) {
+        const glm::vec3 &c = p->center, &e = p->extent;
+        min = glm::min(min, c - e);
+        max = glm::max(max, c + e);
+        cmin = glm::min(cmin, c);
+        cmax = glm::max(cmax, c);
+    }
+    BvhNode &node = b.nodes[task.node];
+    node.Min = min;
+    node.Max = max;
+    node.First = task.first;
+    node.Count = task.count;
+    if (task.count <= MIN_LEAF_SIZE) {
+        return;
+    }
+
+    // binned SAH over all three axes, cost of a split is
+    // countLeft * areaLeft + countRight * areaRight
+    int axis = -1;
+    uint32_t split = 0;
+    float bestCost = FLT_MAX;
+    if (task.depth < MAX_SAH_DEPTH) {
+        // one pass fills the bins of all three axes
+        Bin bins[3][BINS];
+        float scale[3];
+        for (int a = 0; a < 3; ++a) {
+            float range = cmax[a] - cmin[a];
+            scale[a] = range > 0.0f ? BINS / range : 0.0f;
+            for (auto &bin : bins[a]) {
+                bin.min = glm::vec3(FLT_MAX);
+                bin.max = glm::vec3(-FLT_MAX);
+                bin.count = 0;
+            }
+        }
+        for (BuildPrimitive *p = begin; p != end; ++p) {
+            glm::vec3 pmin = p->center - p->extent, pmax = p->center + p->extent;
+            for (int a = 0; a < 3; ++a) {
+                Bin &bin = bins[a][binIndex(p->center[a], cmin[a], scale[a])];
+                bin.min = glm::min(bin.min, pmin);
+                bin.max = glm::max(bin.max, pmax);
+                bin.count++;
+            }
+        }
+
+        for (int a = 0; a < 3; ++a) {
+            if (scale[a] == 0.0f) {
+                continue;
+            }
+            float rightArea[BINS];
+            uint32_t rightCount[BINS];
+            glm::vec3 rmin(FLT_MAX), rmax(-FLT_MAX);
+            uint32_t count = 0;
+            for (uint32_t i = BINS - 1; i > 0; --i) {
+                rmin = glm::min(rmin, bins[a][i].min);
+                rmax = glm::max(rmax, bins[a][i].max);
+                count += bins[a][i].count;
+                rightArea[i] = halfArea(rmin, rmax);
+                rightCount[i] = count;
+            }
+            glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX);
+            count = 0;
+            for (uint32_t i = 0; i + 1 < BINS; ++i) {
+                lmin = glm::min(lmin, bins[a][i].min);
+                lmax = glm::max(lmax, bins[a][i].max);
+                count += bins[a][i].count;
+                if (!count || !rightCount[i + 1]) {
+                    continue;
+                }
+                float cost = count * halfArea(lmin, lmax) + rightCount[i + 1] * rightArea[i + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    axis = a;
+                    split = i;
+                }
+            }
+        }
+    }
+
+    // one traversal step against intersecting every primitive
+    float area = halfArea(min, max);
+    if (task.count <= MAX_LEAF_SIZE && (axis < 0 || area <= 0.0f || 1.0f + bestCost / area >= task.count)) {
+        return;
+    }
+    BuildPrimitive *mid = begin;
+    if (axis >= 0) {
+        float lo = cmin[axis], scale = BINS / (cmax[axis] - lo);
+        mid = std::partition(begin, end, [&](const BuildPrimitive &p) {
+            return binIndex(p.center[axis], lo, scale) <= split;
+        });
+    }
+    if (mid == begin || mid == end) {
+        // too deep or all centers in one place, split at the median
+        glm::vec3 range = cmax - cmin;
+        int a = range.x >= range.y && range.x >= range.z ? 0 : (range.y >= range.z ? 1 : 2);
+        mid = begin + task.count / 2;
+        std::nth_element(begin, mid, end, [&](const BuildPrimitive &l, const BuildPrimitive &r) {
+            return l.center[a] < r.center[a];
+        });
+    }
+
+    uint32_t children = b.nodeCount.fetch_add(2);
+    node.First = children;
+    node.Count = 0;
+    uint32_t leftCount = mid - begin;
+    BuildTask left = { children, task.first, leftCount, task.depth + 1 };
+    BuildTask right = { children + 1, task.first + leftCount, task.count - leftCount, task.depth + 1 };
+    subdivide(b, left, deferred, deferBelow);
+    subdivide(b, right, deferred, deferBelow);
+}
+
+// entry distance of the ray into the box, FLT_MAX if it misses within tMax
+inline float intersectBox(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &origin,
+        const glm::vec3 &invDirection, float tMax) {
+    float tNear = 0.0f, tFar = tMax;
+    for (int a = 0; a < 3; ++a) {
+        float t0 = (min[a] - origin[a]) * invDirection[a];
+        float t1 = (max[a] - origin[a]) * invDirection[a];
+        tNear = std::max(tNear, std::min(t0, t1));
+        tFar = std::min(tFar, std::max(t0, t1));
+    }
+    return tNear <= tFar ? tNear : FLT_MAX;
+}
+
+} // namespace
+
+Bvh::Bvh() {
+}
+
+void Bvh::clear() {
+    m_nodes.clear();
+    m_ids.clear();
+    m_centers.clear();
+    m_extents.clear();
+}
+
+void Bvh::build(const std::vector<glm::vec3> &centers, const std::vector<glm::vec3> &extents, ThreadPool *pool) {
+    clear();
+    uint32_t count = centers.size();
+    if (!count) {
+        return;
+    }
+    std::vector<BuildPrimitive> primitives(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        primitives[i].center = centers[i];
+        primitives[i].extent = extents[i];
+        primitives[i].id = i;
+    }
+    // a binary tree with at least one primitive per leaf
+    std::vector<BvhNode> nodes(2 * count);
+    Builder builder(nodes, primitives);
+    BuildTask root = { 0, 0, count, 0 };
+    if (pool && pool->threadCount() > 1 && count > PARALLEL_BUILD_SIZE) {
+        // top levels on this thread until there are a few subtrees per thread
+        std::vector<BuildTask> deferred;
+        uint32_t deferBelow = std::max<uint32_t>(PARALLEL_BUILD_SIZE / 4, count / (pool->threadCount() * 8));
+        subdivide(builder, root, &deferred, deferBelow);
+        pool->parallelFor(deferred.size(), [&](uint32_t i) {
+            subdivide(builder, deferred[i], nullptr, 0);
+        });
+    } else {
+        subdivide(builder, root, nullptr, 0);
+    }
+
+    // subtrees were allocated by whichever thread built them, lay the nodes
+    // out depth first so that a subtree is contiguous
+    m_nodes.reserve(builder.nodeCount);
+    m_nodes.push_back(nodes[0]);
+    std::vector<std::pair<uint32_t, uint32_t> > stack(1, std::make_pair(0u, 0u));
+    while (!stack.empty()) {
+        uint32_t source = stack.back().first, target = stack.back().second;
+        stack.pop_back();
+        if (m_nodes[target].Count) {
+            continue;
+        }
+        uint32_t left = nodes[source].First, children = m_nodes.size();
+        m_nodes[target].First = children;
+        m_nodes.push_back(nodes[left]);
+        m_nodes.push_back(nodes[left + 1]);
+        stack.push_back(std::make_pair(left + 1, children + 1));
+        stack.push_back(std::make_pair(left, children));
+    }
+
+    m_ids.resize(count);
+    m_centers.resize(count);
+    m_extents.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        m_ids[i] = primitives[i].id;
+        m_centers[i] = primitives[i].center;
+        m_extents[i] = primitives[i].extent;
+    }
+}
+
+void Bvh::refit(const std::vector<glm::vec3> &centers, const std::vector<glm::vec3> &extents) {
+    for (uint32_t i = 0; i < m_ids.size(); ++i) {
+        m_centers[i] = centers[m_ids[i]];
+        m_extents[i] = extents[m_ids[i]];
+    }
+    // children are stored after their parent
+    for (uint32_t i = m_nodes.size(); i-- > 0;) {
+        BvhNode &node = m_nodes[i];
+        if (node.Count) {
+            node.Min = glm::vec3(FLT_MAX);
+            node.Max = glm::vec3(-FLT_MAX);
+            for (uint32_t k = node.First; k < node.First + node.Count; ++k) {
+                node.Min = glm::min(node.Min, m_centers[k] - m_extents[k]);
+                node.Max = glm::max(node.Max, m_centers[k] + m_extents[k]);
+            }
+        } else {
+            const BvhNode &left = m_nodes[node.First], &right = m_nodes[node.First + 1];
+            node.Min = glm::min(left.Min, right.Min);
+            node.Max = glm::max(left.Max, right.Max);
+        }
+    }
+}
+
+uint32_t Bvh::cull(const glm::mat4 &viewProjection, std::vector<uint32_t> &visible) const {
+    visible.clear();
+    if (m_nodes.empty()) {
+        return 0;
+    }
+    float planes[6][4];
+    FrustumCuller::extractPlanes(viewProjection, planes);
+
+    // bit p set while plane p still has to be tested
+    struct Entry {
+        uint32_t node, planes;
+    } stack[STACK_SIZE];
+    uint32_t top = 0;
+    stack[top++] = { 0, 0x3f };
+    while (top) {
+        Entry entry = stack[--top];
+        const BvhNode &node = m_nodes[entry.node];
+        glm::vec3 center = (node.Min + node.Max) * 0.5f, extent = (node.Max - node.Min) * 0.5f;
+        uint32_t mask = entry.planes;
+        bool outside = false;
+        for (int p = 0; p < 6 && !outside; ++p) {
+            if (!(mask & (1u << p))) {
+                continue;
+            }
+            float d = planes[p][0] * center.x + planes[p][1] * center.y + planes[p][2] * center.z + planes[p][3];
+            float r = fabsf(planes[p][0]) * extent.x + fabsf(planes[p][1]) * extent.y +
+                    fabsf(planes[p][2]) * extent.z;
+            outside = d + r < 0.0f;
+            if (d - r >= 0.0f) {
+                mask &= ~(1u << p);
+            }
+        }
+        if (outside) {
+            continue;
+        }
+        if (!node.Count) {
+            stack[top++] = { node.First + 1, mask };
+            stack[top++] = { node.First, mask };
+            continue;
+        }
+        for (uint32_t k = node.First; k < node.First + node.Count; ++k) {
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; ++p) {
+                if (mask & (1u << p)) {
+                    const glm::vec3 &c = m_centers[k], &e = m_extents[k];
+                    inside = planes[p][0] * c.x + planes[p][1] * c.y + planes[p][2] * c.z + planes[p][3] +
+                            fabsf(planes[p][0]) * e.x + fabsf(planes[p][1]) * e.y +
+                            fabsf(planes[p][2]) * e.z >= 0.0f;
+                }
+            }
+            if (inside) {
+                visible.push_back(m_ids[k]);
+            }
+        }
+    }
+    return visible.size();
+}
+
+uint32_t Bvh::intersect(const glm::vec3 &origin, const glm::vec3 &direction, float &tMax,
+        const std::function<bool(uint32_t, float &)> &hit) const {
+    uint32_t closest = ~0u;
+    if (m_nodes.empty()) {
+        return closest;
+    }
+    // divisions by zero give infinities, which the slab test handles
+    glm::vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    struct Entry {
+        uint32_t node;
+        float t;
+    } stack[STACK_SIZE];
+    uint32_t top = 0;
+    float t = intersectBox(m_nodes[0].Min, m_nodes[0].Max, origin, invDirection, tMax);
+    if (t != FLT_MAX) {
+        stack[top++] = { 0, t };
+    }
+    while (top) {
+        Entry entry = stack[--top];
+        // a closer hit was found since it was pushed
+        if (entry.t > tMax) {
+            continue;
+        }
+        const BvhNode &node = m_nodes[entry.node];
+        if (node.Count) {
+            for (uint32_t k = node.First; k < node.First + node.Count; ++k) {
+                if (intersectBox(m_centers[k] - m_extents[k], m_centers[k] + m_extents[k], origin,
+                                 invDirection, tMax) != FLT_MAX && hit(m_ids[k], tMax)) {
+                    closest = m_ids[k];
+                }
+            }
+            continue;
+        }
+        const BvhNode &left = m_nodes[node.First], &right = m_nodes[node.First + 1];
+        float tLeft = intersectBox(left.Min, left.Max, origin, invDirection, tMax);
+        float tRight = intersectBox(right.Min, right.Max, origin, invDirection, tMax);
+        // the nearer child is popped first
+        Entry near = { node.First, tLeft }, far = { node.First + 1, tRight };
+        if (tRight < tLeft) {
+            std::swap(near, far);
+        }
+        if (far.t != FLT_MAX) {
+            stack[top++] = far;
+        }
+        if (near.t != FLT_MAX) {
+            stack[top++] = near;
+        }
+    }
+    return closest;
+}
+
+void TriangleBvh::build(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+        ThreadPool *pool) {
+    m_positions = positions;
+    m_indices = indices;
+    uint32_t count = indices.size() / 3;
+    std::vector<glm::vec3> centers(count), extents(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        const glm::vec3 &v0 = positions[indices[i * 3]], &v1 = positions[indices[i * 3 + 1]];
+        const glm::vec3 &v2 = positions[indices[i * 3 + 2]];
+        glm::vec3 min = glm::min(v0, glm::min(v1, v2)), max = glm::max(v0, glm::max(v1, v2));
+        centers[i] = (min + max) * 0.5f;
+        extents[i] = (max - min) * 0.5f;
+    }
+    m_bvh.build(centers, extents, pool);
+}
+
+bool TriangleBvh::intersect(const glm::vec3 &origin, const glm::vec3 &direction, float &t,
+        uint32_t &triangle) const {
+    // Moller-Trumbore
+    triangle = m_bvh.intersect(origin, direction, t, [&](uint32_t i, float &tMax) {
+        const glm::vec3 &v0 = m_positions[m_indices[i * 3]];
+        glm::vec3 e1 = m_positions[m_indices[i * 3 + 1]] - v0, e2 = m_positions[m_indices[i * 3 + 2]] - v0;
+        glm::vec3 p = glm::cross(direction, e2);
+        float det = glm::dot(e1, p);
+        if (det == 0.0f) {
+            return false;
+        }
+        float inv = 1.0f / det;
+        glm::vec3 s = origin - v0;
+        float u = glm::dot(s, p) * inv;
+        if (u < 0.0f || u > 1.0f) {
+            return false;
+        }
+        glm::vec3 q = glm::cross(s, e1);
+        float v = glm::dot(direction, q) * inv;
+        if (v < 0.0f || u + v > 1.0f) {
+            return false;
+        }
+        float d = glm::dot(e2, q) * inv;
+        if (d < 0.0f || d >= tMax) {
+            return false;
+        }
+        tMax = d;
+        return true;
+    });
+    return triangle != ~0u;
+}
+
+} // namespace util
@@ -0,0 +1,176 @@
+#include "FrameRingAllocator.h"
+
+#include <chrono>
+
+#include "GLStateCache.h"
+#include "LogUtil.h"
+
+namespace util {
+
+FrameRingAllocator::FrameRingAllocator() :
+    m_buffer(0), m_regionSize(0), m_uniformAlignment(256), m_region(0), m_head(0), m_mapStart(0),
+    m_mapped(nullptr), m_inFrame(false), m_allocations(0), m_failed(0) {
+}
+
+FrameRingAllocator::~FrameRingAllocator() {
+    release();
+}
+
+bool FrameRingAllocator::init(GLsizeiptr regionSize, uint32_t framesInFlight) {
+    release();
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    m_uniformAlignment = alignment > 0 ? alignment : 256;
+    m_fences.assign(framesInFlight ? framesInFlight : 1, nullptr);
+    glGenBuffers(1, &m_buffer);
+    allocateBuffer(regionSize);
+    m_region = 0;
+    return m_buffer != 0;
+}
+
+void FrameRingAllocator::release() {
+    if (m_mapped) {
+        flush();
+    }
+    for (auto &fence : m_fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (m_buffer) {
+        GLStateCache::Current()->deleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+    }
+    m_inFrame = false;
+}
+
+// orphans the old storage, the driver frees it once the GPU is done with it
+void FrameRingAllocator::allocateBuffer(GLsizeiptr regionSize) {
+    m_regionSize = (regionSize + m_uniformAlignment - 1) / m_uniformAlignment * m_uniformAlignment;
+    GLStateCache *state = GLStateCache::Current();
+    state->bindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, m_regionSize * m_fences.size(), nullptr, GL_STREAM_DRAW);
+    state->memory()->track(GpuMemory::BUFFER, m_buffer, GPU_MEMORY_STREAMING, m_regionSize * m_fences.size());
+    state->bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    // fences guard the old storage only
+    for (auto &fence : m_fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    m_stats.RegionSize = m_regionSize;
+}
+
+void FrameRingAllocator::waitFence(uint32_t region) {
+    GLsync &fence = m_fences[region];
+    if (!fence) {
+        return;
+    }
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        // the GPU is framesInFlight frames behind, nothing left but to wait
+        auto start = std::chrono::steady_clock::now();
+        do {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        } while (result == GL_TIMEOUT_EXPIRED);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        m_stats.Stalls++;
+        m_stats.StallMs += elapsed.count();
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void FrameRingAllocator::beginFrame(GLsizeiptr minimumSize) {
+    if (!m_buffer) {
+        return;
+    }
+    if (m_inFrame) {
+        endFrame();
+    }
+    m_region = (m_region + 1) % m_fences.size();
+    if (minimumSize > m_regionSize) {
+        allocateBuffer(minimumSize + minimumSize / 2);
+        m_stats.Grows++;
+    }
+    waitFence(m_region);
+    m_head = 0;
+    m_allocations = 0;
+    m_failed = 0;
+    m_inFrame = true;
+}
+
+bool FrameRingAllocator::map() {
+    // the fence of this region has passed, nothing on the GPU reads it
+    GLStateCache *state = GLStateCache::Current();
+    state->bindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    m_mapStart = m_head;
+    m_mapped = (uint8_t *)glMapBufferRange(GL_COPY_WRITE_BUFFER, m_region * m_regionSize + m_mapStart,
+            m_regionSize - m_mapStart, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+            GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+    state->bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (!m_mapped) {
+        ALOGE("Unable to map the frame ring!");
+        return false;
+    }
+    return true;
+}
+
+RingAllocation FrameRingAllocator::allocate(GLsizeiptr size, GLsizeiptr alignment) {
+    RingAllocation allocation;
+    GLsizeiptr offset = (m_head + alignment - 1) / alignment * alignment;
+    if (!m_inFrame || offset + size > m_regionSize) {
+        m_failed++;
+        return allocation;
+    }
+    if (!m_mapped) {
+        // a mapping starts where the last one ended, keep it aligned as well
+        m_head = offset;
+        if (!map()) {
+            m_failed++;
+            return allocation;
+        }
+    }
+    m_head = offset + size;
+    m_allocations++;
+    allocation.Buffer = m_buffer;
+    allocation.Offset = m_region * m_regionSize + offset;
+    allocation.Size = size;
+    allocation.Data = m_mapped + (offset - m_mapStart);
+    return allocation;
+}
+
+void FrameRingAllocator::flush() {
+    if (!m_mapped) {
+        return;
+    }
+    GLStateCache *state = GLStateCache::Current();
+    state->bindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    if (m_head > m_mapStart) {
+        glFlushMappedBufferRange(GL_COPY_WRITE_BUFFER, 0, m_head - m_mapStart);
+    }
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    state->bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_mapped = nullptr;
+}
+
+void FrameRingAllocator::endFrame() {
+    if (!m_inFrame) {
+        return;
+    }
+    flush();
+    m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_stats.Used = m_head;
+    m_stats.Allocations = m_allocations;
+    m_stats.Failed = m_failed;
+    m_inFrame = false;
+}
+
+void FrameRingAllocator::bindUniform(GLuint binding, const RingAllocation &allocation) const {
+    GLStateCache::Current()->bindBufferRange(GL_UNIFORM_BUFFER, binding, allocation.Buffer,
+            allocation.Offset, allocation.Size);
+}
+
+} // namespace util
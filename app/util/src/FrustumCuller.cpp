@@ -0,0 +1,208 @@
+#include "FrustumCuller.h"
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CULL_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CULL_NEON 1
+#endif
+
+namespace util {
+
+FrustumCuller::FrustumCuller() :
+    m_count(0) {
+}
+
+uint32_t FrustumCuller::add(const glm::vec3 &center, const glm::vec3 &extent) {
+    uint32_t id = m_count++;
+    if (m_centerX.size() < m_count) {
+        size_t padded = (m_count + 3) & ~3u;
+        m_centerX.resize(padded, 0.0f);
+        m_centerY.resize(padded, 0.0f);
+        m_centerZ.resize(padded, 0.0f);
+        m_extentX.resize(padded, 0.0f);
+        m_extentY.resize(padded, 0.0f);
+        m_extentZ.resize(padded, 0.0f);
+    }
+    update(id, center, extent);
+    return id;
+}
+
+void FrustumCuller::update(uint32_t id, const glm::vec3 &center, const glm::vec3 &extent) {
+    m_centerX[id] = center.x;
+    m_centerY[id] = center.y;
+    m_centerZ[id] = center.z;
+    m_extentX[id] = extent.x;
+    m_extentY[id] = extent.y;
+    m_extentZ[id] = extent.z;
+}
+
+void FrustumCuller::clear() {
+    m_count = 0;
+    m_centerX.clear();
+    m_centerY.clear();
+    m_centerZ.clear();
+    m_extentX.clear();
+    m_extentY.clear();
+    m_extentZ.clear();
+}
+
+// Gribb and Hartmann, planes are rows of the matrix added to or subtracted
+// from the w row; they don't need normalizing for an inside/outside test
+void FrustumCuller::extractPlanes(const glm::mat4 &m, float planes[6][4]) {
+    for (int c = 0; c < 4; ++c) {
+        planes[0][c] = m[c][3] + m[c][0];
+        planes[1][c] = m[c][3] - m[c][0];
+        planes[2][c] = m[c][3] + m[c][1];
+        planes[3][c] = m[c][3] - m[c][1];
+        planes[4][c] = m[c][3] + m[c][2];
+        planes[5][c] = m[c][3] - m[c][2];
+    }
+}
+
+const char *FrustumCuller::simdName() {
+#if defined(CULL_SSE)
+    return "sse2";
+#elif defined(CULL_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+uint32_t FrustumCuller::cullScalar(const glm::mat4 &viewProjection, std::vector<uint32_t> &visible) const {
+    float planes[6][4];
+    extractPlanes(viewProjection, planes);
+    visible.resize(m_count);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < m_count; ++i) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; ++p) {
+            // the box corner furthest along the plane normal
+            float d = planes[p][0] * m_centerX[i] + planes[p][1] * m_centerY[i] +
+                    planes[p][2] * m_centerZ[i] + planes[p][3] +
+                    fabsf(planes[p][0]) * m_extentX[i] + fabsf(planes[p][1]) * m_extentY[i] +
+                    fabsf(planes[p][2]) * m_extentZ[i];
+            inside = d >= 0.0f;
+        }
+        if (inside) {
+            visible[count++] = i;
+        }
+    }
+    visible.resize(count);
+    return count;
+}
+
+#if defined(CULL_SSE) || defined(CULL_NEON)
+// branchless compaction, every lane writes and only the visible ones advance
+static inline uint32_t appendVisible(uint32_t *out, uint32_t count, uint32_t first, uint32_t bits) {
+    for (uint32_t lane = 0; lane < 4; ++lane) {
+        out[count] = first + lane;
+        count += (bits >> lane) & 1;
+    }
+    return count;
+}
+#endif
+
+uint32_t FrustumCuller::cull(const glm::mat4 &viewProjection, std::vector<uint32_t> &visible) const {
+#if !defined(CULL_SSE) && !defined(CULL_NEON)
+    return cullScalar(viewProjection, visible);
+#else
+    float planes[6][4];
+    extractPlanes(viewProjection, planes);
+    // room for the 4 lanes of the last group
+    visible.resize(m_count + 4);
+    uint32_t *out = visible.data();
+    uint32_t count = 0;
+
+#if defined(CULL_SSE)
+    __m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (int p = 0; p < 6; ++p) {
+        nx[p] = _mm_set1_ps(planes[p][0]);
+        ny[p] = _mm_set1_ps(planes[p][1]);
+        nz[p] = _mm_set1_ps(planes[p][2]);
+        nw[p] = _mm_set1_ps(planes[p][3]);
+        ax[p] = _mm_set1_ps(fabsf(planes[p][0]));
+        ay[p] = _mm_set1_ps(fabsf(planes[p][1]));
+        az[p] = _mm_set1_ps(fabsf(planes[p][2]));
+    }
+    const __m128 zero = _mm_setzero_ps();
+    for (uint32_t i = 0; i < m_count; i += 4) {
+        __m128 cx = _mm_loadu_ps(&m_centerX[i]), cy = _mm_loadu_ps(&m_centerY[i]);
+        __m128 cz = _mm_loadu_ps(&m_centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&m_extentX[i]), ey = _mm_loadu_ps(&m_extentY[i]);
+        __m128 ez = _mm_loadu_ps(&m_extentZ[i]);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)),
+                                  _mm_add_ps(_mm_mul_ps(nz[p], cz), nw[p]));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)),
+                                  _mm_mul_ps(az[p], ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+        }
+        uint32_t bits = (uint32_t)_mm_movemask_ps(inside);
+        if (m_count - i < 4) {
+            bits &= (1u << (m_count - i)) - 1;
+        }
+        count = appendVisible(out, count, i, bits);
+    }
+#elif defined(CULL_NEON)
+    float32x4_t nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (int p = 0; p < 6; ++p) {
+        nx[p] = vdupq_n_f32(planes[p][0]);
+        ny[p] = vdupq_n_f32(planes[p][1]);
+        nz[p] = vdupq_n_f32(planes[p][2]);
+        nw[p] = vdupq_n_f32(planes[p][3]);
+        ax[p] = vdupq_n_f32(fabsf(planes[p][0]));
+        ay[p] = vdupq_n_f32(fabsf(planes[p][1]));
+        az[p] = vdupq_n_f32(fabsf(planes[p][2]));
+    }
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+    const uint32x4_t lanes = vld1q_u32(laneBits);
+    for (uint32_t i = 0; i < m_count; i += 4) {
+        float32x4_t cx = vld1q_f32(&m_centerX[i]), cy = vld1q_f32(&m_centerY[i]);
+        float32x4_t cz = vld1q_f32(&m_centerZ[i]);
+        float32x4_t ex = vld1q_f32(&m_extentX[i]), ey = vld1q_f32(&m_extentY[i]);
+        float32x4_t ez = vld1q_f32(&m_extentZ[i]);
+        uint32x4_t inside = vdupq_n_u32(0xffffffff);
+        for (int p = 0; p < 6; ++p) {
+            float32x4_t d = vmlaq_f32(vmlaq_f32(vmlaq_f32(nw[p], nx[p], cx), ny[p], cy), nz[p], cz);
+            d = vmlaq_f32(vmlaq_f32(vmlaq_f32(d, ax[p], ex), ay[p], ey), az[p], ez);
+            inside = vandq_u32(inside, vcgeq_f32(d, zero));
+        }
+        uint32x4_t masked = vandq_u32(inside, lanes);
+#if defined(__aarch64__)
+        uint32_t bits = vaddvq_u32(masked);
+#else
+        uint32x2_t pair = vadd_u32(vget_low_u32(masked), vget_high_u32(masked));
+        uint32_t bits = vget_lane_u32(vpadd_u32(pair, pair), 0);
+#endif
+        if (m_count - i < 4) {
+            bits &= (1u << (m_count - i)) - 1;
+        }
+        count = appendVisible(out, count, i, bits);
+    }
+#endif // CULL_NEON
+
+    visible.resize(count);
+    return count;
+#endif
+}
+
+void TransformBounds(const glm::mat4 &transform, const glm::vec3 &center, const glm::vec3 &extent,
+        glm::vec3 &outCenter, glm::vec3 &outExtent) {
+    for (int r = 0; r < 3; ++r) {
+        outCenter[r] = transform[3][r];
+        outExtent[r] = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            outCenter[r] += transform[c][r] * center[c];
+            outExtent[r] += fabsf(transform[c][r]) * extent[c];
+        }
+    }
+}
+
+} // namespace util
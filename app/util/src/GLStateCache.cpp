@@ -0,0 +1,346 @@
+#include "GLStateCache.h"
+
+namespace util {
+
+static const GLuint UNKNOWN_NAME = ~0u;
+static const GLenum UNKNOWN_ENUM = ~0u;
+
+static GLStateCache s_fallback;
+static GLStateCache *s_current = &s_fallback;
+
+GLStateCache::GLStateCache() {
+    reset();
+}
+
+GLStateCache *GLStateCache::Current() {
+    return s_current;
+}
+
+void GLStateCache::MakeCurrent(GLStateCache *cache) {
+    s_current = cache ? cache : &s_fallback;
+}
+
+void GLStateCache::reset() {
+    m_program = UNKNOWN_NAME;
+    m_vao = UNKNOWN_NAME;
+    for (auto &buffer : m_buffers) {
+        buffer = UNKNOWN_NAME;
+    }
+    for (auto &range : m_uniformRanges) {
+        range.Buffer = UNKNOWN_NAME;
+        range.Offset = range.Size = 0;
+    }
+    m_drawFramebuffer = UNKNOWN_NAME;
+    m_readFramebuffer = UNKNOWN_NAME;
+    m_activeUnit = UNKNOWN_ENUM;
+    for (auto &unit : m_textures) {
+        for (auto &texture : unit) {
+            texture = UNKNOWN_NAME;
+        }
+    }
+    for (auto &cap : m_caps) {
+        cap = -1;
+    }
+    m_depthFunc = UNKNOWN_ENUM;
+    m_depthMask = -1;
+    m_colorMask = ~0u;
+    m_cullFace = UNKNOWN_ENUM;
+    m_frontFace = UNKNOWN_ENUM;
+    for (auto &factor : m_blend) {
+        factor = UNKNOWN_ENUM;
+    }
+    m_blendEquation = UNKNOWN_ENUM;
+    // no real viewport is negative
+    m_viewport[0] = m_viewport[1] = m_viewport[2] = m_viewport[3] = -1;
+}
+
+void GLStateCache::endFrame() {
+    m_lastFrame = m_frame;
+    m_frame = GLStateStats();
+}
+
+int GLStateCache::bufferSlot(GLenum target) {
+    switch (target) {
+    case GL_ARRAY_BUFFER: return 0;
+    case GL_ELEMENT_ARRAY_BUFFER: return 1;
+    case GL_UNIFORM_BUFFER: return 2;
+    case GL_COPY_READ_BUFFER: return 3;
+    case GL_COPY_WRITE_BUFFER: return 4;
+    case GL_PIXEL_PACK_BUFFER: return 5;
+    case GL_PIXEL_UNPACK_BUFFER: return 6;
+    case GL_TRANSFORM_FEEDBACK_BUFFER: return 7;
+    case GL_DRAW_INDIRECT_BUFFER: return 8;
+    case GL_SHADER_STORAGE_BUFFER: return 9;
+    default: return -1;
+    }
+}
+
+int GLStateCache::textureSlot(GLenum target) {
+    switch (target) {
+    case GL_TEXTURE_2D: return 0;
+    case GL_TEXTURE_CUBE_MAP: return 1;
+    case GL_TEXTURE_2D_ARRAY: return 2;
+    case GL_TEXTURE_3D: return 3;
+    default: return -1;
+    }
+}
+
+int GLStateCache::capSlot(GLenum cap) {
+    switch (cap) {
+    case GL_BLEND: return 0;
+    case GL_CULL_FACE: return 1;
+    case GL_DEPTH_TEST: return 2;
+    case GL_SCISSOR_TEST: return 3;
+    case GL_STENCIL_TEST: return 4;
+    case GL_POLYGON_OFFSET_FILL: return 5;
+    case GL_SAMPLE_ALPHA_TO_COVERAGE: return 6;
+    case GL_SAMPLE_COVERAGE: return 7;
+    case GL_RASTERIZER_DISCARD: return 8;
+    case GL_PRIMITIVE_RESTART_FIXED_INDEX: return 9;
+    case GL_DITHER: return 10;
+    default: return -1;
+    }
+}
+
+void GLStateCache::useProgram(GLuint program) {
+    if (update(m_program, program)) {
+        glUseProgram(program);
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint vao) {
+    if (update(m_vao, vao)) {
+        glBindVertexArray(vao);
+        // the element buffer binding belongs to the VAO
+        m_buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN_NAME;
+    }
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer) {
+    int slot = bufferSlot(target);
+    if (slot < 0) {
+        m_frame.Issued++;
+        glBindBuffer(target, buffer);
+    } else if (update(m_buffers[slot], buffer)) {
+        glBindBuffer(target, buffer);
+    }
+}
+
+void GLStateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset,
+        GLsizeiptr size) {
+    if (target == GL_UNIFORM_BUFFER && index < MAX_UNIFORM_BINDINGS) {
+        BufferRange &range = m_uniformRanges[index];
+        if (range.Buffer == buffer && range.Offset == offset && range.Size == size) {
+            m_frame.Skipped++;
+            return;
+        }
+        range.Buffer = buffer;
+        range.Offset = offset;
+        range.Size = size;
+    }
+    m_frame.Issued++;
+    glBindBufferRange(target, index, buffer, offset, size);
+    int slot = bufferSlot(target);
+    if (slot >= 0) {
+        m_buffers[slot] = buffer;
+    }
+}
+
+void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer) {
+    switch (target) {
+    case GL_DRAW_FRAMEBUFFER:
+        if (update(m_drawFramebuffer, framebuffer)) {
+            glBindFramebuffer(target, framebuffer);
+        }
+        break;
+    case GL_READ_FRAMEBUFFER:
+        if (update(m_readFramebuffer, framebuffer)) {
+            glBindFramebuffer(target, framebuffer);
+        }
+        break;
+    default:
+        if (m_drawFramebuffer == framebuffer && m_readFramebuffer == framebuffer) {
+            m_frame.Skipped++;
+            return;
+        }
+        m_drawFramebuffer = m_readFramebuffer = framebuffer;
+        m_frame.Issued++;
+        glBindFramebuffer(target, framebuffer);
+        break;
+    }
+}
+
+void GLStateCache::activeTexture(GLenum unit) {
+    if (update(m_activeUnit, unit)) {
+        glActiveTexture(unit);
+    }
+}
+
+void GLStateCache::bindTexture(GLenum target, GLuint texture) {
+    int slot = textureSlot(target);
+    GLuint unit = m_activeUnit - GL_TEXTURE0;
+    if (slot < 0 || m_activeUnit == UNKNOWN_ENUM || unit >= MAX_TEXTURE_UNITS) {
+        m_frame.Issued++;
+        glBindTexture(target, texture);
+    } else if (update(m_textures[unit][slot], texture)) {
+        glBindTexture(target, texture);
+    }
+}
+
+void GLStateCache::setEnabled(GLenum cap, bool enabled) {
+    int slot = capSlot(cap);
+    if (slot >= 0 && !update(m_caps[slot], (int8_t)enabled)) {
+        return;
+    }
+    if (slot < 0) {
+        m_frame.Issued++;
+    }
+    if (enabled) {
+        glEnable(cap);
+    } else {
+        glDisable(cap);
+    }
+}
+
+void GLStateCache::depthFunc(GLenum func) {
+    if (update(m_depthFunc, func)) {
+        glDepthFunc(func);
+    }
+}
+
+void GLStateCache::depthMask(bool write) {
+    if (update(m_depthMask, (int8_t)write)) {
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+}
+
+void GLStateCache::colorMask(bool red, bool green, bool blue, bool alpha) {
+    uint32_t mask = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+    if (update(m_colorMask, mask)) {
+        glColorMask(red, green, blue, alpha);
+    }
+}
+
+void GLStateCache::cullFace(GLenum face) {
+    if (update(m_cullFace, face)) {
+        glCullFace(face);
+    }
+}
+
+void GLStateCache::frontFace(GLenum mode) {
+    if (update(m_frontFace, mode)) {
+        glFrontFace(mode);
+    }
+}
+
+void GLStateCache::blendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha) {
+    bool changed = m_blend[0] != srcRGB || m_blend[1] != dstRGB || m_blend[2] != srcAlpha ||
+            m_blend[3] != dstAlpha;
+    if (!changed) {
+        m_frame.Skipped++;
+        return;
+    }
+    m_blend[0] = srcRGB;
+    m_blend[1] = dstRGB;
+    m_blend[2] = srcAlpha;
+    m_blend[3] = dstAlpha;
+    m_frame.Issued++;
+    glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+
+void GLStateCache::blendEquation(GLenum mode) {
+    if (update(m_blendEquation, mode)) {
+        glBlendEquation(mode);
+    }
+}
+
+void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    bool changed = m_viewport[0] != x || m_viewport[1] != y || m_viewport[2] != width ||
+            m_viewport[3] != height;
+    if (!changed) {
+        m_frame.Skipped++;
+        return;
+    }
+    m_viewport[0] = x;
+    m_viewport[1] = y;
+    m_viewport[2] = width;
+    m_viewport[3] = height;
+    m_frame.Issued++;
+    glViewport(x, y, width, height);
+}
+
+void GLStateCache::deleteProgram(GLuint program) {
+    if (!program) {
+        return;
+    }
+    // a program in use lives on until the next glUseProgram
+    if (m_program == program) {
+        m_program = UNKNOWN_NAME;
+    }
+    m_memory.release(GpuMemory::PROGRAM, program);
+    glDeleteProgram(program);
+}
+
+void GLStateCache::deleteVertexArrays(GLsizei count, const GLuint *arrays) {
+    for (GLsizei i = 0; i < count; ++i) {
+        if (arrays[i] && m_vao == arrays[i]) {
+            m_vao = 0;
+            m_buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN_NAME;
+        }
+    }
+    glDeleteVertexArrays(count, arrays);
+}
+
+void GLStateCache::deleteBuffers(GLsizei count, const GLuint *buffers) {
+    for (GLsizei i = 0; i < count; ++i) {
+        for (auto &buffer : m_buffers) {
+            if (buffers[i] && buffer == buffers[i]) {
+                buffer = 0;
+            }
+        }
+        for (auto &range : m_uniformRanges) {
+            if (buffers[i] && range.Buffer == buffers[i]) {
+                range.Buffer = 0;
+            }
+        }
+        m_memory.release(GpuMemory::BUFFER, buffers[i]);
+    }
+    glDeleteBuffers(count, buffers);
+}
+
+void GLStateCache::deleteTextures(GLsizei count, const GLuint *textures) {
+    for (GLsizei i = 0; i < count; ++i) {
+        for (auto &unit : m_textures) {
+            for (auto &texture : unit) {
+                if (textures[i] && texture == textures[i]) {
+                    texture = 0;
+                }
+            }
+        }
+        m_memory.release(GpuMemory::TEXTURE, textures[i]);
+    }
+    glDeleteTextures(count, textures);
+}
+
+void GLStateCache::deleteFramebuffers(GLsizei count, const GLuint *framebuffers) {
+    for (GLsizei i = 0; i < count; ++i) {
+        // GL falls back to the default framebuffer
+        if (framebuffers[i] && m_drawFramebuffer == framebuffers[i]) {
+            m_drawFramebuffer = 0;
+        }
+        if (framebuffers[i] && m_readFramebuffer == framebuffers[i]) {
+            m_readFramebuffer = 0;
+        }
+    }
+    glDeleteFramebuffers(count, framebuffers);
+}
+
+void GLStateCache::deleteRenderbuffers(GLsizei count, const GLuint *renderbuffers) {
+    // renderbuffer bindings aren't shadowed
+    for (GLsizei i = 0; i < count; ++i) {
+        m_memory.release(GpuMemory::RENDERBUFFER, renderbuffers[i]);
+    }
+    glDeleteRenderbuffers(count, renderbuffers);
+}
+
+} // namespace util
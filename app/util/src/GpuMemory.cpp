@@ -0,0 +1,53 @@
+#include "GpuMemory.h"
+
+#include <algorithm>
+
+namespace util {
+
+void GpuMemory::track(Kind kind, GLuint name, GpuMemoryCategory category, size_t bytes) {
+    if (!name) {
+        return;
+    }
+    release(kind, name);
+    Allocation allocation = { category, bytes };
+    m_objects[kind][name] = allocation;
+    m_stats.Bytes[category] += bytes;
+    m_stats.Objects[category]++;
+    m_stats.Total += bytes;
+    m_stats.Peak = std::max(m_stats.Peak, m_stats.Total);
+}
+
+void GpuMemory::release(Kind kind, GLuint name) {
+    auto found = m_objects[kind].find(name);
+    if (found == m_objects[kind].end()) {
+        return;
+    }
+    const Allocation &allocation = found->second;
+    m_stats.Bytes[allocation.Category] -= allocation.Bytes;
+    m_stats.Objects[allocation.Category]--;
+    m_stats.Total -= allocation.Bytes;
+    m_objects[kind].erase(found);
+}
+
+void GpuMemory::clear() {
+    for (auto &objects : m_objects) {
+        objects.clear();
+    }
+    // the peak is of the process, it survives the context
+    size_t peak = m_stats.Peak;
+    m_stats = GpuMemoryStats();
+    m_stats.Peak = peak;
+}
+
+const char *GpuMemory::CategoryName(GpuMemoryCategory category) {
+    switch (category) {
+    case GPU_MEMORY_GEOMETRY: return "geometry";
+    case GPU_MEMORY_STREAMING: return "streaming";
+    case GPU_MEMORY_TEXTURES: return "textures";
+    case GPU_MEMORY_RENDER_TARGETS: return "render targets";
+    case GPU_MEMORY_PROGRAMS: return "programs";
+    default: return "unknown";
+    }
+}
+
+} // namespace util
@@ -0,0 +1,381 @@
+#include "MeshFormat.h"
+
+#include <math.h>
+#include <string.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLStateCache.h"
+#include "LogUtil.h"
+
+namespace util {
+
+static const size_t POSITION_BYTES = 4 * sizeof (uint16_t);
+static const size_t NORMAL_BYTES = 2 * sizeof (int16_t);
+static const size_t UV_BYTES = 2 * sizeof (uint16_t);
+
+static size_t align4(size_t size) {
+    return (size + 3) & ~size_t(3);
+}
+
+static int16_t packSnorm16(float value) {
+    value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+    return (int16_t)lrintf(value * 32767.0f);
+}
+
+static float unpackSnorm16(int16_t value) {
+    float f = value / 32767.0f;
+    return f < -1.0f ? -1.0f : f;
+}
+
+// octahedral mapping of a unit vector onto [-1, 1]^2
+static void encodeOctahedral(const glm::vec3 &n, int16_t out[2]) {
+    float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (sum == 0.0f) {
+        out[0] = out[1] = 0;
+        return;
+    }
+    float x = n.x / sum, y = n.y / sum;
+    if (n.z < 0.0f) {
+        float ox = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float oy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = ox;
+        y = oy;
+    }
+    out[0] = packSnorm16(x);
+    out[1] = packSnorm16(y);
+}
+
+uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof (bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff) {
+        // inf or nan
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    if (exponent >= 31) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return (uint16_t)sign;
+        }
+        // denormal, round to nearest even
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1))) {
+            half++;
+        }
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        // may carry into the exponent, which is still correct
+        half++;
+    }
+    return (uint16_t)half;
+}
+
+float HalfToFloat(uint16_t value) {
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // normalize the denormal
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float result;
+    memcpy(&result, &bits, sizeof (result));
+    return result;
+}
+
+size_t PackedMeshView::indexBytes() const {
+    return (size_t)((uint64_t)Header->indexCount * ((Header->flags & MESH_SHORT_INDICES) ? 2 : 4));
+}
+
+GLenum PackedMeshView::indexType() const {
+    return (Header->flags & MESH_SHORT_INDICES) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+glm::mat4 PackedMeshView::dequantizeMatrix() const {
+    glm::vec3 boundsMin(Header->boundsMin[0], Header->boundsMin[1], Header->boundsMin[2]);
+    glm::vec3 boundsMax(Header->boundsMax[0], Header->boundsMax[1], Header->boundsMax[2]);
+    return glm::scale(glm::translate(glm::mat4(1.0f), boundsMin), boundsMax - boundsMin);
+}
+
+bool EncodePackedMesh(const MeshData &mesh, std::vector<uint8_t> &blob) {
+    size_t vertexCount = mesh.Positions.size();
+    if (!vertexCount || mesh.Indices.empty() || mesh.Indices.size() % 3 ||
+            (!mesh.Normals.empty() && mesh.Normals.size() != vertexCount) ||
+            (!mesh.UVs.empty() && mesh.UVs.size() != vertexCount)) {
+        return false;
+    }
+
+    PackedMeshHeader header;
+    memset(&header, 0, sizeof (header));
+    header.magic = MESH_MAGIC;
+    header.version = MESH_VERSION;
+    header.flags = (mesh.Normals.empty() ? 0 : MESH_NORMALS) | (mesh.UVs.empty() ? 0 : MESH_UVS) |
+            (vertexCount <= 0x10000 ? MESH_SHORT_INDICES : 0);
+    header.stride = POSITION_BYTES + ((header.flags & MESH_NORMALS) ? NORMAL_BYTES : 0) +
+            ((header.flags & MESH_UVS) ? UV_BYTES : 0);
+    header.vertexCount = (uint32_t)vertexCount;
+    header.indexCount = (uint32_t)mesh.Indices.size();
+    header.lodCount = mesh.Lods.empty() ? 1 : (uint32_t)mesh.Lods.size();
+    for (auto &lod : mesh.Lods) {
+        if (lod.IndexOffset + (size_t)lod.IndexCount > mesh.Indices.size() || lod.IndexCount % 3) {
+            return false;
+        }
+    }
+
+    glm::vec3 boundsMin = mesh.Positions[0], boundsMax = mesh.Positions[0];
+    for (auto &p : mesh.Positions) {
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+    for (int i = 0; i < 3; ++i) {
+        header.boundsMin[i] = boundsMin[i];
+        header.boundsMax[i] = boundsMax[i];
+    }
+    glm::vec3 extent = boundsMax - boundsMin;
+    glm::vec3 scale;
+    for (int i = 0; i < 3; ++i) {
+        scale[i] = extent[i] > 0.0f ? 65535.0f / extent[i] : 0.0f;
+    }
+
+    size_t vertexBytes = vertexCount * header.stride;
+    size_t indexBytes = mesh.Indices.size() * ((header.flags & MESH_SHORT_INDICES) ? 2 : 4);
+    size_t lodBytes = header.lodCount * sizeof (PackedMeshLod);
+    blob.assign(sizeof (header) + lodBytes + vertexBytes + align4(indexBytes), 0);
+    memcpy(blob.data(), &header, sizeof (header));
+
+    PackedMeshLod *lods = reinterpret_cast<PackedMeshLod *>(blob.data() + sizeof (header));
+    if (mesh.Lods.empty()) {
+        lods[0].indexCount = header.indexCount;
+    }
+    for (size_t i = 0; i < mesh.Lods.size(); ++i) {
+        lods[i].indexOffset = mesh.Lods[i].IndexOffset;
+        lods[i].indexCount = mesh.Lods[i].IndexCount;
+        lods[i].error = mesh.Lods[i].Error;
+    }
+
+    uint8_t *vertex = blob.data() + sizeof (header) + lodBytes;
+    for (size_t i = 0; i < vertexCount; ++i, vertex += header.stride) {
+        uint16_t position[4];
+        glm::vec3 q = (mesh.Positions[i] - boundsMin) * scale;
+        for (int c = 0; c < 3; ++c) {
+            float v = q[c] < 0.0f ? 0.0f : (q[c] > 65535.0f ? 65535.0f : q[c]);
+            position[c] = (uint16_t)lrintf(v);
+        }
+        position[3] = 0xffff;
+        memcpy(vertex, position, POSITION_BYTES);
+
+        size_t offset = POSITION_BYTES;
+        if (header.flags & MESH_NORMALS) {
+            int16_t normal[2];
+            encodeOctahedral(mesh.Normals[i], normal);
+            memcpy(vertex + offset, normal, NORMAL_BYTES);
+            offset += NORMAL_BYTES;
+        }
+        if (header.flags & MESH_UVS) {
+            uint16_t uv[2] = { FloatToHalf(mesh.UVs[i].x), FloatToHalf(mesh.UVs[i].y) };
+            memcpy(vertex + offset, uv, UV_BYTES);
+        }
+    }
+
+    uint8_t *indices = blob.data() + sizeof (header) + lodBytes + vertexBytes;
+    if (header.flags & MESH_SHORT_INDICES) {
+        uint16_t *out = reinterpret_cast<uint16_t *>(indices);
+        for (size_t i = 0; i < mesh.Indices.size(); ++i) {
+            out[i] = (uint16_t)mesh.Indices[i];
+        }
+    } else {
+        memcpy(indices, mesh.Indices.data(), indexBytes);
+    }
+    return true;
+}
+
+bool ParsePackedMesh(const uint8_t *data, size_t size, PackedMeshView &view) {
+    if (!data || size < sizeof (PackedMeshHeader)) {
+        return false;
+    }
+    const PackedMeshHeader *header = reinterpret_cast<const PackedMeshHeader *>(data);
+    size_t attribBytes = POSITION_BYTES + ((header->flags & MESH_NORMALS) ? NORMAL_BYTES : 0) +
+            ((header->flags & MESH_UVS) ? UV_BYTES : 0);
+    if (header->magic != MESH_MAGIC || header->version != MESH_VERSION ||
+            header->stride < attribBytes || header->stride % 4 || header->lodCount == 0 ||
+            header->indexCount % 3) {
+        ALOGE("Invalid mesh header!");
+        return false;
+    }
+    // 64 bit, the counts come from the file and size_t may be 32 bit
+    uint64_t lodBytes = (uint64_t)header->lodCount * sizeof (PackedMeshLod);
+    uint64_t vertexBytes = (uint64_t)header->vertexCount * header->stride;
+    uint64_t indexBytes = (uint64_t)header->indexCount * ((header->flags & MESH_SHORT_INDICES) ? 2 : 4);
+    if (sizeof (PackedMeshHeader) + lodBytes + vertexBytes + indexBytes > size) {
+        ALOGE("Truncated mesh data!");
+        return false;
+    }
+    view.Header = header;
+    view.Lods = reinterpret_cast<const PackedMeshLod *>(data + sizeof (PackedMeshHeader));
+    for (uint32_t i = 0; i < header->lodCount; ++i) {
+        if (view.Lods[i].indexOffset + (uint64_t)view.Lods[i].indexCount > header->indexCount ||
+                view.Lods[i].indexOffset % 3 || view.Lods[i].indexCount % 3) {
+            ALOGE("Invalid mesh LOD range!");
+            view = PackedMeshView();
+            return false;
+        }
+    }
+    view.Vertices = data + sizeof (PackedMeshHeader) + lodBytes;
+    view.Indices = view.Vertices + vertexBytes;
+    // picking and CPU occlusion index the decoded positions directly
+    bool inRange = true;
+    if (header->flags & MESH_SHORT_INDICES) {
+        const uint16_t *indices = reinterpret_cast<const uint16_t *>(view.Indices);
+        for (uint32_t i = 0; i < header->indexCount; ++i) {
+            inRange = inRange && indices[i] < header->vertexCount;
+        }
+    } else {
+        const uint32_t *indices = reinterpret_cast<const uint32_t *>(view.Indices);
+        for (uint32_t i = 0; i < header->indexCount; ++i) {
+            inRange = inRange && indices[i] < header->vertexCount;
+        }
+    }
+    if (!inRange) {
+        ALOGE("Mesh index out of range!");
+        view = PackedMeshView();
+        return false;
+    }
+    return true;
+}
+
+// the decoders read fixed-offset fields with a constant stride and do
+// a single multiply-add per component, which compilers vectorize well
+void DecodePositions(const PackedMeshView &view, glm::vec3 *out) {
+    const PackedMeshHeader *header = view.Header;
+    float scale[3], offset[3];
+    for (int c = 0; c < 3; ++c) {
+        scale[c] = (header->boundsMax[c] - header->boundsMin[c]) / 65535.0f;
+        offset[c] = header->boundsMin[c];
+    }
+    const uint8_t *vertex = view.Vertices;
+    for (uint32_t i = 0; i < header->vertexCount; ++i, vertex += header->stride) {
+        uint16_t position[3];
+        memcpy(position, vertex, sizeof (position));
+        out[i].x = position[0] * scale[0] + offset[0];
+        out[i].y = position[1] * scale[1] + offset[1];
+        out[i].z = position[2] * scale[2] + offset[2];
+    }
+}
+
+void DecodeNormals(const PackedMeshView &view, glm::vec3 *out) {
+    const PackedMeshHeader *header = view.Header;
+    if (!(header->flags & MESH_NORMALS)) {
+        return;
+    }
+    const uint8_t *vertex = view.Vertices + POSITION_BYTES;
+    for (uint32_t i = 0; i < header->vertexCount; ++i, vertex += header->stride) {
+        int16_t normal[2];
+        memcpy(normal, vertex, sizeof (normal));
+        float x = unpackSnorm16(normal[0]), y = unpackSnorm16(normal[1]);
+        float z = 1.0f - fabsf(x) - fabsf(y);
+        float t = z < 0.0f ? -z : 0.0f;
+        x += x >= 0.0f ? -t : t;
+        y += y >= 0.0f ? -t : t;
+        out[i] = glm::normalize(glm::vec3(x, y, z));
+    }
+}
+
+void DecodeUVs(const PackedMeshView &view, glm::vec2 *out) {
+    const PackedMeshHeader *header = view.Header;
+    if (!(header->flags & MESH_UVS)) {
+        return;
+    }
+    size_t offset = POSITION_BYTES + ((header->flags & MESH_NORMALS) ? NORMAL_BYTES : 0);
+    const uint8_t *vertex = view.Vertices + offset;
+    for (uint32_t i = 0; i < header->vertexCount; ++i, vertex += header->stride) {
+        uint16_t uv[2];
+        memcpy(uv, vertex, sizeof (uv));
+        out[i] = glm::vec2(HalfToFloat(uv[0]), HalfToFloat(uv[1]));
+    }
+}
+
+bool UploadPackedMesh(const PackedMeshView &view, ModelDrawable &model) {
+    const PackedMeshHeader *header = view.Header;
+    if (!header) {
+        return false;
+    }
+    GLStateCache *state = GLStateCache::Current();
+    // VAO
+    glGenVertexArrays(1, &model.VAO);
+    state->bindVertexArray(model.VAO);
+    // VBO, straight from the blob
+    glGenBuffers(1, &model.VBO);
+    state->bindBuffer(GL_ARRAY_BUFFER, model.VBO);
+    glBufferData(GL_ARRAY_BUFFER, view.vertexBytes(), view.Vertices, GL_STATIC_DRAW);
+    state->memory()->track(GpuMemory::BUFFER, model.VBO, GPU_MEMORY_GEOMETRY, view.vertexBytes());
+    // IBO
+    glGenBuffers(1, &model.IBO);
+    state->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.IBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, view.indexBytes(), view.Indices, GL_STATIC_DRAW);
+    state->memory()->track(GpuMemory::BUFFER, model.IBO, GPU_MEMORY_GEOMETRY, view.indexBytes());
+    // attrib
+    size_t offset = 0;
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, header->stride, (const void *)offset);
+    offset += POSITION_BYTES;
+    if (header->flags & MESH_NORMALS) {
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, header->stride, (const void *)offset);
+        offset += NORMAL_BYTES;
+    }
+    if (header->flags & MESH_UVS) {
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, header->stride, (const void *)offset);
+    }
+    state->bindVertexArray(0);
+    state->bindBuffer(GL_ARRAY_BUFFER, 0);
+    state->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    model.Lods.clear();
+    for (uint32_t i = 0; i < header->lodCount; ++i) {
+        MeshLod lod = { view.Lods[i].indexOffset, view.Lods[i].indexCount, view.Lods[i].error };
+        model.Lods.push_back(lod);
+    }
+    model.Lod = 0;
+    model.TriCount = model.Lods[0].IndexCount / 3;
+    model.IndexType = view.indexType();
+    model.Dequantize = view.dequantizeMatrix();
+    glm::vec3 extent(0.0f);
+    for (int c = 0; c < 3; ++c) {
+        model.Center[c] = 0.5f * (header->boundsMin[c] + header->boundsMax[c]);
+        extent[c] = header->boundsMax[c] - header->boundsMin[c];
+    }
+    model.Extent = 0.5f * extent;
+    model.Radius = 0.5f * glm::length(extent);
+    model.setTransform(model.Transform);
+    return true;
+}
+
+} // namespace util
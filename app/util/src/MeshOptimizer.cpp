@@ -0,0 +1,662 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+#include "HashUtil.h"
+
+namespace util {
+
+namespace {
+
+// fifo post-transform cache, as used by AnalyzeVertexCache and the
+// overdraw cluster split
+class FifoCache {
+public:
+    FifoCache(size_t vertexCount, uint32_t size) :
+        m_stamps(vertexCount, 0), m_size(size), m_time(size + 1) {
+    }
+
+    uint32_t touch(uint32_t vertex) {
+        if (m_time - m_stamps[vertex] > m_size) {
+            m_stamps[vertex] = m_time++;
+            return 1;
+        }
+        return 0;
+    }
+
+    uint32_t touch(const uint32_t *tri) {
+        return touch(tri[0]) + touch(tri[1]) + touch(tri[2]);
+    }
+
+    // everything currently cached becomes stale
+    void reset() {
+        m_time += m_size + 1;
+    }
+
+private:
+    std::vector<uint32_t> m_stamps;
+    uint32_t m_size;
+    uint32_t m_time;
+};
+
+// Forsyth, "Linear-Speed Vertex Cache Optimisation"
+const int FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRI_SCORE = 0.75f;
+const float FORSYTH_VALENCE_SCALE = 2.0f;
+const float FORSYTH_VALENCE_POWER = 0.5f;
+
+const uint32_t FORSYTH_VALENCE_TABLE = 32;
+
+struct ForsythTables {
+    float cache[FORSYTH_CACHE_SIZE];
+    float valence[FORSYTH_VALENCE_TABLE];
+
+    ForsythTables() {
+        for (int i = 0; i < FORSYTH_CACHE_SIZE; ++i) {
+            float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            cache[i] = i < 3 ? FORSYTH_LAST_TRI_SCORE :
+                    powf(1.0f - (i - 3) * scale, FORSYTH_DECAY_POWER);
+        }
+        for (uint32_t i = 0; i < FORSYTH_VALENCE_TABLE; ++i) {
+            valence[i] = i ? FORSYTH_VALENCE_SCALE * powf((float)i, -FORSYTH_VALENCE_POWER) : 0.0f;
+        }
+    }
+};
+
+float forsythScore(int cachePos, uint32_t remaining) {
+    static const ForsythTables tables;
+    if (remaining == 0) {
+        return -1.0f;
+    }
+    float score = cachePos >= 0 ? tables.cache[cachePos] : 0.0f;
+    // prefer finishing off vertices with few triangles left
+    return score + (remaining < FORSYTH_VALENCE_TABLE ? tables.valence[remaining] :
+            FORSYTH_VALENCE_SCALE * powf((float)remaining, -FORSYTH_VALENCE_POWER));
+}
+
+template <typename T>
+void remapAttribute(std::vector<T> &values, const std::vector<uint32_t> &remap, uint32_t count) {
+    if (values.empty()) {
+        return;
+    }
+    std::vector<T> result(count);
+    for (size_t i = 0; i < remap.size(); ++i) {
+        if (remap[i] != UINT32_MAX) {
+            result[remap[i]] = values[i];
+        }
+    }
+    values.swap(result);
+}
+
+void remapVertices(MeshData &mesh, const std::vector<uint32_t> &remap, uint32_t count) {
+    remapAttribute(mesh.Positions, remap, count);
+    remapAttribute(mesh.Normals, remap, count);
+    remapAttribute(mesh.UVs, remap, count);
+    for (auto &index : mesh.Indices) {
+        index = remap[index];
+    }
+}
+
+bool sameVertex(const MeshData &mesh, uint32_t a, uint32_t b) {
+    if (memcmp(&mesh.Positions[a], &mesh.Positions[b], sizeof (glm::vec3))) {
+        return false;
+    }
+    if (!mesh.Normals.empty() && memcmp(&mesh.Normals[a], &mesh.Normals[b], sizeof (glm::vec3))) {
+        return false;
+    }
+    return mesh.UVs.empty() || !memcmp(&mesh.UVs[a], &mesh.UVs[b], sizeof (glm::vec2));
+}
+
+// maps every vertex to the first one with the same position
+std::vector<uint32_t> positionRemap(const std::vector<glm::vec3> &positions) {
+    size_t tableSize = 1;
+    while (tableSize < positions.size() * 2) {
+        tableSize <<= 1;
+    }
+    std::vector<uint32_t> table(tableSize, UINT32_MAX);
+    std::vector<uint32_t> remap(positions.size());
+    for (uint32_t v = 0; v < positions.size(); ++v) {
+        size_t slot = HashBytes(&positions[v], sizeof (glm::vec3)) & (tableSize - 1);
+        while (table[slot] != UINT32_MAX &&
+               memcmp(&positions[table[slot]], &positions[v], sizeof (glm::vec3))) {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        if (table[slot] == UINT32_MAX) {
+            table[slot] = v;
+        }
+        remap[v] = table[slot];
+    }
+    return remap;
+}
+
+// area weighted sum of squared plane distances
+struct Quadric {
+    double a2, b2, c2, d2, ab, ac, ad, bc, bd, cd;
+    double weight;
+
+    Quadric() :
+        a2(0), b2(0), c2(0), d2(0), ab(0), ac(0), ad(0), bc(0), bd(0), cd(0), weight(0) {
+    }
+
+    // plane ax + by + cz + d = 0 with a unit normal
+    void addPlane(double a, double b, double c, double d, double w) {
+        a2 += w * a * a; b2 += w * b * b; c2 += w * c * c; d2 += w * d * d;
+        ab += w * a * b; ac += w * a * c; ad += w * a * d;
+        bc += w * b * c; bd += w * b * d; cd += w * c * d;
+        weight += w;
+    }
+
+    void add(const Quadric &q) {
+        a2 += q.a2; b2 += q.b2; c2 += q.c2; d2 += q.d2;
+        ab += q.ab; ac += q.ac; ad += q.ad; bc += q.bc; bd += q.bd; cd += q.cd;
+        weight += q.weight;
+    }
+
+    double error(const glm::vec3 &p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+                2.0 * (ab * x * y + ac * x * z + ad * x + bc * y * z + bd * y + cd * z);
+        return e > 0.0 ? e : 0.0;
+    }
+};
+
+struct Collapse {
+    uint32_t from, to;
+    float cost;
+};
+
+// triangles around each vertex, triangle ids are indices / 3
+void buildTriangleAdjacency(const std::vector<uint32_t> &indices, const std::vector<uint32_t> &remap,
+        std::vector<uint32_t> &offsets, std::vector<uint32_t> &triangles) {
+    offsets.assign(remap.size() + 1, 0);
+    for (auto index : indices) {
+        offsets[remap[index] + 1]++;
+    }
+    for (size_t v = 0; v < remap.size(); ++v) {
+        offsets[v + 1] += offsets[v];
+    }
+    triangles.resize(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        triangles[fill[remap[indices[i]]]++] = i / 3;
+    }
+}
+
+} // namespace
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount,
+        uint32_t cacheSize) {
+    VertexCacheStats stats;
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<bool> used(vertexCount, false);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        stats.Misses += cache.touch(&indices[i]);
+        stats.TriangleCount++;
+    }
+    for (auto index : indices) {
+        if (!used[index]) {
+            used[index] = true;
+            stats.VertexCount++;
+        }
+    }
+    if (stats.TriangleCount) {
+        stats.ACMR = (float)stats.Misses / stats.TriangleCount;
+        stats.ATVR = (float)stats.Misses / stats.VertexCount;
+    }
+    return stats;
+}
+
+size_t WeldVertices(MeshData &mesh) {
+    size_t vertexCount = mesh.Positions.size();
+    size_t tableSize = 1;
+    while (tableSize < vertexCount * 2) {
+        tableSize <<= 1;
+    }
+    std::vector<uint32_t> table(tableSize, UINT32_MAX);
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+
+    uint32_t unique = 0;
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        uint64_t hash = HashBytes(&mesh.Positions[v], sizeof (glm::vec3));
+        if (!mesh.Normals.empty()) {
+            hash = HashBytes(&mesh.Normals[v], sizeof (glm::vec3), hash);
+        }
+        if (!mesh.UVs.empty()) {
+            hash = HashBytes(&mesh.UVs[v], sizeof (glm::vec2), hash);
+        }
+        size_t slot = hash & (tableSize - 1);
+        while (table[slot] != UINT32_MAX && !sameVertex(mesh, table[slot], v)) {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        if (table[slot] == UINT32_MAX) {
+            table[slot] = v;
+            remap[v] = unique++;
+        } else {
+            remap[v] = remap[table[slot]];
+        }
+    }
+    remapVertices(mesh, remap, unique);
+
+    // welding may collapse triangles
+    size_t count = 0;
+    for (size_t i = 0; i + 2 < mesh.Indices.size(); i += 3) {
+        uint32_t a = mesh.Indices[i], b = mesh.Indices[i + 1], c = mesh.Indices[i + 2];
+        if (a != b && b != c && c != a) {
+            mesh.Indices[count++] = a;
+            mesh.Indices[count++] = b;
+            mesh.Indices[count++] = c;
+        }
+    }
+    mesh.Indices.resize(count);
+    return vertexCount - unique;
+}
+
+void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount) {
+    size_t triCount = indices.size() / 3;
+    if (triCount == 0) {
+        return;
+    }
+
+    // per vertex list of triangles not emitted yet
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (size_t i = 0; i < triCount * 3; ++i) {
+        remaining[indices[i]]++;
+    }
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        offsets[v + 1] = offsets[v] + remaining[v];
+    }
+    std::vector<uint32_t> adjacency(triCount * 3);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triCount * 3; ++i) {
+        adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int> cachePos(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScore[v] = forsythScore(-1, remaining[v]);
+    }
+    std::vector<float> triScore(triCount);
+    std::vector<bool> emitted(triCount, false);
+    uint32_t best = 0;
+    for (size_t t = 0; t < triCount; ++t) {
+        const uint32_t *tri = &indices[t * 3];
+        triScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+        if (triScore[t] > triScore[best]) {
+            best = t;
+        }
+    }
+
+    std::vector<uint32_t> result;
+    result.reserve(triCount * 3);
+    std::vector<uint32_t> cache, newCache;
+    size_t cursor = 0;
+    for (size_t n = 0; n < triCount; ++n) {
+        if (best == UINT32_MAX) {
+            // dead end, continue with the next triangle in input order
+            while (emitted[cursor]) {
+                cursor++;
+            }
+            best = cursor;
+        }
+        const uint32_t *tri = &indices[best * 3];
+        emitted[best] = true;
+        newCache.assign(tri, tri + 3);
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = tri[k];
+            result.push_back(v);
+            uint32_t *list = &adjacency[offsets[v]];
+            uint32_t *last = list + remaining[v] - 1;
+            *std::find(list, last, best) = *last;
+            remaining[v]--;
+        }
+        for (auto v : cache) {
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                newCache.push_back(v);
+            }
+        }
+
+        for (size_t i = 0; i < newCache.size(); ++i) {
+            uint32_t v = newCache[i];
+            cachePos[v] = i < FORSYTH_CACHE_SIZE ? (int)i : -1;
+            vertexScore[v] = forsythScore(cachePos[v], remaining[v]);
+        }
+        // only triangles touching the cache changed score
+        best = UINT32_MAX;
+        float bestScore = -1.0f;
+        for (auto v : newCache) {
+            for (uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; ++i) {
+                uint32_t t = adjacency[i];
+                const uint32_t *other = &indices[t * 3];
+                triScore[t] = vertexScore[other[0]] + vertexScore[other[1]] + vertexScore[other[2]];
+                if (triScore[t] > bestScore) {
+                    bestScore = triScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (newCache.size() > FORSYTH_CACHE_SIZE) {
+            newCache.resize(FORSYTH_CACHE_SIZE);
+        }
+        cache.swap(newCache);
+    }
+    indices.swap(result);
+}
+
+// Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw": clusters end where the simulated cache goes cold, and are split
+// further as long as each piece stays within threshold of the cluster ACMR.
+// Clusters facing away from the mesh center are drawn first, they are the
+// likely occluders for the rest.
+void OptimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+        float threshold) {
+    size_t triCount = indices.size() / 3;
+    if (triCount < 2) {
+        return;
+    }
+
+    FifoCache cache(positions.size(), 16);
+    std::vector<uint32_t> hard;
+    for (size_t t = 0; t < triCount; ++t) {
+        if (cache.touch(&indices[t * 3]) == 3 || t == 0) {
+            hard.push_back(t);
+        }
+    }
+    hard.push_back(triCount);
+
+    std::vector<uint32_t> clusters;
+    for (size_t c = 0; c + 1 < hard.size(); ++c) {
+        uint32_t begin = hard[c], end = hard[c + 1];
+        cache.reset();
+        uint32_t misses = 0;
+        for (uint32_t t = begin; t < end; ++t) {
+            misses += cache.touch(&indices[t * 3]);
+        }
+        float limit = threshold * misses / (end - begin);
+
+        cache.reset();
+        misses = 0;
+        uint32_t start = begin;
+        clusters.push_back(begin);
+        for (uint32_t t = begin; t + 1 < end; ++t) {
+            misses += cache.touch(&indices[t * 3]);
+            if ((float)misses / (t + 1 - start) <= limit) {
+                start = t + 1;
+                clusters.push_back(start);
+                misses = 0;
+                cache.reset();
+            }
+        }
+    }
+    clusters.push_back(triCount);
+
+    // area weighted centroids and normals
+    size_t clusterCount = clusters.size() - 1;
+    std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> normals(clusterCount, glm::vec3(0.0f));
+    std::vector<float> areas(clusterCount, 0.0f);
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusterCount; ++c) {
+        for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+            const glm::vec3 &a = positions[indices[t * 3]];
+            const glm::vec3 &b = positions[indices[t * 3 + 1]];
+            const glm::vec3 &p = positions[indices[t * 3 + 2]];
+            glm::vec3 normal = glm::cross(b - a, p - a);
+            float area = glm::length(normal);
+            centroids[c] += (a + b + p) * (area / 3.0f);
+            normals[c] += normal;
+            areas[c] += area;
+        }
+        meshCentroid += centroids[c];
+        meshArea += areas[c];
+    }
+    if (meshArea > 0.0f) {
+        meshCentroid /= meshArea;
+    }
+
+    std::vector<float> keys(clusterCount, 0.0f);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        float length = glm::length(normals[c]);
+        if (areas[c] > 0.0f && length > 0.0f) {
+            keys[c] = glm::dot(centroids[c] / areas[c] - meshCentroid, normals[c] / length);
+        }
+    }
+    std::vector<uint32_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) {
+        return keys[a] > keys[b];
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (auto c : order) {
+        result.insert(result.end(), indices.begin() + clusters[c] * 3,
+                indices.begin() + clusters[c + 1] * 3);
+    }
+    indices.swap(result);
+}
+
+void OptimizeVertexFetch(MeshData &mesh) {
+    // number vertices in the order the triangles first use them
+    std::vector<uint32_t> remap(mesh.Positions.size(), UINT32_MAX);
+    uint32_t count = 0;
+    for (auto index : mesh.Indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = count++;
+        }
+    }
+    remapVertices(mesh, remap, count);
+}
+
+// Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics",
+// restricted to half edge collapses. Each pass sorts all candidate collapses
+// by cost and applies the cheapest ones that don't touch each other.
+float SimplifyMesh(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+        size_t targetIndexCount) {
+    size_t vertexCount = positions.size();
+    std::vector<uint32_t> canonical = positionRemap(positions);
+    std::vector<uint32_t> wedges(vertexCount, 0);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        wedges[canonical[v]]++;
+    }
+
+    std::vector<uint32_t> offsets, triangles;
+    buildTriangleAdjacency(indices, canonical, offsets, triangles);
+
+    // seams and open borders stay where they are
+    std::vector<bool> locked(vertexCount, false);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        locked[v] = wedges[canonical[v]] > 1;
+    }
+    for (size_t i = 0; i < indices.size(); ++i) {
+        uint32_t a = canonical[indices[i]];
+        uint32_t b = canonical[indices[i - i % 3 + (i + 1) % 3]];
+        bool shared = false;
+        for (uint32_t k = offsets[b]; k < offsets[b + 1] && !shared; ++k) {
+            const uint32_t *tri = &indices[triangles[k] * 3];
+            for (int e = 0; e < 3; ++e) {
+                if (canonical[tri[e]] == b && canonical[tri[(e + 1) % 3]] == a) {
+                    shared = true;
+                }
+            }
+        }
+        if (!shared) {
+            locked[a] = locked[b] = true;
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const glm::vec3 &p0 = positions[indices[i]];
+        glm::vec3 e1 = positions[indices[i + 1]] - p0, e2 = positions[indices[i + 2]] - p0;
+        double nx = (double)e1.y * e2.z - (double)e1.z * e2.y;
+        double ny = (double)e1.z * e2.x - (double)e1.x * e2.z;
+        double nz = (double)e1.x * e2.y - (double)e1.y * e2.x;
+        double area = sqrt(nx * nx + ny * ny + nz * nz);
+        if (area > 0.0) {
+            nx /= area;
+            ny /= area;
+            nz /= area;
+            double d = -(nx * p0.x + ny * p0.y + nz * p0.z);
+            for (int k = 0; k < 3; ++k) {
+                quadrics[canonical[indices[i + k]]].addPlane(nx, ny, nz, d, area);
+            }
+        }
+    }
+
+    double maxError = 0.0;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    while (indices.size() > targetIndexCount) {
+        collapses.clear();
+        for (size_t i = 0; i < indices.size(); ++i) {
+            uint32_t from = indices[i];
+            uint32_t to = indices[i - i % 3 + (i + 1) % 3];
+            if (locked[from]) {
+                continue;
+            }
+            Quadric q = quadrics[from];
+            q.add(quadrics[canonical[to]]);
+            Collapse collapse = { from, to, q.weight > 0.0 ? float(q.error(positions[to]) / q.weight) : 0.0f };
+            collapses.push_back(collapse);
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) {
+            return a.cost < b.cost;
+        });
+
+        for (size_t v = 0; v < vertexCount; ++v) {
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), false);
+        size_t triCount = indices.size() / 3, removed = 0;
+        size_t applied = 0;
+        for (auto &collapse : collapses) {
+            if (triCount - removed <= targetIndexCount / 3) {
+                break;
+            }
+            uint32_t from = collapse.from, to = collapse.to;
+            uint32_t target = canonical[to];
+            if (touched[from] || touched[target]) {
+                continue;
+            }
+            // reject collapses that fold a triangle over
+            bool flips = false;
+            size_t degenerate = 0;
+            for (uint32_t k = offsets[from]; k < offsets[from + 1] && !flips; ++k) {
+                const uint32_t *tri = &indices[triangles[k] * 3];
+                if (canonical[tri[0]] == target || canonical[tri[1]] == target ||
+                        canonical[tri[2]] == target) {
+                    degenerate++;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (int e = 0; e < 3; ++e) {
+                    p[e] = positions[tri[e]];
+                    q[e] = canonical[tri[e]] == from ? positions[to] : p[e];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                flips = glm::dot(before, after) <= 0.0f;
+            }
+            if (flips) {
+                continue;
+            }
+
+            remap[from] = to;
+            quadrics[target].add(quadrics[from]);
+            maxError = std::max(maxError, (double)collapse.cost);
+            removed += degenerate;
+            applied++;
+            // the one ring changed shape, leave it to the next pass
+            for (uint32_t k = offsets[from]; k < offsets[from + 1]; ++k) {
+                const uint32_t *tri = &indices[triangles[k] * 3];
+                for (int e = 0; e < 3; ++e) {
+                    touched[canonical[tri[e]]] = true;
+                }
+            }
+        }
+        if (!applied) {
+            break;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (canonical[a] != canonical[b] && canonical[b] != canonical[c] &&
+                    canonical[c] != canonical[a]) {
+                indices[count++] = a;
+                indices[count++] = b;
+                indices[count++] = c;
+            }
+        }
+        indices.resize(count);
+        buildTriangleAdjacency(indices, canonical, offsets, triangles);
+    }
+    return (float)sqrt(maxError);
+}
+
+void BuildLodChain(MeshData &mesh, uint32_t maxLods, float ratio) {
+    MeshLod first = { 0, (uint32_t)mesh.Indices.size(), 0.0f };
+    mesh.Lods.assign(1, first);
+
+    std::vector<uint32_t> lod = mesh.Indices;
+    float error = 0.0f;
+    while (mesh.Lods.size() < maxLods) {
+        size_t before = lod.size();
+        size_t target = size_t(before / 3 * ratio) * 3;
+        // errors of successive LODs add up at most
+        error += SimplifyMesh(lod, mesh.Positions, target);
+        if (lod.empty() || lod.size() > before - (before - target) / 2) {
+            break;
+        }
+        OptimizeVertexCache(lod, mesh.Positions.size());
+        MeshLod next = { (uint32_t)mesh.Indices.size(), (uint32_t)lod.size(), error };
+        mesh.Lods.push_back(next);
+        mesh.Indices.insert(mesh.Indices.end(), lod.begin(), lod.end());
+    }
+}
+
+void OptimizeMesh(MeshData &mesh, uint32_t maxLods) {
+    WeldVertices(mesh);
+    OptimizeVertexCache(mesh.Indices, mesh.Positions.size());
+    OptimizeOverdraw(mesh.Indices, mesh.Positions);
+    OptimizeVertexFetch(mesh);
+    // coarser LODs only use vertices of LOD 0, the fetch order still holds
+    if (maxLods > 1) {
+        BuildLodChain(mesh, maxLods);
+    }
+}
+
+void OptimizeMeshes(const std::vector<MeshData *> &meshes, uint32_t maxLods, unsigned int threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min<size_t>(threads, meshes.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&meshes, &next, maxLods]() {
+        for (size_t i = next++; i < meshes.size(); i = next++) {
+            OptimizeMesh(*meshes[i], maxLods);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threads; ++i) {
+        pool.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+}
+
+} // namespace util
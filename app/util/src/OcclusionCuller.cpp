@@ -0,0 +1,194 @@
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+
+#include "GLStateCache.h"
+#include "ShaderCompileQueue.h"
+
+namespace util {
+
+static const char *PROXY_VERTEX_SHADER =
+    "#version 300 es\n"
+    "layout(location = 0) in vec3 inPos;\n"
+    "uniform mat4 viewProjection;\n"
+    "void main() {\n"
+    "    gl_Position = viewProjection * vec4(inPos, 1.0);\n"
+    "}\n";
+
+static const char *PROXY_FRAGMENT_SHADER =
+    "#version 300 es\n"
+    "precision mediump float;\n"
+    "out vec4 Color;\n"
+    "void main() {\n"
+    "    Color = vec4(1.0);\n"
+    "}\n";
+
+static const glm::vec3 CubeCorners[] = {
+    { -1.0f, -1.0f,  1.0f }, {  1.0f, -1.0f,  1.0f }, {  1.0f,  1.0f,  1.0f }, { -1.0f,  1.0f,  1.0f },
+    { -1.0f, -1.0f, -1.0f }, {  1.0f, -1.0f, -1.0f }, {  1.0f,  1.0f, -1.0f }, { -1.0f,  1.0f, -1.0f },
+};
+
+// counter clockwise from outside, same as the models
+static const GLuint CubeIndices[] = {
+    0, 1, 2, 2, 3, 0,   1, 5, 6, 6, 2, 1,   7, 6, 5, 5, 4, 7,
+    4, 0, 3, 3, 7, 4,   4, 5, 1, 1, 0, 4,   3, 2, 6, 6, 7, 3,
+};
+
+static const GLsizei CORNERS = sizeof (CubeCorners) / sizeof (CubeCorners[0]);
+static const GLsizei INDICES = sizeof (CubeIndices) / sizeof (CubeIndices[0]);
+
+OcclusionCuller::OcclusionCuller() :
+    m_proxyVAO(0), m_proxyVBO(0), m_proxyIBO(0), m_proxyCapacity(0), m_frame(0) {
+}
+
+OcclusionCuller::~OcclusionCuller() {
+    release();
+}
+
+void OcclusionCuller::init() {
+    m_program = std::make_shared<OpenGLShaderProgram>();
+    m_program->addShaderFromSourceCode(OpenGLShader::Vertex, PROXY_VERTEX_SHADER);
+    m_program->addShaderFromSourceCode(OpenGLShader::Fragment, PROXY_FRAGMENT_SHADER);
+    ShaderCompileQueue::Get()->enqueue(m_program);
+    m_viewProjection = Uniform<glm::mat4>();
+
+    // corners are rewritten every frame, the indices when more boxes are needed
+    GLStateCache *state = GLStateCache::Current();
+    glGenVertexArrays(1, &m_proxyVAO);
+    state->bindVertexArray(m_proxyVAO);
+    glGenBuffers(1, &m_proxyVBO);
+    state->bindBuffer(GL_ARRAY_BUFFER, m_proxyVBO);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof (glm::vec3), nullptr);
+    glGenBuffers(1, &m_proxyIBO);
+    state->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_proxyIBO);
+    state->bindVertexArray(0);
+    state->bindBuffer(GL_ARRAY_BUFFER, 0);
+    m_proxyCapacity = 0;
+    m_frame = 0;
+}
+
+void OcclusionCuller::release() {
+    GLStateCache *state = GLStateCache::Current();
+    state->deleteVertexArrays(1, &m_proxyVAO);
+    const GLuint buffers[] = { m_proxyVBO, m_proxyIBO };
+    state->deleteBuffers(2, buffers);
+    m_proxyVAO = m_proxyVBO = m_proxyIBO = 0;
+    m_proxyCapacity = 0;
+    m_program.reset();
+    m_queried.clear();
+}
+
+void OcclusionCuller::update(const std::vector<ModelDrawable *> &occluders,
+        const std::vector<ModelDrawable *> &models) {
+    m_frame++;
+    m_stats = OcclusionStats();
+    for (auto model : models) {
+        bool culled = model->isCulled;
+        if (model->QueryPending) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(model->Query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint passed = 0;
+                glGetQueryObjectuiv(model->Query, GL_QUERY_RESULT, &passed);
+                // a single hidden result may be a proxy that only just
+                // slipped behind an occluder
+                model->OccludedResults = passed ? 0 : model->OccludedResults + 1;
+                model->isCulled = model->OccludedResults >= OCCLUDED_RESULTS;
+                model->QueryPending = false;
+            } else {
+                m_stats.Pending++;
+            }
+        }
+        // never tested, back in the frustum or nothing left to hide behind:
+        // the last result says nothing
+        if (!model->Query || model->OcclusionFrame + 1 != m_frame || occluders.empty()) {
+            model->isCulled = false;
+            model->OccludedResults = 0;
+        }
+        model->OcclusionFrame = m_frame;
+        if (model->isCulled) {
+            m_stats.Occluded++;
+        }
+        if (model->isCulled != culled) {
+            m_stats.Changed++;
+        }
+    }
+}
+
+void OcclusionCuller::query(const glm::mat4 &viewProjection, const glm::vec3 &eye,
+        const std::vector<ModelDrawable *> &occluders, const std::vector<ModelDrawable *> &models) {
+    // without occluders every query would pass, update() keeps them visible
+    if (occluders.empty() || !m_program || !m_program->isReady()) {
+        return;
+    }
+    if (!m_viewProjection.isValid()) {
+        m_viewProjection = m_program->uniform<glm::mat4>("viewProjection");
+    }
+
+    m_corners.clear();
+    m_queried.clear();
+    for (auto model : models) {
+        // one query in flight per model
+        if (model->QueryPending) {
+            continue;
+        }
+        // the near plane would clip a proxy around the camera
+        glm::vec3 distance = glm::abs(eye - model->WorldCenter);
+        if (distance.x <= model->WorldExtent.x && distance.y <= model->WorldExtent.y &&
+                distance.z <= model->WorldExtent.z) {
+            model->isCulled = false;
+            model->OccludedResults = 0;
+            continue;
+        }
+        if (!model->Query) {
+            glGenQueries(1, &model->Query);
+        }
+        for (GLsizei i = 0; i < CORNERS; ++i) {
+            m_corners.push_back(model->WorldCenter + CubeCorners[i] * model->WorldExtent);
+        }
+        m_queried.push_back(model);
+    }
+    if (m_queried.empty()) {
+        return;
+    }
+
+    GLStateCache *state = GLStateCache::Current();
+    state->bindVertexArray(m_proxyVAO);
+    if (m_queried.size() > m_proxyCapacity) {
+        // box i uses corners 8i to 8i+7, no base vertex in GLES 3.0
+        m_proxyCapacity = std::max(m_queried.size(), m_proxyCapacity * 2);
+        std::vector<GLuint> indices(m_proxyCapacity * INDICES);
+        for (size_t box = 0; box < m_proxyCapacity; ++box) {
+            for (GLsizei i = 0; i < INDICES; ++i) {
+                indices[box * INDICES + i] = (GLuint)(box * CORNERS) + CubeIndices[i];
+            }
+        }
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof (GLuint), indices.data(), GL_STATIC_DRAW);
+        state->memory()->track(GpuMemory::BUFFER, m_proxyIBO, GPU_MEMORY_GEOMETRY,
+                               indices.size() * sizeof (GLuint));
+    }
+    state->bindBuffer(GL_ARRAY_BUFFER, m_proxyVBO);
+    glBufferData(GL_ARRAY_BUFFER, m_corners.size() * sizeof (glm::vec3), m_corners.data(), GL_STREAM_DRAW);
+    state->memory()->track(GpuMemory::BUFFER, m_proxyVBO, GPU_MEMORY_STREAMING,
+                           m_corners.size() * sizeof (glm::vec3));
+
+    // depth test only, the proxies must not show up or occlude anything
+    state->colorMask(false, false, false, false);
+    state->depthMask(false);
+    m_program->bind();
+    m_viewProjection.set(viewProjection);
+    for (size_t i = 0; i < m_queried.size(); ++i) {
+        glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, m_queried[i]->Query);
+        glDrawElements(GL_TRIANGLES, INDICES, GL_UNSIGNED_INT, (const void *)(i * INDICES * sizeof (GLuint)));
+        glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+        m_queried[i]->QueryPending = true;
+    }
+    state->bindVertexArray(0);
+    state->bindBuffer(GL_ARRAY_BUFFER, 0);
+    state->colorMask(true, true, true, true);
+    state->depthMask(true);
+    m_stats.Issued = m_queried.size();
+}
+
+} // namespace util
@@ -1,6 +1,6 @@
 #include "OpenGLCommon.h"
 
-#ifdef __ANDROID__
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
 #include <GLES3/gl32.h>
 #include "LogUtil.h"
 
@@ -6,6 +6,7 @@
 #include <GL/glext.h>
 #endif
 
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -14,9 +15,11 @@
 
 #include "LogUtil.h"
 #include "AssetHelper.h"
+#include "ProgramBinaryCache.h"
+#include "GLStateCache.h"
 
 #define UNIFORM_LOCATION \
-    glGetUniformLocation(m_programID, name.c_str())
+    uniformLocation(name)
 
 namespace util {
 
@@ -32,8 +35,12 @@ OpenGLShader::~OpenGLShader()
 }
 
 bool OpenGLShader::compileSourceCode(const std::string &source) {
+    return submitSourceCode(source) && checkCompileErrors();
+}
+
+bool OpenGLShader::submitSourceCode(const std::string &source) {
     if (source.empty()) {
-#ifdef __ANDROID__
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
         ALOGE("Empty shader source!\n");
 #endif
         return false;
@@ -41,18 +48,21 @@ bool OpenGLShader::compileSourceCode(const std::string &source) {
     const char *c_source = source.c_str();
     glShaderSource(m_shaderID, 1, &c_source, nullptr);
     glCompileShader(m_shaderID);
-    return checkCompileErrors();
+    return true;
 }
 
 bool OpenGLShader::compileSourceFile(const std::string &filename) {
-    std::vector<uint8_t> data;
-    if (!AssetHelper::Get()->AssetReadFile(filename, data)) {
-#ifdef __ANDROID__
+    AssetView view;
+    if (!AssetHelper::Get()->AssetOpenView(filename, view)) {
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
         ALOGE("Cannot open a file: %s!\n", filename.c_str());
 #endif
+        return false;
     }
-    char *p_shader = (char *)(data.data());
-    glShaderSource(m_shaderID, 1, &p_shader, nullptr);
+    // asset data is not null terminated
+    const char *p_shader = (const char *)(view.data());
+    GLint length = (GLint)view.size();
+    glShaderSource(m_shaderID, 1, &p_shader, &length);
     glCompileShader(m_shaderID);
     return checkCompileErrors();
 }
@@ -91,7 +101,7 @@ bool OpenGLShader::checkCompileErrors() const {
         if (infoLogLen > 0) {
             GLchar *info = new GLchar[infoLogLen];
             glGetShaderInfoLog(m_shaderID, infoLogLen, nullptr, info);
-#ifdef __ANDROID__
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
             ALOGE("Could not compile shader:\n%s\n", info);
 #endif
             delete  [] info;
@@ -101,134 +111,354 @@ bool OpenGLShader::checkCompileErrors() const {
 }
 
 OpenGLShaderProgram::OpenGLShaderProgram() :
-    m_isLinked(false) {
+    m_status(Unlinked), m_useCache(false), m_cacheKey(0), m_blockedMs(0.0), m_uniformMask(0) {
     m_programID = glCreateProgram();
 }
 
 OpenGLShaderProgram::~OpenGLShaderProgram()
 {
     m_shaders.clear();
-    glDeleteProgram(m_programID);
+    GLStateCache::Current()->deleteProgram(m_programID);
 }
 
 bool OpenGLShaderProgram::addShaderFromSourceCode(OpenGLShader::ShaderType type, const std::string &source)
 {
-    OpenGLShaderPtr shader = std::make_shared<OpenGLShader>(type);
-    if (shader->compileSourceCode(source)) {
-        m_shaders.push_back(shader);
-        return true;
+    if (source.empty()) {
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+        ALOGE("Empty shader source!\n");
+#endif
+        return false;
     }
-    return false;
+    ShaderSource shader = { type, source };
+    m_sources.push_back(shader);
+    return true;
 }
 
 bool OpenGLShaderProgram::addShaderFromSourceFile(OpenGLShader::ShaderType type, const std::string &filename)
 {
-    OpenGLShaderPtr shader = std::make_shared<OpenGLShader>(type);
-
-    if (shader->compileSourceFile(filename)) {
-        m_shaders.push_back(shader);
-        return true;
+    AssetView view;
+    if (!AssetHelper::Get()->AssetOpenView(filename, view)) {
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+        ALOGE("Cannot open a file: %s!\n", filename.c_str());
+#endif
+        return false;
     }
-    return false;
+    const char *source = (const char *)view.data();
+    return addShaderFromSourceCode(type, std::string(source, source + view.size()));
+}
+
+void OpenGLShaderProgram::addDefine(const std::string &name, const std::string &value)
+{
+    m_defines.push_back(std::make_pair(name, value));
 }
 
 bool OpenGLShaderProgram::link()
 {
-    if (m_isLinked) {
+    if (m_status == Unlinked) {
+        submit();
+    }
+    if (m_status == Pending) {
+        finish();
+    }
+    return m_status == Ready;
+}
+
+bool OpenGLShaderProgram::submit()
+{
+    if (m_status != Unlinked) {
+        return m_status != Failed;
+    }
+
+    // try the binary cache before touching the compiler
+    ProgramBinaryCache *cache = ProgramBinaryCache::Get();
+    m_useCache = cache->isEnabled();
+    m_cacheKey = m_useCache ? cache->makeKey(sourceHash()) : 0;
+    if (m_useCache && cache->load(m_programID, m_cacheKey)) {
+        m_status = Ready;
+        reflectUniforms();
+        trackMemory();
         return true;
     }
+
+    // compile and link without querying any status, so the driver can
+    // work on every stage (and other programs) before we sync on it
+    m_submitTime = std::chrono::steady_clock::now();
+    m_shaders.clear();
+    for (auto &source : m_sources) {
+        OpenGLShaderPtr shader = std::make_shared<OpenGLShader>(source.type);
+        if (!shader->submitSourceCode(preprocess(source.source))) {
+            m_status = Failed;
+            return false;
+        }
+        m_shaders.push_back(shader);
+    }
     for (auto shader : m_shaders) {
         glAttachShader(m_programID, shader->shaderID());
     }
+    if (m_useCache) {
+        glProgramParameteri(m_programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(m_programID);
-    if (!checkLinkErrors()) {
-        m_isLinked = true;
-        return true;
+    m_status = Pending;
+    std::chrono::duration<double, std::milli> blocked = std::chrono::steady_clock::now() - m_submitTime;
+    m_blockedMs = blocked.count();
+    return true;
+}
+
+bool OpenGLShaderProgram::isLinkComplete() const
+{
+    GLint complete = GL_FALSE;
+    glGetProgramiv(m_programID, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete == GL_TRUE;
+}
+
+OpenGLShaderProgram::Status OpenGLShaderProgram::finish()
+{
+    if (m_status != Pending) {
+        return m_status;
+    }
+    // without a completed parallel link this is where the driver makes us wait
+    auto start = std::chrono::steady_clock::now();
+    if (checkLinkErrors()) {
+        // the link log rarely says which stage failed, print the compile logs
+        for (auto shader : m_shaders) {
+            shader->checkCompileErrors();
+        }
+        m_status = Failed;
+        return m_status;
+    }
+
+    ProgramBinaryCache *cache = ProgramBinaryCache::Get();
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::milli> blocked = now - start;
+    std::chrono::duration<double, std::milli> latency = now - m_submitTime;
+    cache->recordCompile(m_blockedMs + blocked.count(), latency.count());
+
+    m_status = Ready;
+    reflectUniforms();
+    trackMemory();
+    if (m_useCache) {
+        cache->store(m_programID, m_cacheKey);
     }
-    return false;
+    return m_status;
+}
+
+std::string OpenGLShaderProgram::preprocess(const std::string &source) const
+{
+    if (m_defines.empty()) {
+        return source;
+    }
+    std::string defines;
+    for (auto &define : m_defines) {
+        defines += "#define " + define.first + " " + define.second + "\n";
+    }
+    // defines have to follow the #version line
+    size_t pos = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        pos = source.find('\n');
+        pos = (pos == std::string::npos) ? source.size() : pos + 1;
+    }
+    std::string result = source.substr(0, pos);
+    if (pos == source.size() && (pos == 0 || source[pos - 1] != '\n')) {
+        result += "\n";
+    }
+    return result + defines + source.substr(pos);
+}
+
+uint64_t OpenGLShaderProgram::sourceHash() const
+{
+    uint64_t hash = FNV64_OFFSET;
+    for (auto &source : m_sources) {
+        uint32_t type = source.type;
+        hash = HashBytes(&type, sizeof (type), hash);
+        hash = HashBytes(source.source.data(), source.source.size(), hash);
+    }
+    for (auto &define : m_defines) {
+        std::string line = define.first + "=" + define.second + ";";
+        hash = HashBytes(line.data(), line.size(), hash);
+    }
+    return hash;
 }
 
 void OpenGLShaderProgram::bind()
 {
-    glUseProgram(m_programID);
+    GLStateCache::Current()->useProgram(m_programID);
 }
 
 void OpenGLShaderProgram::release()
 {
-    glUseProgram(0);
+    GLStateCache::Current()->useProgram(0);
+}
+
+bool OpenGLShaderProgram::bindUniformBlock(const char *name, GLuint binding) const
+{
+    GLuint index = glGetUniformBlockIndex(m_programID, name);
+    if (index == GL_INVALID_INDEX) {
+        return false;
+    }
+    glUniformBlockBinding(m_programID, index, binding);
+    return true;
+}
+
+GLint OpenGLShaderProgram::uniformLocation(UniformName name) const
+{
+    if (m_uniforms.empty()) {
+        return -1;
+    }
+    uint32_t index = name.hash() & m_uniformMask;
+    while (m_uniforms[index].location != -1) {
+        if (m_uniforms[index].hash == name.hash()) {
+            return m_uniforms[index].location;
+        }
+        index = (index + 1) & m_uniformMask;
+    }
+    return -1;
 }
 
-void OpenGLShaderProgram::setBoolean(const std::string &name, bool value) const
+void OpenGLShaderProgram::setBoolean(UniformName name, bool value) const
 {
     glUniform1i(UNIFORM_LOCATION, value);
 }
 
-void OpenGLShaderProgram::setInt(const std::string &name, int value) const
+void OpenGLShaderProgram::setInt(UniformName name, int value) const
 {
     glUniform1i(UNIFORM_LOCATION, value);
 }
 
-void OpenGLShaderProgram::setFloat(const std::string &name, float value) const
+void OpenGLShaderProgram::setFloat(UniformName name, float value) const
 {
     glUniform1f(UNIFORM_LOCATION, value);
 }
 
-void OpenGLShaderProgram::setVec2(const std::string &name, const glm::vec2 &value) const
+void OpenGLShaderProgram::setVec2(UniformName name, const glm::vec2 &value) const
 {
     glUniform2fv(UNIFORM_LOCATION, 1, glm::value_ptr(value));
 }
 
-void OpenGLShaderProgram::setVec2(const std::string &name, float x, float y) const
+void OpenGLShaderProgram::setVec2(UniformName name, float x, float y) const
 {
     glUniform2f(UNIFORM_LOCATION, x, y);
 }
 
-void OpenGLShaderProgram::setVec3(const std::string &name, const glm::vec3 &value) const
+void OpenGLShaderProgram::setVec3(UniformName name, const glm::vec3 &value) const
 {
     glUniform3fv(UNIFORM_LOCATION, 1, glm::value_ptr(value));
 }
 
-void OpenGLShaderProgram::setVec3(const std::string &name, float x, float y, float z) const
+void OpenGLShaderProgram::setVec3(UniformName name, float x, float y, float z) const
 {
     glUniform3f(UNIFORM_LOCATION, x, y, z);
 }
 
-void OpenGLShaderProgram::setVec4(const std::string &name, const glm::vec4 &value) const
+void OpenGLShaderProgram::setVec4(UniformName name, const glm::vec4 &value) const
 {
     glUniform4fv(UNIFORM_LOCATION, 1, glm::value_ptr(value));
 }
 
-void OpenGLShaderProgram::setVec4(const std::string &name, float x, float y, float z, float w) const
+void OpenGLShaderProgram::setVec4(UniformName name, float x, float y, float z, float w) const
 {
     glUniform4f(UNIFORM_LOCATION, x, y, z, w);
 }
 
-void OpenGLShaderProgram::setMat2(const std::string &name, const glm::mat2 &mat) const
+void OpenGLShaderProgram::setMat2(UniformName name, const glm::mat2 &mat) const
 {
     glUniformMatrix2fv(UNIFORM_LOCATION, 1, GL_FALSE, glm::value_ptr(mat));
 }
 
-void OpenGLShaderProgram::setMat3(const std::string &name, const glm::mat3 &mat) const
+void OpenGLShaderProgram::setMat3(UniformName name, const glm::mat3 &mat) const
 {
     glUniformMatrix3fv(UNIFORM_LOCATION, 1, GL_FALSE, glm::value_ptr(mat));
 }
 
-void OpenGLShaderProgram::setMat4(const std::string &name, const glm::mat4 &mat) const
+void OpenGLShaderProgram::setMat4(UniformName name, const glm::mat4 &mat) const
 {
     glUniformMatrix4fv(UNIFORM_LOCATION, 1, GL_FALSE, glm::value_ptr(mat));
 }
 
+// the driver's binary, the closest GL gets to what a program takes
+void OpenGLShaderProgram::trackMemory() const
+{
+    GLint length = 0;
+    glGetProgramiv(m_programID, GL_PROGRAM_BINARY_LENGTH, &length);
+    GLStateCache::Current()->memory()->track(GpuMemory::PROGRAM, m_programID, GPU_MEMORY_PROGRAMS,
+                                             length > 0 ? (size_t)length : 0);
+}
+
+void OpenGLShaderProgram::reflectUniforms()
+{
+    GLint count = 0, maxNameLen = 0;
+    glGetProgramiv(m_programID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(m_programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLen);
+
+    // collect every addressable name first so the table is sized once
+    std::vector<std::pair<std::string, GLint> > entries;
+    std::vector<GLchar> buf(maxNameLen + 1);
+    for (GLint i = 0; i < count; ++i) {
+        GLint size = 0;
+        GLenum type = GL_NONE;
+        glGetActiveUniform(m_programID, i, (GLsizei)buf.size(), nullptr, &size, &type, buf.data());
+        std::string name(buf.data());
+        GLint location = glGetUniformLocation(m_programID, name.c_str());
+        if (location < 0) {
+            // member of a uniform block
+            continue;
+        }
+        entries.push_back(std::make_pair(name, location));
+
+        // arrays are reported as "name[0]", register "name" and every element
+        size_t bracket = name.rfind("[0]");
+        if (bracket != std::string::npos && bracket + 3 == name.size()) {
+            std::string base = name.substr(0, bracket);
+            entries.push_back(std::make_pair(base, location));
+            for (GLint e = 1; e < size; ++e) {
+                std::string element = base + "[" + std::to_string(e) + "]";
+                GLint elementLocation = glGetUniformLocation(m_programID, element.c_str());
+                if (elementLocation >= 0) {
+                    entries.push_back(std::make_pair(element, elementLocation));
+                }
+            }
+        }
+    }
+
+    uint32_t capacity = 1;
+    while (capacity < entries.size() * 2) {
+        capacity <<= 1;
+    }
+    UniformSlot empty = { 0, -1 };
+    m_uniforms.assign(capacity, empty);
+    m_uniformMask = capacity - 1;
+    for (auto &entry : entries) {
+        insertUniform(HashString(entry.first), entry.second);
+    }
+}
+
+void OpenGLShaderProgram::insertUniform(uint32_t hash, GLint location)
+{
+    uint32_t index = hash & m_uniformMask;
+    while (m_uniforms[index].location != -1) {
+        if (m_uniforms[index].hash == hash) {
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
+            ALOGE("Uniform hash collision, location %d is shadowed\n", location);
+#endif
+            return;
+        }
+        index = (index + 1) & m_uniformMask;
+    }
+    m_uniforms[index].hash = hash;
+    m_uniforms[index].location = location;
+}
+
 bool OpenGLShaderProgram::checkLinkErrors() const
 {
     GLint success = GL_FALSE;
-    glGetShaderiv(m_programID, GL_LINK_STATUS, &success);
+    glGetProgramiv(m_programID, GL_LINK_STATUS, &success);
     if (success != GL_TRUE) {
         GLint infoLogLen = 0;
-        glGetShaderiv(m_programID, GL_INFO_LOG_LENGTH, &infoLogLen);
+        glGetProgramiv(m_programID, GL_INFO_LOG_LENGTH, &infoLogLen);
         if (infoLogLen > 0) {
             GLchar *info = new GLchar[infoLogLen];
             glGetProgramInfoLog(m_programID, infoLogLen, nullptr, info);
-#ifdef __ANDROID__
+#if defined(__ANDROID__) || defined(QVIEWER_HOST)
             ALOGE("Could not link shader:\n%s\n", info);
 #endif
             delete [] info;
@@ -0,0 +1,161 @@
+#include "ProgramBinaryCache.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "HashUtil.h"
+#include "LogUtil.h"
+
+namespace util {
+
+static const uint32_t CACHE_MAGIC = 0x42505651; // "QVPB"
+static const uint32_t CACHE_VERSION = 1;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t checksum;
+    uint32_t format;
+    uint32_t size;
+};
+
+ProgramBinaryCache *ProgramBinaryCache::Get() {
+    static ProgramBinaryCache cache;
+    return &cache;
+}
+
+void ProgramBinaryCache::Init(const std::string &cacheDir) {
+    m_cacheDir = cacheDir;
+    if (!m_cacheDir.empty() && m_cacheDir[m_cacheDir.size() - 1] != '/') {
+        m_cacheDir.append("/");
+    }
+}
+
+bool ProgramBinaryCache::isEnabled() {
+    if (m_cacheDir.empty()) {
+        return false;
+    }
+    if (!m_formatsChecked) {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        m_supported = formats > 0;
+        m_formatsChecked = true;
+    }
+    return m_supported;
+}
+
+uint64_t ProgramBinaryCache::makeKey(uint64_t sourceHash) const {
+    uint64_t key = sourceHash;
+    const GLenum names[] = { GL_RENDERER, GL_VERSION };
+    for (GLenum name : names) {
+        const char *str = (const char *)glGetString(name);
+        if (str) {
+            key = HashBytes(str, strlen(str), key);
+        }
+    }
+    return key;
+}
+
+bool ProgramBinaryCache::load(GLuint program, uint64_t key) {
+    auto start = std::chrono::steady_clock::now();
+
+    FILE *file = fopen(entryPath(key).c_str(), "rb");
+    if (!file) {
+        m_stats.misses++;
+        return false;
+    }
+
+    // the size in the header must account for the rest of the file, a
+    // corrupted one must not make us allocate whatever it says
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        length = ftell(file);
+    }
+    CacheHeader header;
+    std::vector<uint8_t> binary;
+    bool valid = length >= (long)sizeof (header) && fseek(file, 0, SEEK_SET) == 0 &&
+            fread(&header, sizeof (header), 1, file) == 1 &&
+            header.magic == CACHE_MAGIC && header.version == CACHE_VERSION &&
+            header.key == key &&
+            (uint64_t)header.size == (uint64_t)length - sizeof (header);
+    if (valid) {
+        binary.resize(header.size);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size() &&
+                HashBytes(binary.data(), binary.size()) == header.checksum;
+    }
+    fclose(file);
+
+    GLint success = GL_FALSE;
+    if (valid) {
+        glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+    }
+    if (success != GL_TRUE) {
+        // driver update or corrupted file, drop it and compile from source
+        ALOGV("Discarding invalid program binary %016llx", (unsigned long long)key);
+        remove(entryPath(key).c_str());
+        m_stats.invalid++;
+        m_stats.misses++;
+        return false;
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    m_stats.loadMs += elapsed.count();
+    m_stats.hits++;
+    return true;
+}
+
+bool ProgramBinaryCache::store(GLuint program, uint64_t key) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return false;
+    }
+
+    std::vector<uint8_t> binary(length);
+    GLenum format = GL_NONE;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    binary.resize(length);
+
+    CacheHeader header;
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.checksum = HashBytes(binary.data(), binary.size());
+    header.format = format;
+    header.size = (uint32_t)binary.size();
+
+    // write to a temp file first so a crash never leaves a truncated entry
+    std::string path = entryPath(key);
+    std::string tmpPath = path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (!file) {
+        ALOGE("Cannot open a file: %s!", tmpPath.c_str());
+        return false;
+    }
+    bool written = fwrite(&header, sizeof (header), 1, file) == 1 &&
+            fwrite(binary.data(), 1, binary.size(), file) == binary.size();
+    written = (fclose(file) == 0) && written;
+    if (!written || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    m_stats.stores++;
+    return true;
+}
+
+ProgramBinaryCache::ProgramBinaryCache() :
+    m_formatsChecked(false), m_supported(false) {
+}
+
+std::string ProgramBinaryCache::entryPath(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof (name), "%016llx.bin", (unsigned long long)key);
+    return m_cacheDir + name;
+}
+
+} // namespace util
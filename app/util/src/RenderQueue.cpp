@@ -0,0 +1,152 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "GLStateCache.h"
+
+namespace util {
+
+uint64_t RenderQueue::MakeKey(uint32_t pass, bool translucent, uint32_t program, uint32_t material,
+        uint32_t vao, float depth) {
+    const uint64_t depthMax = (1ull << DEPTH_BITS) - 1;
+    uint64_t z = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * depthMax);
+    uint64_t state = (uint64_t)(program & ((1u << PROGRAM_BITS) - 1));
+    state = state << MATERIAL_BITS | (material & ((1u << MATERIAL_BITS) - 1));
+    state = state << VAO_BITS | (vao & ((1u << VAO_BITS) - 1));
+
+    uint64_t key = (uint64_t)(pass & ((1u << PASS_BITS) - 1)) << 1 | (translucent ? 1 : 0);
+    if (translucent) {
+        // far first
+        key = key << DEPTH_BITS | (depthMax - z);
+        key = key << (PROGRAM_BITS + MATERIAL_BITS + VAO_BITS) | state;
+    } else {
+        key = key << (PROGRAM_BITS + MATERIAL_BITS + VAO_BITS) | state;
+        key = key << DEPTH_BITS | z;
+    }
+    return key;
+}
+
+void RenderQueue::clear() {
+    m_packets.clear();
+    m_items.clear();
+}
+
+void RenderQueue::submit(uint64_t key, const DrawPacket &packet) {
+    SortItem item = { key, (uint32_t)m_packets.size() };
+    m_items.push_back(item);
+    m_packets.push_back(packet);
+}
+
+void RenderQueue::countStateChanges(const std::vector<SortItem> &order, uint32_t &programs, uint32_t &vaos,
+        uint32_t &textures) const {
+    programs = vaos = textures = 0;
+    GLuint program = 0, vao = 0, texture = 0;
+    for (auto &item : order) {
+        const DrawPacket &packet = m_packets[item.index];
+        programs += packet.Program != program;
+        vaos += packet.VAO != vao;
+        textures += packet.Texture != texture;
+        program = packet.Program;
+        vao = packet.VAO;
+        texture = packet.Texture;
+    }
+}
+
+// LSD radix sort on bytes, stable, passes where every key has the same
+// byte are skipped; keys mostly differ in a few fields only
+void RenderQueue::sort() {
+    auto start = std::chrono::steady_clock::now();
+    m_stats = RenderQueueStats();
+    m_stats.Packets = m_packets.size();
+    countStateChanges(m_items, m_stats.UnsortedProgramChanges, m_stats.UnsortedVAOChanges,
+                      m_stats.UnsortedTextureChanges);
+
+    uint32_t counts[8][256] = {};
+    for (auto &item : m_items) {
+        for (int d = 0; d < 8; ++d) {
+            counts[d][(item.key >> (d * 8)) & 0xff]++;
+        }
+    }
+    m_scratch.resize(m_items.size());
+    for (int d = 0; d < 8; ++d) {
+        uint32_t offsets[256];
+        uint32_t sum = 0;
+        bool single = false;
+        for (int b = 0; b < 256; ++b) {
+            single = single || counts[d][b] == m_items.size();
+            offsets[b] = sum;
+            sum += counts[d][b];
+        }
+        if (single) {
+            continue;
+        }
+        for (auto &item : m_items) {
+            m_scratch[offsets[(item.key >> (d * 8)) & 0xff]++] = item;
+        }
+        m_items.swap(m_scratch);
+    }
+
+    countStateChanges(m_items, m_stats.ProgramChanges, m_stats.VAOChanges, m_stats.TextureChanges);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    m_stats.SortMs = elapsed.count();
+}
+
+// binds go through the state cache, which drops the ones the sort made redundant
+void RenderQueue::execute() {
+    execute(0, m_items.size());
+}
+
+void RenderQueue::execute(uint32_t pass) {
+    // sorted, the pass is the top of the key
+    const uint32_t shift = 64 - PASS_BITS;
+    size_t begin = 0;
+    while (begin < m_items.size() && (m_items[begin].key >> shift) < pass) {
+        begin++;
+    }
+    size_t end = begin;
+    while (end < m_items.size() && (m_items[end].key >> shift) == pass) {
+        end++;
+    }
+    execute(begin, end);
+}
+
+void RenderQueue::execute(size_t begin, size_t end) {
+    GLStateCache *state = GLStateCache::Current();
+    for (size_t i = begin; i < end; ++i) {
+        const DrawPacket &packet = m_packets[m_items[i].index];
+        state->useProgram(packet.Program);
+        state->bindVertexArray(packet.VAO);
+        state->activeTexture(GL_TEXTURE0);
+        state->bindTexture(GL_TEXTURE_2D, packet.Texture);
+        if (packet.UniformBuffer) {
+            state->bindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BINDING, packet.UniformBuffer,
+                                   packet.UniformOffset, packet.UniformSize);
+        }
+        if (!packet.InstanceCount) {
+            glDrawElements(GL_TRIANGLES, packet.IndexCount, packet.IndexType, (const void *)packet.IndexOffset);
+            m_stats.DrawCalls++;
+            continue;
+        }
+        state->bindBuffer(GL_ARRAY_BUFFER, packet.InstanceBuffer);
+        // no base instance in GLES, the attributes point at the first one
+        const GLsizei stride = INSTANCE_ROWS * sizeof (glm::vec4);
+        for (GLuint r = 0; r < INSTANCE_ROWS; ++r) {
+            glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + r);
+            glVertexAttribPointer(INSTANCE_ATTRIBUTE + r, 4, GL_FLOAT, GL_FALSE, stride,
+                                  (const void *)(packet.InstanceOffset + r * sizeof (glm::vec4)));
+        }
+        glDrawElementsInstanced(GL_TRIANGLES, packet.IndexCount, packet.IndexType,
+                                (const void *)packet.IndexOffset, packet.InstanceCount);
+        m_stats.DrawCalls++;
+        // the VAO is shared with plain draws, which must not fetch from a
+        // ring region of an earlier frame
+        for (GLuint r = 0; r < INSTANCE_ROWS; ++r) {
+            glDisableVertexAttribArray(INSTANCE_ATTRIBUTE + r);
+        }
+    }
+    state->bindVertexArray(0);
+    state->bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+} // namespace util
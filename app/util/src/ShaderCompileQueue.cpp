@@ -0,0 +1,52 @@
+#include "ShaderCompileQueue.h"
+
+namespace util {
+
+ShaderCompileQueue *ShaderCompileQueue::Get() {
+    static ShaderCompileQueue queue;
+    return &queue;
+}
+
+void ShaderCompileQueue::init(bool parallel) {
+    m_parallel = parallel;
+    m_pending.clear();
+}
+
+void ShaderCompileQueue::enqueue(const OpenGLShaderProgramPtr &program) {
+    if (!program) {
+        return;
+    }
+    program->submit();
+    if (program->status() == OpenGLShaderProgram::Pending) {
+        m_pending.push_back(program);
+    }
+}
+
+void ShaderCompileQueue::poll() {
+    auto it = m_pending.begin();
+    while (it != m_pending.end()) {
+        if (!m_parallel || (*it)->isLinkComplete()) {
+            (*it)->finish();
+            it = m_pending.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ShaderCompileQueue::finish() {
+    for (auto &program : m_pending) {
+        program->finish();
+    }
+    m_pending.clear();
+}
+
+void ShaderCompileQueue::clear() {
+    m_pending.clear();
+}
+
+ShaderCompileQueue::ShaderCompileQueue() :
+    m_parallel(false) {
+}
+
+} // namespace util
@@ -0,0 +1,366 @@
+#include "SoftwareOcclusion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OCCLUSION_NEON 1
+#endif
+
+namespace util {
+
+namespace {
+
+// 4 wide helpers, comparisons return all-ones lanes
+#if defined(OCCLUSION_SSE)
+typedef __m128 Float4;
+inline Float4 set1(float v) { return _mm_set1_ps(v); }
+inline Float4 set4(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+inline Float4 load4(const float *p) { return _mm_loadu_ps(p); }
+inline Float4 add4(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+inline Float4 and4(Float4 a, Float4 b) { return _mm_and_ps(a, b); }
+inline Float4 greaterEqual4(Float4 a, Float4 b) { return _mm_cmpge_ps(a, b); }
+inline Float4 less4(Float4 a, Float4 b) { return _mm_cmplt_ps(a, b); }
+inline uint32_t mask4(Float4 m) { return (uint32_t)_mm_movemask_ps(m); }
+#elif defined(OCCLUSION_NEON)
+typedef float32x4_t Float4;
+inline Float4 set1(float v) { return vdupq_n_f32(v); }
+inline Float4 set4(float a, float b, float c, float d) {
+    const float v[4] = { a, b, c, d };
+    return vld1q_f32(v);
+}
+inline Float4 load4(const float *p) { return vld1q_f32(p); }
+inline Float4 add4(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+inline Float4 and4(Float4 a, Float4 b) {
+    return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)));
+}
+inline Float4 greaterEqual4(Float4 a, Float4 b) { return vreinterpretq_f32_u32(vcgeq_f32(a, b)); }
+inline Float4 less4(Float4 a, Float4 b) { return vreinterpretq_f32_u32(vcltq_f32(a, b)); }
+inline uint32_t mask4(Float4 m) {
+    const uint32_t bits[4] = { 1, 2, 4, 8 };
+    uint32x4_t masked = vandq_u32(vreinterpretq_u32_f32(m), vld1q_u32(bits));
+#if defined(__aarch64__)
+    return vaddvq_u32(masked);
+#else
+    uint32x2_t pair = vadd_u32(vget_low_u32(masked), vget_high_u32(masked));
+    return vget_lane_u32(vpadd_u32(pair, pair), 0);
+#endif
+}
+#else
+struct Float4 {
+    float v[4];
+};
+inline Float4 set4(float a, float b, float c, float d) {
+    Float4 r = {{ a, b, c, d }};
+    return r;
+}
+inline Float4 set1(float v) { return set4(v, v, v, v); }
+inline Float4 load4(const float *p) { return set4(p[0], p[1], p[2], p[3]); }
+inline Float4 add4(Float4 a, Float4 b) {
+    return set4(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]);
+}
+// masks are 0.0 or 1.0 here
+inline Float4 and4(Float4 a, Float4 b) {
+    return set4(a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]);
+}
+inline Float4 greaterEqual4(Float4 a, Float4 b) {
+    return set4(a.v[0] >= b.v[0], a.v[1] >= b.v[1], a.v[2] >= b.v[2], a.v[3] >= b.v[3]);
+}
+inline Float4 less4(Float4 a, Float4 b) {
+    return set4(a.v[0] < b.v[0], a.v[1] < b.v[1], a.v[2] < b.v[2], a.v[3] < b.v[3]);
+}
+inline uint32_t mask4(Float4 m) {
+    return (m.v[0] != 0.0f) | (m.v[1] != 0.0f) << 1 | (m.v[2] != 0.0f) << 2 | (m.v[3] != 0.0f) << 3;
+}
+#endif
+
+// tile rows per rasterizer job
+const uint32_t BAND_ROWS = 2;
+// occludees per test job
+const uint32_t TEST_CHUNK = 64;
+const float MIN_W = 1e-5f;
+
+inline double elapsedMs(const std::chrono::steady_clock::time_point &start) {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+} // namespace
+
+SoftwareOcclusionCuller::SoftwareOcclusionCuller(uint32_t width, uint32_t height, unsigned int threads) :
+    m_tilesX((width + TILE_WIDTH - 1) / TILE_WIDTH),
+    m_tilesY((height + TILE_HEIGHT - 1) / TILE_HEIGHT),
+    m_pool(threads) {
+    m_zMax0.resize(m_tilesX * m_tilesY);
+    m_zMax1.resize(m_tilesX * m_tilesY);
+    m_mask.resize(m_tilesX * m_tilesY);
+    clear();
+}
+
+void SoftwareOcclusionCuller::clear() {
+    std::fill(m_zMax0.begin(), m_zMax0.end(), 1.0f);
+    std::fill(m_zMax1.begin(), m_zMax1.end(), 0.0f);
+    std::fill(m_mask.begin(), m_mask.end(), 0u);
+}
+
+void SoftwareOcclusionCuller::setupTriangles(const glm::mat4 &viewProjection,
+        const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices,
+        std::vector<Triangle> &triangles) const {
+    float width = (float)(m_tilesX * TILE_WIDTH), height = (float)(m_tilesY * TILE_HEIGHT);
+    // screen x, y, depth in [0, 1], w <= 0 marks vertices in front of the near plane
+    std::vector<glm::vec4> screen(positions.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        glm::vec4 clip = viewProjection * glm::vec4(positions[i], 1.0f);
+        if (clip.w < MIN_W || clip.z < -clip.w) {
+            screen[i].w = 0.0f;
+            continue;
+        }
+        float inv = 1.0f / clip.w;
+        screen[i] = glm::vec4((clip.x * inv * 0.5f + 0.5f) * width, (clip.y * inv * 0.5f + 0.5f) * height,
+                              std::min(1.0f, clip.z * inv * 0.5f + 0.5f), 1.0f);
+    }
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const glm::vec4 &v0 = screen[indices[i]], &v1 = screen[indices[i + 1]], &v2 = screen[indices[i + 2]];
+        // dropping an occluder triangle is always safe, so near plane
+        // crossings are not clipped
+        if (v0.w == 0.0f || v1.w == 0.0f || v2.w == 0.0f) {
+            continue;
+        }
+        // back facing or degenerate, occluders are closed meshes
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (area <= 0.0f) {
+            continue;
+        }
+        float minX = std::min(v0.x, std::min(v1.x, v2.x)), maxX = std::max(v0.x, std::max(v1.x, v2.x));
+        float minY = std::min(v0.y, std::min(v1.y, v2.y)), maxY = std::max(v0.y, std::max(v1.y, v2.y));
+        if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height) {
+            continue;
+        }
+
+        Triangle tri;
+        const glm::vec4 *v[3] = { &v0, &v1, &v2 };
+        for (int e = 0; e < 3; ++e) {
+            const glm::vec4 &p = *v[e], &q = *v[(e + 1) % 3];
+            tri.a[e] = p.y - q.y;
+            tri.b[e] = q.x - p.x;
+            tri.c[e] = p.x * q.y - q.x * p.y;
+        }
+        float inv = 1.0f / area;
+        tri.za = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * inv;
+        tri.zb = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) * inv;
+        tri.zc = v0.z - tri.za * v0.x - tri.zb * v0.y;
+        tri.zMax = std::max(v0.z, std::max(v1.z, v2.z));
+        tri.minTileX = (uint16_t)(std::max(0.0f, minX) / TILE_WIDTH);
+        tri.minTileY = (uint16_t)(std::max(0.0f, minY) / TILE_HEIGHT);
+        tri.maxTileX = (uint16_t)std::min<float>(m_tilesX - 1, maxX / TILE_WIDTH);
+        tri.maxTileY = (uint16_t)std::min<float>(m_tilesY - 1, maxY / TILE_HEIGHT);
+        triangles.push_back(tri);
+    }
+}
+
+// Merges a triangle's coverage into the tile's working layer. Once the
+// working layer covers the whole tile it replaces the reference layer; if
+// the triangle is much nearer than the working layer, the working layer is
+// dropped instead of letting it push the depth back (the MOC heuristic).
+void SoftwareOcclusionCuller::mergeTile(uint32_t tile, uint32_t coverage, float depth) {
+    float zMax0 = m_zMax0[tile];
+    if (depth >= zMax0) {
+        return;
+    }
+    float zMax1 = m_zMax1[tile];
+    uint32_t mask = m_mask[tile];
+    if (zMax1 - depth > zMax0 - zMax1) {
+        zMax1 = 0.0f;
+        mask = 0;
+    }
+    zMax1 = std::max(zMax1, depth);
+    mask |= coverage;
+    if (mask == 0xffffffffu) {
+        m_zMax0[tile] = zMax1;
+        zMax1 = 0.0f;
+        mask = 0;
+    }
+    m_zMax1[tile] = zMax1;
+    m_mask[tile] = mask;
+}
+
+void SoftwareOcclusionCuller::rasterizeBand(uint32_t band) {
+    uint32_t rowBegin = band * BAND_ROWS;
+    uint32_t rowEnd = std::min(rowBegin + BAND_ROWS, m_tilesY);
+
+    for (auto &triangles : m_triangles) {
+        for (auto &tri : triangles) {
+            if (tri.maxTileY < rowBegin || tri.minTileY >= rowEnd) {
+                continue;
+            }
+            // edge values at the 32 pixel centers relative to the tile
+            // corner, as 8 groups of 4: row j, left or right half h
+            Float4 offsets[3][8];
+            for (int e = 0; e < 3; ++e) {
+                for (int j = 0; j < 4; ++j) {
+                    float row = tri.b[e] * (j + 0.5f);
+                    for (int h = 0; h < 2; ++h) {
+                        float x = 4.0f * h + 0.5f;
+                        offsets[e][j * 2 + h] = set4(tri.a[e] * x + row, tri.a[e] * (x + 1.0f) + row,
+                                                     tri.a[e] * (x + 2.0f) + row, tri.a[e] * (x + 3.0f) + row);
+                    }
+                }
+            }
+
+            uint32_t yBegin = std::max<uint32_t>(rowBegin, tri.minTileY);
+            uint32_t yEnd = std::min<uint32_t>(rowEnd, tri.maxTileY + 1);
+            for (uint32_t ty = yBegin; ty < yEnd; ++ty) {
+                float y = (float)(ty * TILE_HEIGHT);
+                for (uint32_t tx = tri.minTileX; tx <= tri.maxTileX; ++tx) {
+                    float x = (float)(tx * TILE_WIDTH);
+                    Float4 base0 = set1(tri.a[0] * x + tri.b[0] * y + tri.c[0]);
+                    Float4 base1 = set1(tri.a[1] * x + tri.b[1] * y + tri.c[1]);
+                    Float4 base2 = set1(tri.a[2] * x + tri.b[2] * y + tri.c[2]);
+                    const Float4 zero = set1(0.0f);
+                    uint32_t coverage = 0;
+                    for (int k = 0; k < 8; ++k) {
+                        Float4 inside = and4(and4(greaterEqual4(add4(base0, offsets[0][k]), zero),
+                                                  greaterEqual4(add4(base1, offsets[1][k]), zero)),
+                                             greaterEqual4(add4(base2, offsets[2][k]), zero));
+                        coverage |= mask4(inside) << (k * 4);
+                    }
+                    if (!coverage) {
+                        continue;
+                    }
+                    // farthest point of the depth plane over the tile, a
+                    // conservative depth for every covered sample
+                    float planeMax = tri.zc + tri.za * (tri.za > 0.0f ? x + TILE_WIDTH : x) +
+                            tri.zb * (tri.zb > 0.0f ? y + TILE_HEIGHT : y);
+                    mergeTile(ty * m_tilesX + tx, coverage, std::min(tri.zMax, planeMax));
+                }
+            }
+        }
+    }
+}
+
+void SoftwareOcclusionCuller::renderOccluders(const glm::mat4 &viewProjection,
+        const std::vector<const std::vector<glm::vec3> *> &positions,
+        const std::vector<const std::vector<uint32_t> *> &indices) {
+    m_triangles.resize(positions.size());
+    m_pool.parallelFor(positions.size(), [&](uint32_t i) {
+        m_triangles[i].clear();
+        setupTriangles(viewProjection, *positions[i], *indices[i], m_triangles[i]);
+    });
+    m_stats.Occluders = positions.size();
+    m_stats.Triangles = 0;
+    for (auto &triangles : m_triangles) {
+        m_stats.Triangles += triangles.size();
+    }
+
+    uint32_t bands = (m_tilesY + BAND_ROWS - 1) / BAND_ROWS;
+    m_pool.parallelFor(bands, [this](uint32_t band) {
+        rasterizeBand(band);
+    });
+}
+
+bool SoftwareOcclusionCuller::testBox(const glm::mat4 &viewProjection, const glm::vec3 &center,
+        const glm::vec3 &extent) const {
+    float width = (float)(m_tilesX * TILE_WIDTH), height = (float)(m_tilesY * TILE_HEIGHT);
+    float minX = width, maxX = 0.0f, minY = height, maxY = 0.0f, minZ = 1.0f;
+    for (int i = 0; i < 8; ++i) {
+        glm::vec3 corner(i & 1 ? extent.x : -extent.x, i & 2 ? extent.y : -extent.y,
+                         i & 4 ? extent.z : -extent.z);
+        glm::vec4 clip = viewProjection * glm::vec4(center + corner, 1.0f);
+        // reaches the near plane, nothing to compare against
+        if (clip.w < MIN_W || clip.z < -clip.w) {
+            return true;
+        }
+        float inv = 1.0f / clip.w;
+        float x = (clip.x * inv * 0.5f + 0.5f) * width, y = (clip.y * inv * 0.5f + 0.5f) * height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minZ = std::min(minZ, clip.z * inv * 0.5f + 0.5f);
+    }
+    if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height) {
+        return false;
+    }
+
+    uint32_t x0 = (uint32_t)(std::max(0.0f, minX) / TILE_WIDTH);
+    uint32_t x1 = (uint32_t)std::min<float>(m_tilesX - 1, maxX / TILE_WIDTH);
+    uint32_t y0 = (uint32_t)(std::max(0.0f, minY) / TILE_HEIGHT);
+    uint32_t y1 = (uint32_t)std::min<float>(m_tilesY - 1, maxY / TILE_HEIGHT);
+    Float4 depth = set1(minZ);
+    for (uint32_t ty = y0; ty <= y1; ++ty) {
+        const float *row = &m_zMax0[ty * m_tilesX];
+        uint32_t tx = x0;
+        for (; tx + 4 <= x1 + 1; tx += 4) {
+            if (mask4(less4(depth, load4(row + tx)))) {
+                return true;
+            }
+        }
+        for (; tx <= x1; ++tx) {
+            if (minZ < row[tx]) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void SoftwareOcclusionCuller::cull(const glm::mat4 &viewProjection,
+        const std::vector<ModelDrawable *> &occluders, const std::vector<ModelDrawable *> &occludees) {
+    auto start = std::chrono::steady_clock::now();
+    m_stats = SoftwareOcclusionStats();
+    clear();
+    std::vector<const std::vector<glm::vec3> *> positions;
+    std::vector<const std::vector<uint32_t> *> indices;
+    for (auto model : occluders) {
+        if (!model->OccluderIndices.empty()) {
+            positions.push_back(&model->OccluderPositions);
+            indices.push_back(&model->OccluderIndices);
+        }
+    }
+    renderOccluders(viewProjection, positions, indices);
+    m_stats.RasterMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    uint32_t chunks = (occludees.size() + TEST_CHUNK - 1) / TEST_CHUNK;
+    m_pool.parallelFor(chunks, [&](uint32_t chunk) {
+        size_t end = std::min<size_t>(occludees.size(), (chunk + 1) * TEST_CHUNK);
+        for (size_t i = chunk * TEST_CHUNK; i < end; ++i) {
+            ModelDrawable *model = occludees[i];
+            model->isCulled = !testBox(viewProjection, model->WorldCenter, model->WorldExtent);
+        }
+    });
+    m_stats.Occludees = occludees.size();
+    for (auto model : occludees) {
+        m_stats.Culled += model->isCulled;
+    }
+    m_stats.TestMs = elapsedMs(start);
+}
+
+void SetOccluderGeometry(ModelDrawable &model, const PackedMeshView &view, uint32_t lod) {
+    const PackedMeshHeader *header = view.Header;
+    lod = std::min(lod, header->lodCount - 1);
+    model.OccluderPositions.resize(header->vertexCount);
+    DecodePositions(view, model.OccluderPositions.data());
+    for (auto &position : model.OccluderPositions) {
+        position = glm::vec3(model.Transform * glm::vec4(position, 1.0f));
+    }
+
+    uint32_t offset = view.Lods[lod].indexOffset, count = view.Lods[lod].indexCount;
+    model.OccluderIndices.resize(count);
+    if (view.indexType() == GL_UNSIGNED_SHORT) {
+        const uint16_t *indices = reinterpret_cast<const uint16_t *>(view.Indices) + offset;
+        std::copy(indices, indices + count, model.OccluderIndices.begin());
+    } else {
+        memcpy(model.OccluderIndices.data(), reinterpret_cast<const uint32_t *>(view.Indices) + offset,
+               count * sizeof (uint32_t));
+    }
+}
+
+} // namespace util
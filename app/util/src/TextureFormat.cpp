@@ -0,0 +1,437 @@
+#include "TextureFormat.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "GLStateCache.h"
+#include "LogUtil.h"
+
+namespace util {
+
+static const uint8_t KTX1_IDENTIFIER[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+static const uint8_t KTX2_IDENTIFIER[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+static const uint32_t KTX1_ENDIANNESS = 0x04030201;
+
+struct Ktx1Header {
+    uint8_t identifier[12];
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+// levelCount entries follow the header, level 0 first
+struct Ktx2Level {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// VkFormat values of the formats we can upload
+enum {
+    VK_FORMAT_R8_UNORM = 9,
+    VK_FORMAT_R8G8_UNORM = 16,
+    VK_FORMAT_R8G8B8_UNORM = 23,
+    VK_FORMAT_R8G8B8_SRGB = 29,
+    VK_FORMAT_R8G8B8A8_UNORM = 37,
+    VK_FORMAT_R8G8B8A8_SRGB = 43,
+    VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK = 147,
+    VK_FORMAT_EAC_R11G11_SNORM_BLOCK = 156,
+    VK_FORMAT_ASTC_4x4_UNORM_BLOCK = 157,
+    VK_FORMAT_ASTC_12x12_SRGB_BLOCK = 184
+};
+
+// footprints of the ASTC formats in GL (and VkFormat) order
+static const uint8_t ASTC_BLOCKS[14][2] = {
+    {4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6},
+    {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12}
+};
+
+static size_t align4(size_t size) {
+    return (size + 3) & ~size_t(3);
+}
+
+static int32_t levelExtent(int32_t size, uint32_t level) {
+    return level < 31 ? std::max(1, size >> level) : 1;
+}
+
+// larger than any GLES implementation samples, keeps level sizes within
+// a 32 bit size_t
+static const uint32_t MAX_TEXTURE_EXTENT = 16384;
+
+// the full chain down to 1x1
+static uint32_t maxLevels(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+        levels++;
+    }
+    return levels;
+}
+
+static bool isAstc(GLenum internalFormat, uint32_t &index) {
+    if (internalFormat >= GL_COMPRESSED_RGBA_ASTC_4x4 && internalFormat <= GL_COMPRESSED_RGBA_ASTC_12x12) {
+        index = internalFormat - GL_COMPRESSED_RGBA_ASTC_4x4;
+        return true;
+    }
+    if (internalFormat >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4 &&
+            internalFormat <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12) {
+        index = internalFormat - GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4;
+        return true;
+    }
+    return false;
+}
+
+uint32_t TextureFormatFamily(GLenum internalFormat) {
+    uint32_t astc;
+    if (isAstc(internalFormat, astc)) {
+        return TEXTURE_ASTC;
+    }
+    if (internalFormat >= GL_COMPRESSED_R11_EAC && internalFormat <= GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC) {
+        return TEXTURE_ETC2;
+    }
+    switch (internalFormat) {
+    case GL_R8:
+    case GL_RG8:
+    case GL_RGB8:
+    case GL_SRGB8:
+    case GL_RGBA8:
+    case GL_SRGB8_ALPHA8:
+    case GL_RGB:
+    case GL_RGBA:
+        return TEXTURE_UNCOMPRESSED;
+    default:
+        return 0;
+    }
+}
+
+size_t TextureLevelSize(GLenum internalFormat, int32_t width, int32_t height) {
+    size_t blockBytes = 0;
+    int32_t blockWidth = 4, blockHeight = 4;
+    uint32_t astc;
+    if (isAstc(internalFormat, astc)) {
+        blockBytes = 16;
+        blockWidth = ASTC_BLOCKS[astc][0];
+        blockHeight = ASTC_BLOCKS[astc][1];
+    } else {
+        switch (internalFormat) {
+        case GL_COMPRESSED_R11_EAC:
+        case GL_COMPRESSED_SIGNED_R11_EAC:
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_SRGB8_ETC2:
+        case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+        case GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+            blockBytes = 8;
+            break;
+        case GL_COMPRESSED_RG11_EAC:
+        case GL_COMPRESSED_SIGNED_RG11_EAC:
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:
+        case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+            blockBytes = 16;
+            break;
+        case GL_R8:
+            return (size_t)width * height;
+        case GL_RG8:
+            return (size_t)width * height * 2;
+        case GL_RGB8:
+        case GL_SRGB8:
+        case GL_RGB:
+            return (size_t)width * height * 3;
+        case GL_RGBA8:
+        case GL_SRGB8_ALPHA8:
+        case GL_RGBA:
+            return (size_t)width * height * 4;
+        default:
+            return 0;
+        }
+    }
+    size_t blocksX = (width + blockWidth - 1) / blockWidth;
+    size_t blocksY = (height + blockHeight - 1) / blockHeight;
+    return blocksX * blocksY * blockBytes;
+}
+
+size_t TextureMemorySize(const TextureView &view) {
+    size_t size = 0;
+    for (const TextureLevel &level : view.Levels) {
+        size += TextureLevelSize(view.InternalFormat, level.Width, level.Height);
+    }
+    if (view.GenerateMipmaps) {
+        // the rest of the chain adds a third
+        size += size / 3;
+    }
+    return size;
+}
+
+// sized internal format, pixel format and type of a VkFormat
+static bool vkFormatToGL(uint32_t vkFormat, GLenum &internalFormat, GLenum &format, GLenum &type) {
+    format = 0;
+    type = 0;
+    if (vkFormat >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && vkFormat <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) {
+        // unorm and srgb alternate
+        uint32_t index = vkFormat - VK_FORMAT_ASTC_4x4_UNORM_BLOCK;
+        internalFormat = (index & 1 ? GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4 : GL_COMPRESSED_RGBA_ASTC_4x4) + index / 2;
+        return true;
+    }
+    if (vkFormat >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && vkFormat <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK) {
+        static const GLenum ETC2_FORMATS[] = {
+            GL_COMPRESSED_RGB8_ETC2, GL_COMPRESSED_SRGB8_ETC2,
+            GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+            GL_COMPRESSED_RGBA8_ETC2_EAC, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC,
+            GL_COMPRESSED_R11_EAC, GL_COMPRESSED_SIGNED_R11_EAC,
+            GL_COMPRESSED_RG11_EAC, GL_COMPRESSED_SIGNED_RG11_EAC
+        };
+        internalFormat = ETC2_FORMATS[vkFormat - VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK];
+        return true;
+    }
+    type = GL_UNSIGNED_BYTE;
+    switch (vkFormat) {
+    case VK_FORMAT_R8_UNORM:
+        internalFormat = GL_R8;
+        format = GL_RED;
+        return true;
+    case VK_FORMAT_R8G8_UNORM:
+        internalFormat = GL_RG8;
+        format = GL_RG;
+        return true;
+    case VK_FORMAT_R8G8B8_UNORM:
+        internalFormat = GL_RGB8;
+        format = GL_RGB;
+        return true;
+    case VK_FORMAT_R8G8B8_SRGB:
+        internalFormat = GL_SRGB8;
+        format = GL_RGB;
+        return true;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+        internalFormat = GL_RGBA8;
+        format = GL_RGBA;
+        return true;
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        internalFormat = GL_SRGB8_ALPHA8;
+        format = GL_RGBA;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// expected size of a level as stored, with the container's row padding
+static size_t storedLevelSize(const TextureView &view, int32_t width, int32_t height) {
+    size_t size = TextureLevelSize(view.InternalFormat, width, height);
+    if (view.isCompressed() || view.RowAlignment <= 1) {
+        return size;
+    }
+    size_t row = size / height;
+    return align4(row) * height;
+}
+
+static bool parseKtx1(const uint8_t *data, size_t size, TextureView &view) {
+    if (size < sizeof (Ktx1Header)) {
+        return false;
+    }
+    const Ktx1Header *header = reinterpret_cast<const Ktx1Header *>(data);
+    if (header->endianness != KTX1_ENDIANNESS) {
+        ALOGE("KTX file of the other endianness!");
+        return false;
+    }
+    if (header->pixelWidth == 0 || header->pixelHeight == 0 || header->pixelDepth > 1 ||
+            header->numberOfArrayElements > 1 || header->numberOfFaces != 1) {
+        ALOGE("Only 2D KTX textures are supported!");
+        return false;
+    }
+    if (header->pixelWidth > MAX_TEXTURE_EXTENT || header->pixelHeight > MAX_TEXTURE_EXTENT ||
+            header->numberOfMipmapLevels > maxLevels(header->pixelWidth, header->pixelHeight)) {
+        ALOGE("Invalid KTX size %ux%u with %u levels!", header->pixelWidth, header->pixelHeight,
+              header->numberOfMipmapLevels);
+        return false;
+    }
+    view.InternalFormat = header->glInternalFormat;
+    view.Format = header->glFormat;
+    view.Type = header->glType;
+    view.Width = header->pixelWidth;
+    view.Height = header->pixelHeight;
+    view.RowAlignment = 4;
+    if (!TextureLevelSize(view.InternalFormat, 1, 1) || (view.isCompressed() != (view.Type == 0))) {
+        ALOGE("Unsupported KTX format 0x%x!", view.InternalFormat);
+        return false;
+    }
+    uint32_t levels = std::max(header->numberOfMipmapLevels, 1u);
+    view.GenerateMipmaps = header->numberOfMipmapLevels == 0 && !view.isCompressed();
+
+    // 64 bit, the sizes come from the file and size_t may be 32 bit
+    uint64_t offset = sizeof (Ktx1Header) + (uint64_t)header->bytesOfKeyValueData;
+    view.Levels.resize(levels);
+    for (uint32_t i = 0; i < levels; ++i) {
+        if (offset + sizeof (uint32_t) > size) {
+            ALOGE("Truncated KTX data!");
+            return false;
+        }
+        uint32_t imageSize;
+        memcpy(&imageSize, data + offset, sizeof (imageSize));
+        offset += sizeof (uint32_t);
+        TextureLevel &level = view.Levels[i];
+        level.Width = levelExtent(view.Width, i);
+        level.Height = levelExtent(view.Height, i);
+        if (imageSize < storedLevelSize(view, level.Width, level.Height) || offset + imageSize > size) {
+            ALOGE("Truncated KTX data!");
+            return false;
+        }
+        level.Data = data + offset;
+        level.Size = imageSize;
+        offset += align4(imageSize);
+    }
+    return true;
+}
+
+static bool parseKtx2(const uint8_t *data, size_t size, TextureView &view) {
+    if (size < sizeof (Ktx2Header)) {
+        return false;
+    }
+    const Ktx2Header *header = reinterpret_cast<const Ktx2Header *>(data);
+    if (header->supercompressionScheme != 0) {
+        ALOGE("Supercompressed KTX2 textures need a transcoder, scheme %u!", header->supercompressionScheme);
+        return false;
+    }
+    if (header->pixelWidth == 0 || header->pixelHeight == 0 || header->pixelDepth > 1 ||
+            header->layerCount > 1 || header->faceCount != 1) {
+        ALOGE("Only 2D KTX2 textures are supported!");
+        return false;
+    }
+    if (header->pixelWidth > MAX_TEXTURE_EXTENT || header->pixelHeight > MAX_TEXTURE_EXTENT ||
+            header->levelCount > maxLevels(header->pixelWidth, header->pixelHeight)) {
+        ALOGE("Invalid KTX2 size %ux%u with %u levels!", header->pixelWidth, header->pixelHeight,
+              header->levelCount);
+        return false;
+    }
+    if (!vkFormatToGL(header->vkFormat, view.InternalFormat, view.Format, view.Type)) {
+        ALOGE("Unsupported KTX2 format %u!", header->vkFormat);
+        return false;
+    }
+    view.Width = header->pixelWidth;
+    view.Height = header->pixelHeight;
+    view.RowAlignment = 1;
+    uint32_t levels = std::max(header->levelCount, 1u);
+    view.GenerateMipmaps = header->levelCount == 0 && !view.isCompressed();
+
+    if (sizeof (Ktx2Header) + levels * sizeof (Ktx2Level) > size) {
+        ALOGE("Truncated KTX2 data!");
+        return false;
+    }
+    const Ktx2Level *index = reinterpret_cast<const Ktx2Level *>(data + sizeof (Ktx2Header));
+    view.Levels.resize(levels);
+    for (uint32_t i = 0; i < levels; ++i) {
+        TextureLevel &level = view.Levels[i];
+        level.Width = levelExtent(view.Width, i);
+        level.Height = levelExtent(view.Height, i);
+        if (index[i].byteLength < storedLevelSize(view, level.Width, level.Height) ||
+                index[i].byteOffset > size || index[i].byteLength > size - index[i].byteOffset) {
+            ALOGE("Truncated KTX2 data!");
+            return false;
+        }
+        level.Data = data + index[i].byteOffset;
+        level.Size = (size_t)index[i].byteLength;
+    }
+    return true;
+}
+
+bool ParseKtx(const uint8_t *data, size_t size, TextureView &view) {
+    view = TextureView();
+    if (!data || size < sizeof (KTX1_IDENTIFIER)) {
+        return false;
+    }
+    bool parsed;
+    if (!memcmp(data, KTX1_IDENTIFIER, sizeof (KTX1_IDENTIFIER))) {
+        parsed = parseKtx1(data, size, view);
+    } else if (!memcmp(data, KTX2_IDENTIFIER, sizeof (KTX2_IDENTIFIER))) {
+        parsed = parseKtx2(data, size, view);
+    } else {
+        ALOGE("Not a KTX file!");
+        return false;
+    }
+    if (!parsed) {
+        view = TextureView();
+    }
+    return parsed;
+}
+
+bool UploadTexture(const TextureView &view, GLuint &texture) {
+    if (view.Levels.empty()) {
+        return false;
+    }
+    // report only our own errors
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    GLStateCache *state = GLStateCache::Current();
+    glGenTextures(1, &texture);
+    state->bindTexture(GL_TEXTURE_2D, texture);
+    if (!view.isCompressed()) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, view.RowAlignment);
+    }
+    GLint levels = (GLint)view.Levels.size();
+    for (GLint i = 0; i < levels; ++i) {
+        const TextureLevel &level = view.Levels[i];
+        if (view.isCompressed()) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, view.InternalFormat, level.Width, level.Height, 0,
+                                   (GLsizei)level.Size, level.Data);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, i, view.InternalFormat, level.Width, level.Height, 0,
+                         view.Format, view.Type, level.Data);
+        }
+    }
+    if (!view.isCompressed()) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    if (view.GenerateMipmaps) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    } else {
+        // a partial chain is complete up to its last level
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+    bool mipmapped = levels > 1 || view.GenerateMipmaps;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    state->bindTexture(GL_TEXTURE_2D, 0);
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        ALOGE("Unable to upload a %dx%d texture of format 0x%x, error 0x%x!", view.Width, view.Height,
+              view.InternalFormat, error);
+        state->deleteTextures(1, &texture);
+        texture = 0;
+        return false;
+    }
+    state->memory()->track(GpuMemory::TEXTURE, texture, GPU_MEMORY_TEXTURES, TextureMemorySize(view));
+    return true;
+}
+
+} // namespace util
@@ -0,0 +1,195 @@
+#include "TextureManager.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "AssetHelper.h"
+#include "AsyncLoader.h"
+#include "GLStateCache.h"
+#include "TextureStreamer.h"
+#include "LogUtil.h"
+
+namespace util {
+
+// asset suffixes in order of preference
+static const struct {
+    uint32_t Family;
+    const char *Suffix;
+} VARIANTS[] = {
+    { TEXTURE_ASTC, ".astc.ktx2" },
+    { TEXTURE_ASTC, ".astc.ktx" },
+    { TEXTURE_ETC2, ".etc2.ktx2" },
+    { TEXTURE_ETC2, ".etc2.ktx" },
+    { TEXTURE_UNCOMPRESSED, ".ktx2" },
+    { TEXTURE_UNCOMPRESSED, ".ktx" }
+};
+
+static bool endsWith(const std::string &name, const char *suffix) {
+    size_t length = strlen(suffix);
+    return name.size() >= length && !name.compare(name.size() - length, length, suffix);
+}
+
+Texture::~Texture() {
+    if (Id) {
+        GLStateCache::Current()->deleteTextures(1, &Id);
+    }
+}
+
+TextureManager *TextureManager::Get() {
+    static TextureManager manager;
+    return &manager;
+}
+
+TextureManager::TextureManager() :
+    m_formats(TEXTURE_UNCOMPRESSED), m_fallbacks(0), m_failed(0) {
+}
+
+void TextureManager::init(uint32_t formats) {
+    m_formats = formats | TEXTURE_UNCOMPRESSED;
+    m_textures.clear();
+    m_fallbacks = 0;
+    m_failed = 0;
+}
+
+uint32_t TextureManager::preferredFamily() const {
+    for (const auto &variant : VARIANTS) {
+        if (m_formats & variant.Family) {
+            return variant.Family;
+        }
+    }
+    return TEXTURE_UNCOMPRESSED;
+}
+
+TexturePtr TextureManager::load(const std::string &name) {
+    auto found = m_textures.find(name);
+    if (found != m_textures.end()) {
+        TexturePtr texture = found->second.lock();
+        if (texture) {
+            return texture;
+        }
+    }
+    TexturePtr texture = std::make_shared<Texture>();
+    m_textures[name] = texture;
+
+    std::weak_ptr<Texture> weak = texture;
+    uint32_t formats = m_formats;
+    AsyncLoader::Get()->submit([this, weak, name, formats]() -> AsyncLoader::UploadTask {
+        std::vector<std::string> assets;
+        if (endsWith(name, ".ktx") || endsWith(name, ".ktx2")) {
+            assets.push_back(name);
+        } else {
+            for (const auto &variant : VARIANTS) {
+                if (formats & variant.Family) {
+                    assets.push_back(name + variant.Suffix);
+                }
+            }
+        }
+        // a broken variant falls back to the next one
+        for (const std::string &asset : assets) {
+            auto file = std::make_shared<AssetView>();
+            if (!AssetHelper::Get()->AssetOpenView(asset, *file)) {
+                continue;
+            }
+            // the levels point into the mapped file, both go to the upload
+            auto view = std::make_shared<TextureView>();
+            if (!ParseKtx(file->data(), file->size(), *view)) {
+                ALOGE("Invalid texture: %s!", asset.c_str());
+                continue;
+            }
+            if (!(formats & TextureFormatFamily(view->InternalFormat))) {
+                ALOGE("Texture %s has format 0x%x the context can't sample!", asset.c_str(),
+                      view->InternalFormat);
+                continue;
+            }
+            return [this, weak, file, view, asset]() {
+                upload(weak, file, view, asset);
+            };
+        }
+        return [this, name]() {
+            ALOGE("No usable texture for %s!", name.c_str());
+            m_failed++;
+        };
+    });
+    return texture;
+}
+
+void TextureManager::upload(const std::weak_ptr<Texture> &weak, const std::shared_ptr<AssetView> &file,
+                            const std::shared_ptr<TextureView> &view, const std::string &asset) {
+    TexturePtr texture = weak.lock();
+    if (!texture) {
+        return;
+    }
+    texture->InternalFormat = view->InternalFormat;
+    texture->Width = view->Width;
+    texture->Height = view->Height;
+    texture->Levels = (uint32_t)view->Levels.size();
+    texture->Asset = asset;
+    TextureStreamer *streamer = TextureStreamer::Get();
+    if (streamer->isEnabled() && texture->Levels > 1) {
+        // the streamer uploads the small levels and pages in the rest
+        texture->Source = file;
+        texture->SourceView = view;
+        if (!streamer->add(texture)) {
+            texture->Source.reset();
+            texture->SourceView.reset();
+            m_failed++;
+            return;
+        }
+    } else {
+        GLuint id = 0;
+        if (!UploadTexture(*view, id)) {
+            m_failed++;
+            return;
+        }
+        texture->Id = id;
+        if (view->GenerateMipmaps) {
+            for (int32_t size = std::max(view->Width, view->Height); size > 1; size >>= 1) {
+                texture->Levels++;
+            }
+        }
+        texture->Bytes = TextureMemorySize(*view);
+        texture->UncompressedBytes = 0;
+        for (uint32_t i = 0; i < texture->Levels; ++i) {
+            texture->UncompressedBytes += TextureLevelSize(GL_RGBA8, std::max(1, view->Width >> i),
+                                                           std::max(1, view->Height >> i));
+        }
+    }
+    if (!view->isCompressed()) {
+        m_fallbacks++;
+    }
+}
+
+void TextureManager::clear() {
+    for (auto &entry : m_textures) {
+        TexturePtr texture = entry.second.lock();
+        if (texture && texture->Id) {
+            GLStateCache::Current()->deleteTextures(1, &texture->Id);
+            texture->Id = 0;
+        }
+    }
+    m_textures.clear();
+}
+
+TextureStats TextureManager::stats() {
+    TextureStats stats;
+    auto it = m_textures.begin();
+    while (it != m_textures.end()) {
+        TexturePtr texture = it->second.lock();
+        if (!texture) {
+            it = m_textures.erase(it);
+            continue;
+        }
+        if (texture->isReady()) {
+            stats.Textures++;
+            stats.Bytes += texture->Bytes;
+            stats.UncompressedBytes += texture->UncompressedBytes;
+        }
+        ++it;
+    }
+    stats.Fallbacks = m_fallbacks;
+    stats.Failed = m_failed;
+    return stats;
+}
+
+} // namespace util
@@ -0,0 +1,336 @@
+#include "TextureStreamer.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "GLStateCache.h"
+#include "LogUtil.h"
+
+namespace util {
+
+// glTexStorage2D takes sized formats only
+static GLenum sizedFormat(GLenum internalFormat) {
+    switch (internalFormat) {
+    case GL_RGB: return GL_RGB8;
+    case GL_RGBA: return GL_RGBA8;
+    default: return internalFormat;
+    }
+}
+
+TextureStreamer *TextureStreamer::Get() {
+    static TextureStreamer streamer;
+    return &streamer;
+}
+
+TextureStreamer::TextureStreamer() :
+    m_baseBudget(0), m_budget(0), m_uploadBudget(4 * 1024 * 1024), m_tailSize(64), m_frame(1), m_pending(false) {
+}
+
+bool TextureStreamer::init() {
+    release();
+    return true;
+}
+
+bool TextureStreamer::stage() {
+    if (m_staging.isValid()) {
+        return true;
+    }
+    // not while streaming is off, uploads are direct until then
+    if (!isEnabled() || !m_staging.init(m_uploadBudget, 2)) {
+        return false;
+    }
+    // a staging region stays open from one update() to the next
+    m_staging.beginFrame();
+    return true;
+}
+
+void TextureStreamer::release() {
+    m_staging.release();
+    m_textures.clear();
+    m_pending = false;
+}
+
+uint32_t TextureStreamer::tailLevel(const Texture &texture) const {
+    uint32_t level = 0;
+    while (level + 1 < texture.Levels &&
+           std::max(texture.Width >> level, texture.Height >> level) > m_tailSize) {
+        level++;
+    }
+    return level;
+}
+
+size_t TextureStreamer::chainSize(const Texture &texture, uint32_t base) const {
+    size_t size = 0;
+    for (uint32_t i = base; i < texture.Levels; ++i) {
+        size += TextureLevelSize(texture.InternalFormat, std::max(1, texture.Width >> i),
+                                 std::max(1, texture.Height >> i));
+    }
+    return size;
+}
+
+bool TextureStreamer::rebuild(Texture &texture, uint32_t base) {
+    const TextureView &view = *texture.SourceView;
+    // report only our own errors
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    GLStateCache *state = GLStateCache::Current();
+    GLuint id = 0;
+    glGenTextures(1, &id);
+    state->bindTexture(GL_TEXTURE_2D, id);
+    glTexStorage2D(GL_TEXTURE_2D, texture.Levels - base, sizedFormat(view.InternalFormat),
+                   view.Levels[base].Width, view.Levels[base].Height);
+    if (!view.isCompressed()) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, view.RowAlignment);
+    }
+    size_t uploaded = 0;
+    for (uint32_t i = base; i < texture.Levels; ++i) {
+        const TextureLevel &level = view.Levels[i];
+        // staged, the GPU copies it when it gets to the upload
+        RingAllocation staging = m_staging.allocate(level.Size, 4);
+        const void *data = level.Data;
+        if (staging.Data) {
+            memcpy(staging.Data, level.Data, level.Size);
+            m_staging.flush();
+            data = (const void *)staging.Offset;
+        } else {
+            m_stats.DirectUploads++;
+        }
+        state->bindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.Data ? staging.Buffer : 0);
+        if (view.isCompressed()) {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, i - base, 0, 0, level.Width, level.Height,
+                                      view.InternalFormat, (GLsizei)level.Size, data);
+        } else {
+            glTexSubImage2D(GL_TEXTURE_2D, i - base, 0, 0, level.Width, level.Height, view.Format,
+                            view.Type, data);
+        }
+        uploaded += level.Size;
+    }
+    state->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!view.isCompressed()) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    bool mipmapped = texture.Levels - base > 1;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    state->bindTexture(GL_TEXTURE_2D, 0);
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        ALOGE("Unable to stream %s from level %u, error 0x%x!", texture.Asset.c_str(), base, error);
+        state->deleteTextures(1, &id);
+        return false;
+    }
+    // the old texture is freed once the frames drawing it are done
+    if (texture.Id) {
+        state->deleteTextures(1, &texture.Id);
+    }
+    texture.Id = id;
+    texture.BaseLevel = base;
+    texture.Bytes = chainSize(texture, base);
+    state->memory()->track(GpuMemory::TEXTURE, id, GPU_MEMORY_TEXTURES, texture.Bytes);
+    texture.UncompressedBytes = 0;
+    for (uint32_t i = base; i < texture.Levels; ++i) {
+        texture.UncompressedBytes += TextureLevelSize(GL_RGBA8, view.Levels[i].Width, view.Levels[i].Height);
+    }
+    m_stats.UploadedBytes += uploaded;
+    return true;
+}
+
+bool TextureStreamer::add(const TexturePtr &texture) {
+    if (!texture->SourceView || texture->Levels == 0) {
+        return false;
+    }
+    uint32_t tail = tailLevel(*texture);
+    texture->WantedLevel = tail;
+    texture->LastUsed = 0;
+    stage();
+    if (!rebuild(*texture, tail)) {
+        return false;
+    }
+    m_textures.push_back(texture);
+    return true;
+}
+
+void TextureStreamer::request(Texture &texture, float screenSize) {
+    if (!texture.Source) {
+        return;
+    }
+    // the coarsest level still covering the screen size
+    uint32_t level = 0;
+    float size = (float)std::max(texture.Width, texture.Height);
+    while (level + 1 < texture.Levels && size * 0.5f >= screenSize) {
+        size *= 0.5f;
+        level++;
+    }
+    if (texture.LastUsed != m_frame) {
+        texture.LastUsed = m_frame;
+        texture.WantedLevel = level;
+    } else {
+        texture.WantedLevel = std::min(texture.WantedLevel, level);
+    }
+}
+
+size_t TextureStreamer::evict(size_t resident, size_t target, uint64_t before) {
+    std::vector<TexturePtr> textures;
+    for (auto &weak : m_textures) {
+        TexturePtr texture = weak.lock();
+        if (texture && texture->Id) {
+            textures.push_back(texture);
+        }
+    }
+    std::sort(textures.begin(), textures.end(), [](const TexturePtr &a, const TexturePtr &b) {
+        return a->LastUsed < b->LastUsed;
+    });
+    // levels finer than asked for go first, then whole chains down to the
+    // tail, least recently drawn first
+    for (int pass = 0; pass < 2 && resident > target; ++pass) {
+        for (auto &texture : textures) {
+            if (resident <= target) {
+                break;
+            }
+            uint32_t tail = tailLevel(*texture);
+            uint32_t limit = pass == 0 ? std::min(texture->WantedLevel, tail) :
+                                         (texture->LastUsed < before ? tail : texture->BaseLevel);
+            uint32_t base = texture->BaseLevel;
+            size_t size = texture->Bytes;
+            while (base < limit && resident - texture->Bytes + size > target) {
+                size = chainSize(*texture, ++base);
+            }
+            if (base == texture->BaseLevel) {
+                continue;
+            }
+            uint32_t levels = base - texture->BaseLevel;
+            size_t bytes = texture->Bytes;
+            if (rebuild(*texture, base)) {
+                resident = resident - bytes + texture->Bytes;
+                m_stats.Evictions += levels;
+            }
+        }
+    }
+    return resident;
+}
+
+void TextureStreamer::update() {
+    m_pending = false;
+    std::vector<TexturePtr> missing;
+    size_t resident = 0;
+    auto it = m_textures.begin();
+    while (it != m_textures.end()) {
+        TexturePtr texture = it->lock();
+        // dropped by its holders or by TextureManager::clear()
+        if (!texture || !texture->Id) {
+            it = m_textures.erase(it);
+            continue;
+        }
+        resident += texture->Bytes;
+        if (texture->LastUsed == m_frame && texture->WantedLevel < texture->BaseLevel) {
+            missing.push_back(texture);
+        }
+        ++it;
+    }
+
+    // the textures furthest from what they need first
+    std::sort(missing.begin(), missing.end(), [](const TexturePtr &a, const TexturePtr &b) {
+        return a->BaseLevel - a->WantedLevel > b->BaseLevel - b->WantedLevel;
+    });
+    m_stats.MissingLevels = 0;
+    if (!missing.empty()) {
+        stage();
+    }
+    size_t uploaded = 0;
+    for (auto &texture : missing) {
+        m_stats.MissingLevels += texture->BaseLevel - texture->WantedLevel;
+        if (!isEnabled()) {
+            continue;
+        }
+        // one level per frame, the upload budget bounds the frame's hitch
+        uint32_t base = texture->BaseLevel - 1;
+        size_t size = chainSize(*texture, base);
+        if (uploaded && uploaded + size > m_uploadBudget) {
+            m_pending = true;
+            continue;
+        }
+        size_t growth = size - texture->Bytes;
+        if (resident + growth > m_budget) {
+            // only from textures this frame didn't draw
+            resident = evict(resident, growth < m_budget ? m_budget - growth : 0, m_frame);
+            if (resident + growth > m_budget) {
+                continue;
+            }
+        }
+        size_t bytes = texture->Bytes;
+        if (rebuild(*texture, base)) {
+            resident = resident - bytes + texture->Bytes;
+            uploaded += size;
+            m_stats.PageIns++;
+            m_pending = m_pending || base > texture->WantedLevel;
+        }
+    }
+    // after a trim or new textures
+    if (isEnabled() && resident > m_budget) {
+        evict(resident, m_budget, m_frame + 1);
+    }
+
+    m_staging.endFrame();
+    m_staging.beginFrame();
+    m_frame++;
+}
+
+bool TextureStreamer::setBudgetScale(float scale) {
+    if (!isEnabled()) {
+        return false;
+    }
+    // 0 would turn streaming off and load everything in full
+    size_t budget = std::max((size_t)(m_baseBudget * std::min(std::max(scale, 0.0f), 1.0f)), (size_t)1);
+    if (budget == m_budget) {
+        return true;
+    }
+    m_budget = budget;
+    size_t resident = residentBytes();
+    size_t trimmed = evict(resident, m_budget, m_frame + 1);
+    ALOGV("Texture budget set to %zu kB, %zu of %zu kB resident", m_budget / 1024, trimmed / 1024,
+          resident / 1024);
+    return true;
+}
+
+void TextureStreamer::dropUnrequested() {
+    // nothing counts as undrawn, only the first pass runs
+    evict(residentBytes(), 0, 0);
+    // staged again when levels are missing
+    if (!m_pending) {
+        m_staging.release();
+    }
+}
+
+void TextureStreamer::dropHidden() {
+    // update() has moved on to the next frame
+    evict(residentBytes(), 0, m_frame - 1);
+}
+
+size_t TextureStreamer::residentBytes() const {
+    size_t resident = 0;
+    for (auto &weak : m_textures) {
+        TexturePtr texture = weak.lock();
+        if (texture && texture->Id) {
+            resident += texture->Bytes;
+        }
+    }
+    return resident;
+}
+
+TextureStreamingStats TextureStreamer::stats() const {
+    TextureStreamingStats stats = m_stats;
+    stats.Textures = 0;
+    stats.ResidentBytes = 0;
+    for (auto &weak : m_textures) {
+        TexturePtr texture = weak.lock();
+        if (texture && texture->Id) {
+            stats.Textures++;
+            stats.ResidentBytes += texture->Bytes;
+        }
+    }
+    stats.Budget = m_budget;
+    return stats;
+}
+
+} // namespace util
@@ -0,0 +1,79 @@
+#include "ThreadPool.h"
+
+namespace util {
+
+ThreadPool::ThreadPool(unsigned int threads) :
+    m_task(nullptr), m_count(0), m_next(0), m_generation(0), m_busy(0), m_quit(false) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    for (unsigned int i = 1; i < threads; ++i) {
+        m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (auto &worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)> &task) {
+    if (count == 0) {
+        return;
+    }
+    if (m_workers.empty() || count == 1) {
+        for (uint32_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_busy = m_workers.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+    runTasks();
+
+    // the task must outlive every worker still inside it
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busy == 0; });
+    m_task = nullptr;
+}
+
+void ThreadPool::runTasks() {
+    for (uint32_t i = m_next++; i < m_count; i = m_next++) {
+        (*m_task)(i);
+    }
+}
+
+void ThreadPool::workerLoop() {
+    uint32_t generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this, generation] { return m_quit || m_generation != generation; });
+            if (m_quit) {
+                return;
+            }
+            generation = m_generation;
+        }
+        runTasks();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy--;
+        }
+        m_done.notify_one();
+    }
+}
+
+} // namespace util